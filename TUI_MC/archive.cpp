@@ -0,0 +1,626 @@
+#include "archive.h"
+#include "profiler.h"
+
+#include <cstdlib>
+#include <unordered_set>
+#include <cstring>
+#include <fcntl.h>
+
+std::string TarArchive::Parser::outcome() const {
+    if (error.empty() && !ended && archive.members.empty()) return "not a tar archive";
+    return error;
+}
+
+uint64_t TarArchive::Parser::parse_number(const uint8_t* field, size_t length) {
+    if (field[0] & 0x80) {
+        uint64_t value = field[0] & 0x3f;
+        for (size_t i = 1; i < length; i++) value = value << 8 | field[i];
+        return value;
+    }
+    uint64_t value = 0;
+    size_t i = 0;
+    while (i < length && field[i] == ' ') i++;
+    for (; i < length && field[i] >= '0' && field[i] <= '7'; i++) value = value * 8 + (field[i] - '0');
+    return value;
+}
+
+std::string TarArchive::Parser::field(const uint8_t* data, size_t length) {
+    const char* text = reinterpret_cast<const char*>(data);
+    return std::string(text, strnlen(text, length));
+}
+
+std::string TarArchive::Parser::normalize(std::string name) {
+    size_t start = 0;
+    while (true) {
+        if (name.compare(start, 2, "./") == 0) start += 2;
+        else if (start < name.size() && name[start] == '/') start++;
+        else break;
+    }
+    name.erase(0, start);
+    while (!name.empty() && name.back() == '/') name.pop_back();
+    if (name == ".") name.clear();
+    for (size_t at = 0; at < name.size(); ) {
+        size_t end = name.find('/', at);
+        if (end == std::string::npos) end = name.size();
+        if (name.compare(at, end - at, "..") == 0) return std::string();
+        at = end + 1;
+    }
+    return name;
+}
+
+bool TarArchive::Parser::valid_checksum() const {
+    unsigned sum = 0;
+    int signed_sum = 0;
+    for (size_t i = 0; i < BLOCK; i++) {
+        uint8_t byte = i >= 148 && i < 156 ? ' ' : block[i];
+        sum += byte;
+        signed_sum += static_cast<int8_t>(byte);
+    }
+    uint64_t stored = parse_number(block + 148, 8);
+    return stored == sum || stored == static_cast<uint64_t>(signed_sum);
+}
+
+void TarArchive::Parser::parse_pax() {
+    size_t pos = 0;
+    while (pos < extended.size()) {
+        size_t space = extended.find(' ', pos);
+        size_t length = strtoull(extended.c_str() + pos, nullptr, 10);
+        if (space == std::string::npos || length == 0 || pos + length > extended.size()) break;
+        size_t equals = extended.find('=', space);
+        if (equals == std::string::npos || equals + 1 >= pos + length) break;
+        std::string key = extended.substr(space + 1, equals - space - 1);
+        std::string value = extended.substr(equals + 1, pos + length - equals - 2);
+        if (key == "path") {
+            pax_path = value;
+        } else if (key == "linkpath") {
+            pax_link = value;
+        } else if (key == "size") {
+            pax_size = strtoull(value.c_str(), nullptr, 10);
+            has_pax_size = true;
+        } else if (key == "mtime") {
+            pax_mtime = strtoll(value.c_str(), nullptr, 10);
+            has_pax_mtime = true;
+        }
+        pos += length;
+    }
+}
+
+void TarArchive::Parser::finish_extended() {
+    const uint8_t* text = reinterpret_cast<const uint8_t*>(extended.data());
+    if (extended_type == 'L') long_name = field(text, extended.size());
+    else if (extended_type == 'K') long_link = field(text, extended.size());
+    else if (extended_type == 'x') parse_pax();
+    extended.clear();
+    skip = padding;
+}
+
+void TarArchive::Parser::header() {
+    static const uint8_t zeros[BLOCK] = {};
+    if (memcmp(block, zeros, BLOCK) == 0) {
+        ended = true;
+        return;
+    }
+    if (!valid_checksum()) {
+        error = archive.members.empty() ? "not a tar archive"
+                                        : "bad header at offset " + std::to_string(position - BLOCK);
+        return;
+    }
+    char type = static_cast<char>(block[156]);
+    uint64_t size = parse_number(block + 124, 12);
+    if (type == 'L' || type == 'K' || type == 'x' || type == 'g') {
+        if (size > MAX_EXTENDED) {
+            error = "oversized extended header at offset " + std::to_string(position - BLOCK);
+            return;
+        }
+        extended_type = type;
+        collect = size;
+        padding = pad(size);
+        if (!collect) finish_extended();
+        return;
+    }
+
+    std::string name = long_name;
+    if (name.empty()) name = pax_path;
+    if (name.empty()) {
+        name = field(block, 100);
+        // POSIX ustar splits long names; old GNU headers keep other fields there.
+        if (memcmp(block + 257, "ustar\0", 6) == 0 && block[345]) name = field(block + 345, 155) + "/" + name;
+    }
+    std::string link = !long_link.empty() ? long_link : !pax_link.empty() ? pax_link : field(block + 157, 100);
+    if (has_pax_size) size = pax_size;
+    int64_t mtime = has_pax_mtime ? pax_mtime : static_cast<int64_t>(parse_number(block + 136, 12));
+    long_name.clear();
+    long_link.clear();
+    pax_path.clear();
+    pax_link.clear();
+    has_pax_size = has_pax_mtime = false;
+
+    uint32_t mode = parse_number(block + 100, 8) & 07777;
+    uint64_t data = size;
+    switch (type) {
+        case '5': mode |= S_IFDIR; data = 0; break;
+        case 'D': mode |= S_IFDIR; break;    // GNU dumpdir: a directory with a listing as data
+        case '2': mode |= S_IFLNK; data = 0; break;
+        case '3': mode |= S_IFCHR; data = 0; break;
+        case '4': mode |= S_IFBLK; data = 0; break;
+        case '6': mode |= S_IFIFO; data = 0; break;
+        case '1': mode |= S_IFREG; data = 0; break;
+        case 'V': mode = 0; break;           // volume label
+        default: mode |= S_IFREG; break;
+    }
+    skip = data + pad(data);
+    name = normalize(name);
+    if (!mode || name.empty()) return;
+
+    Member member;
+    member.offset = position;
+    member.size = S_ISREG(mode) && type != '1' ? size : 0;
+    member.mtime = mtime;
+    member.mode = mode;
+    member.name = archive.store(name);
+    // A hard link to an absolute or ".." path keeps its raw target, which no member is named.
+    if (type == '1') member.link = archive.store(contained(link) ? normalize(link) : link);
+    else if (type == '2' && !link.empty()) member.link = archive.store(link);
+    archive.members.push_back(member);
+}
+
+void TarArchive::Parser::consume(const uint8_t* data, size_t n) {
+    while (n > 0 && !done()) {
+        size_t take;
+        if (skip) {
+            take = std::min<uint64_t>(skip, n);
+            skip -= take;
+            position += take;
+        } else if (collect) {
+            take = std::min<uint64_t>(collect, n);
+            extended.append(reinterpret_cast<const char*>(data), take);
+            collect -= take;
+            position += take;
+            if (!collect) finish_extended();
+        } else {
+            take = std::min(BLOCK - filled, n);
+            memcpy(block + filled, data, take);
+            filled += take;
+            position += take;
+            if (filled == BLOCK) {
+                filled = 0;
+                header();
+            }
+        }
+        data += take;
+        n -= take;
+    }
+}
+
+uint32_t TarArchive::store(const std::string& name) {
+    uint32_t at = names.size();
+    names.append(name);
+    names.push_back('\0');
+    return at;
+}
+
+std::string_view TarArchive::parent_of(std::string_view path) {
+    size_t slash = path.rfind('/');
+    return slash == std::string_view::npos ? std::string_view() : path.substr(0, slash);
+}
+
+std::string TarArchive::index_plain(int fd, OperationProgress& progress) {
+    Parser parser(*this);
+    std::vector<uint8_t> buffer(CHUNK);
+    while (!parser.done()) {
+        if (progress.cancelled) return std::strerror(ECANCELED);
+        parser.position += parser.skip;
+        parser.skip = 0;
+        ssize_t n = pread(fd, buffer.data(), buffer.size(), parser.position);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return std::strerror(errno);
+        }
+        if (n == 0) break;   // no end-of-archive blocks: take what is there
+        parser.consume(buffer.data(), n);
+        progress.bytes_done = parser.position;
+        progress.files_done = progress.files_total = members.size();
+    }
+    return parser.outcome();
+}
+
+std::string TarArchive::index_compressed(int fd, OperationProgress& progress) {
+    Parser parser(*this);
+    z_stream strm{};
+    if (inflateInit2(&strm, 47) != Z_OK) return "out of memory";   // 32 + 15: gzip or zlib header
+    std::vector<uint8_t> input(CHUNK), window(WINDOW_SIZE);
+    uint64_t total_in = 0, total_out = 0, last = 0;
+    int ret = Z_OK;
+    bool between = false;   // a gzip member just ended and no byte of another was read
+    std::string error;
+    while (!parser.done() && error.empty()) {
+        if (progress.cancelled) {
+            error = std::strerror(ECANCELED);
+            break;
+        }
+        ssize_t n = read(fd, input.data(), input.size());
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            error = std::strerror(errno);
+            break;
+        }
+        if (n == 0) {
+            if (between) {
+                points.pop_back();
+            } else {
+                error = "unexpected end of compressed data";
+            }
+            break;
+        }
+        progress.bytes_done += n;
+        strm.next_in = input.data();
+        strm.avail_in = n;
+        do {
+            if (strm.avail_out == 0) {
+                strm.next_out = window.data();
+                strm.avail_out = WINDOW_SIZE;
+            }
+            uint8_t* produced = strm.next_out;
+            total_in += strm.avail_in;
+            total_out += strm.avail_out;
+            ret = inflate(&strm, Z_BLOCK);
+            between = false;
+            total_in -= strm.avail_in;
+            total_out -= strm.avail_out;
+            parser.consume(produced, strm.next_out - produced);
+            if (ret == Z_NEED_DICT || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR || ret == Z_STREAM_ERROR) {
+                error = strm.msg ? strm.msg : "corrupt compressed data";
+                break;
+            }
+            if (parser.done()) break;
+            if (ret == Z_STREAM_END) {
+                // Another member may follow. It cannot refer back to this
+                // one, so its point needs only the header's offset.
+                if (inflateReset(&strm) != Z_OK) {
+                    error = "corrupt compressed data";
+                    break;
+                }
+                points.push_back(AccessPoint{total_in, total_out, 0, {}, true});
+                last = total_out;
+                between = true;
+                continue;
+            }
+            // At the end of a block: nothing of the next block is consumed
+            // yet except up to seven bits, which the point records.
+            if ((strm.data_type & 128) && !(strm.data_type & 64) && (total_out == 0 || total_out - last > SPAN)) {
+                AccessPoint point{total_in, total_out, strm.data_type & 7, std::vector<uint8_t>(WINDOW_SIZE)};
+                size_t left = strm.avail_out;
+                if (left) memcpy(point.window.data(), window.data() + WINDOW_SIZE - left, left);
+                if (left < WINDOW_SIZE) memcpy(point.window.data() + left, window.data(), WINDOW_SIZE - left);
+                points.push_back(std::move(point));
+                last = total_out;
+            }
+        } while (strm.avail_in != 0);
+        progress.files_done = progress.files_total = members.size();
+    }
+    inflateEnd(&strm);
+    if (!error.empty()) return error;
+    return parser.outcome();
+}
+
+void TarArchive::build_tree() {
+    std::unordered_set<std::string> seen;
+    size_t count = members.size();
+    for (size_t i = 0; i < count; i++) seen.insert(std::string(name(members[i])));
+    for (size_t i = 0; i < count; i++) {
+        std::string path(name(members[i]));
+        for (size_t slash = path.rfind('/'); slash != std::string::npos && slash > 0;
+             slash = path.rfind('/', slash - 1)) {
+            std::string parent = path.substr(0, slash);
+            if (!seen.insert(parent).second) break;
+            Member directory;
+            directory.mode = S_IFDIR | 0755;
+            directory.name = store(parent);
+            members.push_back(directory);
+        }
+    }
+    by_path.reserve(members.size());
+    for (uint32_t i = 0; i < members.size(); i++) by_path[name(members[i])] = i;
+    for (const auto& [path, id] : by_path) children[parent_of(path)].push_back(id);
+}
+
+const TarArchive::AccessPoint& TarArchive::point_before(uint64_t offset) const {
+    auto it = std::upper_bound(points.begin(), points.end(), offset,
+                               [](uint64_t value, const AccessPoint& point) { return value < point.out; });
+    return *(it == points.begin() ? it : it - 1);
+}
+
+int TarArchive::Reader::seek(const AccessPoint& point) {
+    positioned = false;
+    if (point.header) {
+        if (inflateReset2(&strm, 47) != Z_OK) return ENOMEM;
+        in = point.in;
+        strm.avail_in = 0;
+        out = point.out;
+        positioned = true;
+        return 0;
+    }
+    if (inflateReset2(&strm, -15) != Z_OK) return ENOMEM;
+    in = point.in - (point.bits ? 1 : 0);
+    strm.avail_in = 0;
+    if (point.bits) {
+        uint8_t byte;
+        if (pread(fd, &byte, 1, in) != 1) return EIO;
+        in++;
+        inflatePrime(&strm, point.bits, byte >> (8 - point.bits));
+    }
+    inflateSetDictionary(&strm, point.window.data(), WINDOW_SIZE);
+    out = point.out;
+    positioned = true;
+    return 0;
+}
+
+TarArchive::Reader::Reader(const TarArchive& archive) : archive(archive), input(CHUNK), output(CHUNK) {
+    fd = ::open(archive.file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (archive.compressed) inflating = inflateInit2(&strm, -15) == Z_OK;
+}
+
+TarArchive::Reader::~Reader() {
+    if (inflating) inflateEnd(&strm);
+    if (fd >= 0) close(fd);
+}
+
+bool TarArchive::is_archive_name(const std::string& name) {
+    auto ends_with = [&name](const char* suffix) {
+        size_t length = strlen(suffix);
+        return name.size() > length && strcasecmp(name.c_str() + name.size() - length, suffix) == 0;
+    };
+    return ends_with(".tar") || ends_with(".tar.gz") || ends_with(".tgz");
+}
+
+std::shared_ptr<TarArchive> TarArchive::open(const fs::path& path, OperationProgress& progress, std::string& error) {
+    ScopedTimer timer(Profiler::ARCHIVE);
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        error = std::strerror(errno);
+        if (fd >= 0) close(fd);
+        return nullptr;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    auto archive = std::make_shared<TarArchive>();
+    archive->file = path;
+    archive->dev = st.st_dev;
+    archive->ino = st.st_ino;
+    archive->mtime = st.st_mtim.tv_sec * 1000000000ll + st.st_mtim.tv_nsec;
+    archive->names.push_back('\0');
+    progress.bytes_total = st.st_size;
+    progress.planning = false;
+    uint8_t magic[2] = {0, 0};
+    archive->compressed = pread(fd, magic, 2, 0) == 2 && magic[0] == 0x1f && magic[1] == 0x8b;
+    error = archive->compressed ? archive->index_compressed(fd, progress) : archive->index_plain(fd, progress);
+    close(fd);
+    if (!error.empty()) return nullptr;
+    archive->build_tree();
+    return archive;
+}
+
+bool TarArchive::matches(uint64_t file_dev, uint64_t file_ino, int64_t file_mtime) const {
+    return dev == file_dev && ino == file_ino && mtime == file_mtime;
+}
+
+bool TarArchive::contained(std::string_view target) {
+    if (target.empty() || target[0] == '/') return false;
+    for (size_t at = 0; at <= target.size(); ) {
+        size_t end = std::min(target.find('/', at), target.size());
+        if (target.substr(at, end - at) == "..") return false;
+        at = end + 1;
+    }
+    return true;
+}
+
+const TarArchive::Member* TarArchive::find(std::string_view path) const {
+    auto it = by_path.find(path);
+    return it == by_path.end() ? nullptr : &members[it->second];
+}
+
+const TarArchive::Member& TarArchive::resolve(const Member& member) const {
+    if (!is_hard_link(member)) return member;
+    const Member* target = find(link(member));
+    return target && !is_hard_link(*target) ? *target : member;
+}
+
+const std::vector<uint32_t>& TarArchive::entries(std::string_view dir) const {
+    static const std::vector<uint32_t> none;
+    auto it = children.find(dir);
+    return it == children.end() ? none : it->second;
+}
+
+void TarArchive::collect(std::string_view dir, std::vector<uint32_t>& found) const {
+    for (uint32_t id : entries(dir)) {
+        found.push_back(id);
+        if (S_ISDIR(members[id].mode)) collect(name(members[id]), found);
+    }
+}
+
+std::string ArchiveExtractor::describe(const std::string& path, int err) const {
+    return (base / path).string() + ": " + std::strerror(err);
+}
+
+int ArchiveExtractor::open_parent(const std::string& path, std::string& leaf) {
+    size_t slash = path.rfind('/');
+    leaf = slash == std::string::npos ? path : path.substr(slash + 1);
+    std::string dir = slash == std::string::npos ? std::string() : path.substr(0, slash);
+    if (parent_fd >= 0 && dir == parent) return parent_fd;
+    if (parent_fd >= 0) close(parent_fd);
+    parent_fd = -1;
+    int fd = dup(base_fd);
+    for (size_t at = 0; fd >= 0 && at < dir.size(); ) {
+        size_t end = std::min(dir.find('/', at), dir.size());
+        std::string name = dir.substr(at, end - at);
+        if (mkdirat(fd, name.c_str(), 0700) != 0 && errno != EEXIST) {
+            int err = errno;
+            close(fd);
+            errno = err;
+            return -1;
+        }
+        int next = openat(fd, name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        int err = errno;
+        close(fd);
+        errno = err;
+        fd = next;
+        at = end + 1;
+    }
+    if (fd < 0) return -1;
+    parent = dir;
+    parent_fd = fd;
+    return fd;
+}
+
+bool ArchiveExtractor::extract_file(TarArchive::Reader& reader, const Job& job) {
+    const TarArchive::Member& member = *job.member;
+    if (TarArchive::is_hard_link(member) && &archive->resolve(member) == &member) {
+        progress.fail((base / job.path).string() + ": hard link target is not in the archive");
+        return false;
+    }
+    std::string leaf;
+    int dir = open_parent(job.path, leaf);
+    int out = dir < 0 ? -1 : openat(dir, leaf.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC,
+                                    member.mode & 07777);
+    if (out < 0) {
+        progress.fail(describe(job.path, errno));
+        return false;
+    }
+    int write_error = 0;
+    int err = reader.read(member, [&](const uint8_t* data, size_t length) {
+        if (progress.cancelled) return false;
+        for (size_t written = 0; written < length; ) {
+            ssize_t n = write(out, data + written, length - written);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) {
+                write_error = errno;
+                return false;
+            }
+            written += n;
+        }
+        progress.bytes_done += length;
+        return true;
+    });
+    if (write_error) err = write_error;
+    if (!err) {
+        timespec times[2] = {{0, UTIME_OMIT}, {member.mtime, 0}};
+        futimens(out, times);
+    }
+    if (close(out) != 0 && !err) err = errno;
+    if (err) {
+        unlinkat(dir, leaf.c_str(), 0);
+        if (err != ECANCELED) progress.fail(describe(job.path, err));
+        return false;
+    }
+    return true;
+}
+
+bool ArchiveExtractor::extract_symlink(const Job& job) {
+    std::string_view target = archive->link(*job.member);
+    if (!TarArchive::contained(target)) {
+        progress.fail((base / job.path).string() + ": link to " + std::string(target) +
+                      " points outside the destination");
+        return false;
+    }
+    std::string leaf;
+    int dir = open_parent(job.path, leaf);
+    if (dir < 0 || symlinkat(std::string(target).c_str(), dir, leaf.c_str()) != 0) {
+        progress.fail(describe(job.path, errno));
+        return false;
+    }
+    return true;
+}
+
+void ArchiveExtractor::run(std::vector<std::string> sources, fs::path destination) {
+    ScopedTimer timer(Profiler::ARCHIVE);
+    std::error_code ec;
+    bool into_directory = fs::is_directory(destination, ec);
+    base = into_directory ? destination : destination.parent_path();
+    if (base.empty()) base = ".";
+    base_fd = open(base.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (base_fd < 0) {
+        progress.fail(base.string() + ": " + std::strerror(errno));
+        progress.finish();
+        return;
+    }
+    std::vector<Job> directories, files;
+    std::vector<uint32_t> below;
+    for (const auto& source : sources) {
+        const TarArchive::Member* member = archive->find(source);
+        if (!member) continue;
+        std::string top = (into_directory ? fs::path(source) : destination).filename().string();
+        struct stat st;
+        if (fstatat(base_fd, top.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0 &&
+            !(S_ISDIR(member->mode) && S_ISDIR(st.st_mode))) {
+            progress.fail(describe(top, EEXIST));
+            continue;
+        }
+        (S_ISDIR(member->mode) ? directories : files).push_back({member, top});
+        below.clear();
+        archive->collect(source, below);
+        for (uint32_t id : below) {
+            const TarArchive::Member& inner = archive->member(id);
+            std::string path = top + "/" + std::string(archive->name(inner).substr(source.size() + 1));
+            (S_ISDIR(inner.mode) ? directories : files).push_back({&inner, path});
+        }
+    }
+    for (const Job& job : files) progress.bytes_total += archive->resolve(*job.member).size;
+    progress.files_total = directories.size() + files.size();
+    progress.planning = false;
+
+    std::string leaf;
+    for (const Job& job : directories) {
+        if (progress.cancelled) break;
+        int dir = open_parent(job.path, leaf);
+        if (dir < 0 || (mkdirat(dir, leaf.c_str(), 0700) != 0 && errno != EEXIST)) {
+            progress.fail(describe(job.path, errno));
+        }
+        progress.files_done++;
+    }
+    std::sort(files.begin(), files.end(), [this](const Job& a, const Job& b) {
+        return archive->resolve(*a.member).offset < archive->resolve(*b.member).offset;
+    });
+    TarArchive::Reader reader(*archive);
+    for (const Job& job : files) {
+        if (progress.cancelled) break;
+        const TarArchive::Member& member = *job.member;
+        if (S_ISREG(member.mode)) {
+            extract_file(reader, job);
+        } else if (S_ISLNK(member.mode)) {
+            extract_symlink(job);
+        } else {
+            progress.fail((base / job.path).string() + ": special files are not extracted");
+        }
+        progress.files_done++;
+    }
+    // Children before parents, so a parent that loses search permission is done last.
+    for (auto it = directories.rbegin(); it != directories.rend(); ++it) {
+        int dir = open_parent(it->path, leaf);
+        int fd = dir < 0 ? -1 : openat(dir, leaf.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd < 0) continue;
+        timespec times[2] = {{0, UTIME_OMIT}, {it->member->mtime, 0}};
+        if (it->member->mtime) futimens(fd, times);
+        fchmod(fd, it->member->mode & 07777);
+        close(fd);
+    }
+    if (parent_fd >= 0) close(parent_fd);
+    close(base_fd);
+    parent_fd = base_fd = -1;
+    progress.finish();
+}
+
+ArchiveExtractor::ArchiveExtractor(std::shared_ptr<const TarArchive> archive, OperationProgress& progress)
+    : archive(std::move(archive)), progress(progress) {}
+
+ArchiveExtractor::~ArchiveExtractor() {
+    if (worker.joinable()) progress.cancelled = true;
+    wait();
+}
+
+void ArchiveExtractor::start(std::vector<std::string> sources, fs::path destination) {
+    worker = std::thread(&ArchiveExtractor::run, this, std::move(sources), std::move(destination));
+}
+
+void ArchiveExtractor::wait() {
+    if (worker.joinable()) worker.join();
+}
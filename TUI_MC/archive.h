@@ -0,0 +1,307 @@
+#pragma once
+
+#include "thread_pool.h"
+
+#include <filesystem>
+#include <cerrno>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <thread>
+#include <unordered_map>
+#include <memory>
+#include <algorithm>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+namespace fs = std::filesystem;
+
+// Tar archives, plain or gzip-compressed, browsed like directories. One pass
+// over the headers builds a compact member table (data offset, size, mode,
+// mtime, with every name packed into one arena) and the directory tree on
+// top of it. A plain tar is indexed by seeking past member data, so only the
+// headers are read. A .tar.gz must be inflated once in full; on the way an
+// access point - the deflate bit position and the 32 KiB window before it -
+// is kept every SPAN bytes of output, so a member is later read by
+// inflating from the nearest point before it rather than from the start.
+// Concatenated gzip members (cat a.gz b.gz, pigz -i) are inflated in turn,
+// each starting with an access point at its header.
+class TarArchive {
+public:
+    struct Member {
+        uint64_t offset = 0;     // of the data, in the uncompressed stream
+        uint64_t size = 0;
+        int64_t mtime = 0;       // seconds since the epoch
+        uint32_t mode = 0;       // permissions and S_IFMT type
+        uint32_t name = 0;       // into `names`
+        uint32_t link = 0;       // symlink or hard link target in `names`, 0 for none
+    };
+
+private:
+    static constexpr size_t BLOCK = 512;
+    static constexpr size_t WINDOW_SIZE = 32768;
+    static constexpr uint64_t SPAN = 8 * 1024 * 1024;     // uncompressed bytes between access points
+    static constexpr size_t CHUNK = 64 * 1024;
+    static constexpr uint64_t MAX_EXTENDED = 1024 * 1024; // long names and pax headers larger than this are refused
+
+    struct AccessPoint {
+        uint64_t in;                  // compressed offset of the first whole byte
+        uint64_t out;                 // uncompressed offset
+        int bits;                     // bits of the byte before `in` that still belong to the point
+        std::vector<uint8_t> window;  // the WINDOW_SIZE bytes of output before `out`
+        bool header = false;          // `in` is the start of a gzip member; no bits or window
+    };
+
+    // Takes the uncompressed stream in pieces of any size and appends a
+    // member for every header in it. Member data is counted off in `skip`
+    // without being looked at; a plain tar seeks over it instead.
+    struct Parser {
+        TarArchive& archive;
+        uint64_t position = 0;       // stream offset of the next byte
+        uint64_t skip = 0;           // member data and padding still to pass
+        uint64_t collect = 0;        // bytes of a long name or pax header still to read
+        uint64_t padding = 0;        // to skip after those
+        char extended_type = 0;
+        std::string extended;
+        std::string long_name, long_link, pax_path, pax_link;
+        uint64_t pax_size = 0;
+        int64_t pax_mtime = 0;
+        bool has_pax_size = false, has_pax_mtime = false;
+        uint8_t block[BLOCK];
+        size_t filled = 0;
+        bool ended = false;          // an end-of-archive block was seen
+        std::string error;
+
+        explicit Parser(TarArchive& archive) : archive(archive) {}
+
+        bool done() const { return ended || !error.empty(); }
+
+        // What went wrong, once the stream is over. A stream that ends early
+        // keeps the members before the cut, unless there were none.
+        std::string outcome() const;
+
+        static uint64_t pad(uint64_t size) { return (BLOCK - size % BLOCK) % BLOCK; }
+
+        // Octal, or GNU base-256 for values too large for the field.
+        static uint64_t parse_number(const uint8_t* field, size_t length);
+        static std::string field(const uint8_t* data, size_t length);
+
+        // Strips "./" and "/" in front and "/" at the end. Names with a ".."
+        // component come back empty, so nothing is ever extracted outside
+        // the destination.
+        static std::string normalize(std::string name);
+        bool valid_checksum() const;
+
+        // "<length> <key>=<value>\n" records of a pax extended header.
+        void parse_pax();
+        void finish_extended();
+        void header();
+        void consume(const uint8_t* data, size_t n);
+    };
+
+    fs::path file;
+    uint64_t dev = 0, ino = 0;
+    int64_t mtime = 0;                   // of the archive file, in nanoseconds
+    bool compressed = false;
+    std::vector<Member> members;
+    std::string names;                   // every name followed by '\0'; offset 0 is the empty name
+    std::vector<AccessPoint> points;     // by ascending `out`
+    std::unordered_map<std::string_view, uint32_t> by_path;
+    std::unordered_map<std::string_view, std::vector<uint32_t>> children;   // directory -> members in it
+
+    uint32_t store(const std::string& name);
+    static std::string_view parent_of(std::string_view path);
+    std::string index_plain(int fd, OperationProgress& progress);
+
+    // Inflates the whole stream once, as zran.c in the zlib examples does,
+    // feeding the output to the header parser and keeping an access point
+    // at a deflate block boundary every SPAN bytes.
+    std::string index_compressed(int fd, OperationProgress& progress);
+
+    // Adds the directories that only appear as parents of other members,
+    // then maps every path to its member (a later entry for the same path
+    // replaces an earlier one) and every directory to its contents.
+    void build_tree();
+    const AccessPoint& point_before(uint64_t offset) const;
+
+public:
+    // Reads member data. Every reader has its own descriptor and inflate
+    // state, and keeps inflating forward while the reads it is given move
+    // forward through the stream, so extracting members in offset order
+    // inflates each part of the archive once.
+    class Reader {
+    private:
+        const TarArchive& archive;
+        int fd = -1;
+        z_stream strm{};
+        bool inflating = false;      // strm is initialised
+        bool positioned = false;     // strm will produce stream offset `out` next
+        uint64_t in = 0;             // file offset of the next compressed byte
+        uint64_t out = 0;
+        std::vector<uint8_t> input, output;
+
+        int seek(const AccessPoint& point);
+
+        template <typename Sink>
+        int read_compressed(uint64_t offset, uint64_t length, Sink& sink) {
+            if (!length) return 0;
+            const AccessPoint& point = archive.point_before(offset);
+            if (!positioned || offset < out || point.out > out) {
+                int err = seek(point);
+                if (err) return err;
+            }
+            while (length > 0) {
+                if (strm.avail_in == 0) {
+                    ssize_t n = pread(fd, input.data(), input.size(), in);
+                    if (n < 0 && errno == EINTR) continue;
+                    if (n <= 0) {
+                        positioned = false;
+                        return n < 0 ? errno : EIO;
+                    }
+                    in += n;
+                    strm.next_in = input.data();
+                    strm.avail_in = n;
+                }
+                // Never inflate past the end of the read, so the next member
+                // can carry on from here.
+                strm.next_out = output.data();
+                strm.avail_out = std::min<uint64_t>(output.size(), offset + length - out);
+                uint64_t start = out;
+                int ret = inflate(&strm, Z_NO_FLUSH);
+                if (ret == Z_NEED_DICT || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR || ret == Z_STREAM_ERROR) {
+                    positioned = false;
+                    return EIO;
+                }
+                out += strm.next_out - output.data();
+                if (out > offset) {
+                    size_t skip = offset > start ? offset - start : 0;
+                    size_t take = out - start - skip;
+                    if (!sink(output.data() + skip, take)) return ECANCELED;
+                    offset += take;
+                    length -= take;
+                }
+                if (ret == Z_STREAM_END) {
+                    positioned = false;
+                    if (length) {
+                        // The next gzip member, if any, has a point of its own.
+                        const AccessPoint& next = archive.point_before(out);
+                        if (!next.header || next.out != out) return EIO;
+                        int err = seek(next);
+                        if (err) return err;
+                    }
+                }
+            }
+            return 0;
+        }
+
+    public:
+        explicit Reader(const TarArchive& archive);
+        ~Reader();
+
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+
+        // Hands the data of `member` to `sink(const uint8_t*, size_t)` in
+        // pieces; `sink` returns false to stop. Returns 0, or the errno that
+        // ended the read early (EIO for a corrupt or truncated archive).
+        template <typename Sink>
+        int read(const Member& member, Sink sink) {
+            const Member& data = archive.resolve(member);
+            if (fd < 0) return EBADF;
+            if (archive.compressed) return inflating ? read_compressed(data.offset, data.size, sink) : ENOMEM;
+            for (uint64_t done = 0; done < data.size; ) {
+                size_t want = std::min<uint64_t>(output.size(), data.size - done);
+                ssize_t n = pread(fd, output.data(), want, data.offset + done);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) return n < 0 ? errno : EIO;
+                if (!sink(output.data(), static_cast<size_t>(n))) return ECANCELED;
+                done += n;
+            }
+            return 0;
+        }
+    };
+
+    static bool is_archive_name(const std::string& name);
+
+    // Indexes `path`, reporting compressed bytes read and members found to
+    // `progress`. Returns nullptr with `error` set if it is not a readable
+    // tar archive or the user cancelled.
+    static std::shared_ptr<TarArchive> open(const fs::path& path, OperationProgress& progress, std::string& error);
+
+    // True when this is the index of the file with these identity and mtime.
+    bool matches(uint64_t file_dev, uint64_t file_ino, int64_t file_mtime) const;
+
+    const fs::path& path() const { return file; }
+
+    bool is_compressed() const { return compressed; }
+
+    size_t member_count() const { return by_path.size(); }
+
+    size_t access_points() const { return points.size(); }
+
+    std::string_view name(const Member& member) const { return std::string_view(names.data() + member.name); }
+
+    std::string_view link(const Member& member) const { return std::string_view(names.data() + member.link); }
+
+    static bool is_hard_link(const Member& member) { return S_ISREG(member.mode) && member.link; }
+
+    // Whether a link target stays below the directory the link is in:
+    // relative, and without a ".." component.
+    static bool contained(std::string_view target);
+    const Member* find(std::string_view path) const;
+
+    // The member a hard link points to, or `member` itself.
+    const Member& resolve(const Member& member) const;
+
+    // Members directly in `dir` ("" for the top of the archive).
+    const std::vector<uint32_t>& entries(std::string_view dir) const;
+
+    const Member& member(uint32_t id) const { return members[id]; }
+
+    // Appends every member below `dir`, at any depth, to `found`.
+    void collect(std::string_view dir, std::vector<uint32_t>& found) const;
+};
+
+// Copies members out of a TarArchive. One thread reads them in stream order
+// through a single reader, so a compressed archive is inflated once however
+// many members are extracted. Directories are created first and given their
+// own permissions last, so a read-only directory can still be filled.
+// Everything is created relative to one open destination directory, one
+// component at a time with O_NOFOLLOW, and links whose target is absolute or
+// climbs with ".." are refused, so no member can land outside it.
+class ArchiveExtractor {
+private:
+    struct Job {
+        const TarArchive::Member* member;
+        std::string path;       // relative to `base`
+    };
+
+    std::shared_ptr<const TarArchive> archive;
+    OperationProgress& progress;
+    std::thread worker;
+    fs::path base;
+    int base_fd = -1;
+    std::string parent;         // the directory last opened by open_parent(), and its fd
+    int parent_fd = -1;
+
+    std::string describe(const std::string& path, int err) const;
+
+    // Opens the directory `path` is in, creating missing directories on the
+    // way, and points `leaf` at its last component. Symlinks on the way are
+    // not followed. Returns -1 with errno set on failure.
+    int open_parent(const std::string& path, std::string& leaf);
+    bool extract_file(TarArchive::Reader& reader, const Job& job);
+    bool extract_symlink(const Job& job);
+    void run(std::vector<std::string> sources, fs::path destination);
+
+public:
+    ArchiveExtractor(std::shared_ptr<const TarArchive> archive, OperationProgress& progress);
+
+    // Stops an extraction that is still running when the extractor goes away.
+    ~ArchiveExtractor();
+
+    // `sources` are member paths; a directory brings everything below it.
+    void start(std::vector<std::string> sources, fs::path destination);
+    void wait();
+};
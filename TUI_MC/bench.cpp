@@ -0,0 +1,461 @@
+// Headless benchmark for the file manager. Builds reproducible synthetic
+// trees, then drives FileManager through the real event loop with scripted
+// keys: ncurses reads them from a pipe and draws to /dev/null (or to a
+// pseudo-terminal with --pty). Every scenario runs in its own child process
+// so peak RSS is per scenario, and prints one JSON object per line.
+//
+//   cmake -S . -B build && cmake --build build --target fm_bench
+//   build/fm_bench [--root DIR] [--files N] [--pty] [flat|deep|utf8|mixed ...]
+#include "profiler.h"
+#include "file_manager.h"
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <cerrno>
+#include <fstream>
+#include <ncurses.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <locale.h>
+#include <thread>
+#include <mutex>
+#include <map>
+#include <condition_variable>
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <sstream>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Creates the benchmark trees. A tree is only rebuilt when its stamp file
+// does not match the parameters it was generated with.
+class TreeGenerator {
+private:
+    static constexpr uint64_t SEED = 0x5eed;
+
+    fs::path root;
+    size_t flat_files;
+
+    // The stamp lives next to the tree, so it never shows up in a listing.
+    static fs::path stamp_path(const fs::path& dir) { return dir.string() + ".stamp"; }
+
+    static bool is_current(const fs::path& dir, const std::string& stamp) {
+        std::ifstream in(stamp_path(dir));
+        std::string found;
+        std::getline(in, found);
+        return found == stamp;
+    }
+
+    static void finish(const fs::path& dir, const std::string& stamp) {
+        std::ofstream(stamp_path(dir)) << stamp << "\n";
+    }
+
+    static void create_file(int dir_fd, const std::string& name, uint64_t size) {
+        int fd = openat(dir_fd, name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) throw std::runtime_error(name + ": " + std::strerror(errno));
+        if (size && ftruncate(fd, size) != 0) {
+            close(fd);
+            throw std::runtime_error(name + ": " + std::strerror(errno));
+        }
+        close(fd);
+    }
+
+    static int open_directory(const fs::path& dir) {
+        fs::create_directories(dir);
+        int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) throw std::runtime_error(dir.string() + ": " + std::strerror(errno));
+        return fd;
+    }
+
+    static void reset(const fs::path& dir) {
+        std::error_code ec;
+        fs::remove_all(dir, ec);
+    }
+
+    // One huge directory of empty files.
+    void build_flat(const fs::path& dir) {
+        int fd = open_directory(dir);
+        char name[32];
+        for (size_t i = 0; i < flat_files; i++) {
+            snprintf(name, sizeof(name), "file-%07zu.dat", i);
+            create_file(fd, name, 0);
+        }
+        close(fd);
+    }
+
+    // A chain of nested directories with a few files on every level. The
+    // subdirectory sorts first, so Enter always descends.
+    static void build_deep(const fs::path& dir, int depth, int files_per_level) {
+        fs::path level = dir;
+        for (int d = 0; d < depth; d++) {
+            int fd = open_directory(level);
+            for (int i = 0; i < files_per_level; i++) create_file(fd, "f" + std::to_string(i), 0);
+            close(fd);
+            level /= "0sub";
+        }
+        fs::create_directories(level);
+    }
+
+    // Long names mixing 1- to 4-byte UTF-8 sequences.
+    static void build_utf8(const fs::path& dir, size_t count) {
+        static const char* const pieces[] = {"a", "Z", "_", "é", "ß", "ж", "ю", "λ", "中", "文", "日", "한", "😀", "🚀"};
+        std::mt19937_64 rng(SEED);
+        int fd = open_directory(dir);
+        for (size_t i = 0; i < count; i++) {
+            std::string name = std::to_string(i) + "-";
+            size_t length = 20 + rng() % 200;
+            while (name.size() < length) name += pieces[rng() % std::size(pieces)];
+            create_file(fd, name, 0);
+        }
+        close(fd);
+    }
+
+    // Subdirectories of sparse files whose sizes are spread log-uniformly
+    // from 0 to 64 MiB.
+    static void build_mixed(const fs::path& dir, size_t count, size_t dirs) {
+        std::mt19937_64 rng(SEED + 1);
+        for (size_t d = 0; d < dirs; d++) {
+            char sub[32];
+            snprintf(sub, sizeof(sub), "dir-%03zu", d);
+            int fd = open_directory(dir / sub);
+            for (size_t i = 0; i < count / dirs; i++) {
+                uint64_t size = (rng() % 27 == 0) ? 0 : (uint64_t(1) << (rng() % 27)) + rng() % 4096;
+                create_file(fd, "file-" + std::to_string(i) + (i % 3 ? ".bin" : ".txt"), size);
+            }
+            close(fd);
+        }
+    }
+
+public:
+    TreeGenerator(fs::path root, size_t flat_files) : root(std::move(root)), flat_files(flat_files) {}
+
+    // Returns the directory of `tree`, generating it first if needed.
+    fs::path prepare(const std::string& tree) {
+        fs::path dir = root / tree;
+        std::string stamp = tree + " v1";
+        if (tree == "flat") stamp += " " + std::to_string(flat_files);
+        if (is_current(dir, stamp)) return dir;
+
+        reset(dir);
+        fs::create_directories(root);
+        std::cerr << "generating " << dir << "..." << std::endl;
+        if (tree == "flat") build_flat(dir);
+        else if (tree == "deep") build_deep(dir, 100, 20);
+        else if (tree == "utf8") build_utf8(dir, 50000);
+        else if (tree == "mixed") build_mixed(dir, 100000, 100);
+        else throw std::runtime_error("unknown tree " + tree);
+        finish(dir, stamp);
+        return dir;
+    }
+};
+
+// One scripted step: `keys` is written `repeat` times, either one key per
+// frame (latency of each key) or all at once (latency of the whole burst).
+struct Step {
+    std::string label;
+    std::string keys;
+    int repeat;
+    bool burst;
+};
+
+// Runs FileManager on a fake terminal and times how long it takes for each
+// scripted input to show up in a drawn frame.
+class BenchmarkRun {
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // Single keys are paced like keyboard auto-repeat; sent back to back
+    // they would only measure the event loop's frame budget.
+    static constexpr auto KEY_INTERVAL = std::chrono::milliseconds(33);
+
+    std::string name;
+    fs::path tree;
+    bool use_pty;
+
+    int input_read = -1;
+    int input_write = -1;
+
+    std::mutex frame_mtx;
+    std::condition_variable frame_cv;
+    uint64_t frames = 0;
+    uint64_t drained_frames = 0;     // frames drawn with no input left unread
+    Clock::time_point last_frame;
+    bool scanning = true;
+    size_t entries = 0;
+
+    Clock::time_point started;
+    double first_frame_ms = -1;
+    double scan_ms = -1;
+    std::map<std::string, std::vector<double>> latencies;   // label -> microseconds
+    bool timed_out = false;
+
+    // Called on the UI thread after every frame.
+    void frame_drawn(FileManager& fm) {
+        int unread = 0;
+        ioctl(input_read, FIONREAD, &unread);
+        Clock::time_point now = Clock::now();
+        std::lock_guard<std::mutex> lock(frame_mtx);
+        frames++;
+        if (unread == 0) drained_frames = frames;
+        last_frame = now;
+        scanning = fm.is_scanning();
+        entries = fm.entry_count();
+        double since_start = std::chrono::duration<double, std::milli>(now - started).count();
+        if (first_frame_ms < 0 && (entries > 0 || !scanning)) first_frame_ms = since_start;
+        if (scan_ms < 0 && !scanning) scan_ms = since_start;
+        frame_cv.notify_all();
+    }
+
+    // Writes `bytes` and waits for the first frame drawn after all of it
+    // was read. Returns the latency in microseconds, or -1 on timeout.
+    double send(const std::string& bytes) {
+        std::unique_lock<std::mutex> lock(frame_mtx);
+        uint64_t before = frames;
+        Clock::time_point sent = Clock::now();
+        lock.unlock();
+        for (size_t written = 0; written < bytes.size(); ) {
+            ssize_t n = write(input_write, bytes.data() + written, bytes.size() - written);
+            if (n < 0 && errno != EINTR) return -1;
+            if (n > 0) written += n;
+        }
+        lock.lock();
+        if (!frame_cv.wait_for(lock, std::chrono::seconds(30), [&] { return drained_frames > before; })) {
+            timed_out = true;
+            return -1;
+        }
+        return std::chrono::duration<double, std::micro>(last_frame - sent).count();
+    }
+
+    void drive(const std::vector<Step>& script) {
+        {
+            std::unique_lock<std::mutex> lock(frame_mtx);
+            frame_cv.wait_for(lock, std::chrono::minutes(5), [&] { return !scanning; });
+        }
+        for (const Step& step : script) {
+            if (timed_out) break;
+            if (step.burst) {
+                std::this_thread::sleep_for(KEY_INTERVAL);
+                std::string bytes;
+                for (int i = 0; i < step.repeat; i++) bytes += step.keys;
+                double us = send(bytes);
+                if (us >= 0) latencies[step.label].push_back(us);
+                continue;
+            }
+            for (int i = 0; i < step.repeat && !timed_out; i++) {
+                std::this_thread::sleep_for(KEY_INTERVAL);
+                double us = send(step.keys);
+                if (us >= 0) latencies[step.label].push_back(us);
+            }
+        }
+        const char quit = 'q';
+        while (write(input_write, &quit, 1) < 0 && errno == EINTR) {}
+    }
+
+    static std::string key(const char* capability, const char* fallback) {
+        const char* sequence = tigetstr(const_cast<char*>(capability));
+        return sequence && sequence != reinterpret_cast<char*>(-1) ? sequence : fallback;
+    }
+
+    std::vector<Step> script() const {
+        std::string down = key("kcud1", "\033OB"), up = key("kcuu1", "\033OA");
+        std::string left = key("kcub1", "\033OD");
+        if (name == "flat" || name == "utf8") {
+            return {{"down", down, 200, false},
+                    {"burst_down_1000", down, 1000, true},
+                    {"burst_up_1000", up, 1000, true},
+                    {"sort_size", "s", 1, false},
+                    {"sort_time", "t", 1, false},
+                    {"sort_extension", "e", 1, false},
+                    {"sort_name", "n", 1, false},
+                    {"invert_marks", "*", 2, false},
+                    {"refresh", "r", 3, false}};
+        }
+        if (name == "deep") {
+            return {{"enter", "\n", 100, false}, {"leave", left, 100, false}};
+        }
+        std::vector<Step> steps = {{"down", down, 50, false}, {"sort_size", "s", 1, false}, {"sort_name", "n", 1, false}};
+        for (int i = 0; i < 20; i++) {
+            steps.push_back({"enter", "\n", 1, false});
+            steps.push_back({"leave", left, 1, false});
+            steps.push_back({"down", down, 1, false});
+        }
+        return steps;
+    }
+
+    static std::string json_number(double value) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.3f", value);
+        return buf;
+    }
+
+    std::string report() const {
+        std::ostringstream out;
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+        double scan_rate = scan_ms > 0 ? entries / (scan_ms / 1000) : 0;
+        out << "{\"scenario\":\"" << name << "\",\"output\":\"" << (use_pty ? "pty" : "null") << "\""
+            << ",\"entries\":" << entries << ",\"first_frame_ms\":" << json_number(first_frame_ms)
+            << ",\"scan_ms\":" << json_number(scan_ms) << ",\"scan_entries_per_s\":" << json_number(scan_rate)
+            << ",\"peak_rss_kb\":" << usage.ru_maxrss << ",\"timed_out\":" << (timed_out ? "true" : "false")
+            << ",\"keys\":{";
+        bool first = true;
+        for (auto [label, samples] : latencies) {
+            std::sort(samples.begin(), samples.end());
+            double sum = 0;
+            for (double us : samples) sum += us;
+            auto at = [&samples](double q) { return samples[std::min(samples.size() - 1, size_t(q * samples.size()))]; };
+            out << (first ? "" : ",") << "\"" << label << "\":{\"n\":" << samples.size()
+                << ",\"mean_us\":" << json_number(sum / samples.size()) << ",\"p50_us\":" << json_number(at(0.5))
+                << ",\"p99_us\":" << json_number(at(0.99)) << ",\"max_us\":" << json_number(samples.back()) << "}";
+            first = false;
+        }
+        out << "},\"stages\":{";
+        first = true;
+        for (int stage = 0; stage < Profiler::STAGE_COUNT; stage++) {
+            Profiler::Summary summary = Profiler::summarize(static_cast<Profiler::Stage>(stage));
+            if (summary.count == 0) continue;
+            out << (first ? "" : ",") << "\"" << Profiler::stage_name(static_cast<Profiler::Stage>(stage))
+                << "\":{\"n\":" << summary.count << ",\"p50_us\":" << json_number(summary.p50_ns / 1e3)
+                << ",\"p99_us\":" << json_number(summary.p99_ns / 1e3) << "}";
+            first = false;
+        }
+        out << "}}";
+        return out.str();
+    }
+
+public:
+    BenchmarkRun(std::string name, fs::path tree, bool use_pty) : name(std::move(name)), tree(std::move(tree)), use_pty(use_pty) {}
+
+    // Runs the scenario in the calling process and returns its JSON line.
+    std::string run() {
+        int input[2];
+        if (pipe2(input, O_CLOEXEC) != 0) throw std::runtime_error(std::string("pipe: ") + std::strerror(errno));
+        input_read = input[0];
+        input_write = input[1];
+
+        // The terminal's output goes to /dev/null, or to a pty whose master
+        // side is drained on a thread so ncurses never blocks on it.
+        int master = -1;
+        std::thread drainer;
+        FILE* output;
+        if (use_pty) {
+            master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+            if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) throw std::runtime_error("no pty available");
+            int slave = open(ptsname(master), O_RDWR | O_NOCTTY | O_CLOEXEC);
+            struct winsize size = {50, 160, 0, 0};
+            ioctl(slave, TIOCSWINSZ, &size);
+            output = fdopen(slave, "w");
+            drainer = std::thread([master] {
+                char buf[65536];
+                while (read(master, buf, sizeof(buf)) > 0) {}
+            });
+        } else {
+            setenv("LINES", "50", 1);
+            setenv("COLUMNS", "160", 1);
+            output = fopen("/dev/null", "w");
+        }
+        FILE* keys = fdopen(input_read, "r");
+        if (!output || !keys) throw std::runtime_error("cannot open the terminal streams");
+
+        if (chdir(tree.c_str()) != 0) throw std::runtime_error(tree.string() + ": " + std::strerror(errno));
+        setlocale(LC_ALL, "");
+        SCREEN* screen = newterm("xterm", output, keys);
+        if (!screen) throw std::runtime_error("newterm failed");
+        set_escdelay(25);
+        noecho();
+        cbreak();
+        curs_set(0);
+        keypad(stdscr, TRUE);
+
+        int rows, cols;
+        getmaxyx(stdscr, rows, cols);
+        int divider = std::max(20, cols / 2);
+        WINDOW* menuwin = newwin(rows, divider, 0, 0);
+        WINDOW* optionwin = newwin(rows, divider, 0, divider);
+        keypad(menuwin, TRUE);
+
+        std::vector<Step> steps = script();
+        std::string result;
+        {
+            started = Clock::now();
+            FileManager fm;
+            fm.set_window_size(rows, divider);
+            fm.set_output_descriptor(fileno(output));
+            std::thread driver(&BenchmarkRun::drive, this, steps);
+            run_event_loop(fm, menuwin, optionwin, input_read, [&] { frame_drawn(fm); });
+            driver.join();
+            result = report();
+        }
+
+        delwin(menuwin);
+        delwin(optionwin);
+        endwin();
+        delscreen(screen);
+        fclose(keys);
+        close(input_write);
+        fclose(output);
+        if (master >= 0) {
+            close(master);
+            drainer.join();
+        }
+        return result;
+    }
+};
+
+int main(int argc, char** argv) {
+    fs::path root = "/tmp/fm-bench";
+    size_t flat_files = 1000000;
+    bool use_pty = false;
+    std::vector<std::string> scenarios;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--root" && i + 1 < argc) root = argv[++i];
+        else if (arg == "--files" && i + 1 < argc) flat_files = std::stoul(argv[++i]);
+        else if (arg == "--pty") use_pty = true;
+        else if (arg == "flat" || arg == "deep" || arg == "utf8" || arg == "mixed") scenarios.push_back(arg);
+        else {
+            std::cerr << "usage: " << argv[0] << " [--root DIR] [--files N] [--pty] [flat|deep|utf8|mixed ...]" << std::endl;
+            return 2;
+        }
+    }
+    if (scenarios.empty()) scenarios = {"flat", "deep", "utf8", "mixed"};
+
+    int status = 0;
+    TreeGenerator generator(root, flat_files);
+    for (const auto& scenario : scenarios) {
+        fs::path tree;
+        try {
+            tree = generator.prepare(scenario);
+        } catch (const std::exception& e) {
+            std::cerr << scenario << ": " << e.what() << std::endl;
+            return 1;
+        }
+
+        // A fresh process per scenario, so peak RSS and the profiler's
+        // histograms only cover that scenario.
+        std::cout.flush();
+        pid_t child = fork();
+        if (child == 0) {
+            try {
+                std::string line = BenchmarkRun(scenario, tree, use_pty).run();
+                std::cout << line << std::endl;
+                _exit(0);
+            } catch (const std::exception& e) {
+                std::cerr << scenario << ": " << e.what() << std::endl;
+                _exit(1);
+            }
+        }
+        int child_status = 0;
+        waitpid(child, &child_status, 0);
+        if (!WIFEXITED(child_status) || WEXITSTATUS(child_status) != 0) status = 1;
+    }
+    return status;
+}
@@ -0,0 +1,200 @@
+#include "checksum.h"
+
+#include <cstdlib>
+#include <cerrno>
+#include <thread>
+#include <memory>
+#include <algorithm>
+#include <cstring>
+
+void Sha256::compress(const uint8_t* p) {
+    static const uint32_t K[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = uint32_t(p[4 * i]) << 24 | uint32_t(p[4 * i + 1]) << 16 | uint32_t(p[4 * i + 2]) << 8 | p[4 * i + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+        uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+void Sha256::reset() {
+    static const uint32_t initial[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    memcpy(state, initial, sizeof(state));
+    length = 0;
+    filled = 0;
+}
+
+void Sha256::update(const void* data, size_t size) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    length += size;
+    if (filled) {
+        size_t take = std::min(size, sizeof(block) - filled);
+        memcpy(block + filled, p, take);
+        filled += take;
+        p += take;
+        size -= take;
+        if (filled < sizeof(block)) return;
+        compress(block);
+        filled = 0;
+    }
+    for (; size >= sizeof(block); p += sizeof(block), size -= sizeof(block)) compress(p);
+    memcpy(block, p, size);
+    filled = size;
+}
+
+Sha256::Digest Sha256::finish() {
+    uint64_t bits = length * 8;
+    uint8_t tail[72] = {0x80};
+    size_t pad = (filled < 56 ? 56 : 120) - filled;
+    for (int i = 0; i < 8; i++) tail[pad + i] = static_cast<uint8_t>(bits >> (56 - 8 * i));
+    update(tail, pad + 8);
+    Digest digest;
+    for (int i = 0; i < 32; i++) digest[i] = static_cast<uint8_t>(state[i / 4] >> (24 - 8 * (i % 4)));
+    return digest;
+}
+
+std::string Sha256::hex(const Digest& digest) {
+    static const char digits[] = "0123456789abcdef";
+    std::string text;
+    for (uint8_t byte : digest) {
+        text.push_back(digits[byte >> 4]);
+        text.push_back(digits[byte & 15]);
+    }
+    return text;
+}
+
+int ChecksumPipeline::write_all(int out, const uint8_t* data, size_t size) {
+    for (size_t done = 0; done < size; ) {
+        ssize_t n = write(out, data + done, size - done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return errno;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+int ChecksumPipeline::store(int out, const uint8_t* data, size_t size, bool sparse) {
+    if (sparse && size > 0 && data[0] == 0 && memcmp(data, data + 1, size - 1) == 0) {
+        return lseek(out, size, SEEK_CUR) < 0 ? errno : 0;
+    }
+    return write_all(out, data, size);
+}
+
+int ChecksumPipeline::finish(int out, bool sparse) {
+    if (!sparse || out < 0) return 0;
+    off_t end = lseek(out, 0, SEEK_CUR);
+    return end < 0 || ftruncate(out, end) != 0 ? errno : 0;
+}
+
+ssize_t ChecksumPipeline::read_some(int in, uint8_t* data) {
+    while (true) {
+        ssize_t n = read(in, data, SLOT_SIZE);
+        if (n >= 0 || errno != EINTR) return n;
+    }
+}
+
+uint8_t* ChecksumPipeline::thread_ring() {
+    static thread_local std::unique_ptr<uint8_t, decltype(&free)> memory(nullptr, &free);
+    if (!memory) {
+        void* block = nullptr;
+        if (posix_memalign(&block, ALIGN, SLOTS * SLOT_SIZE) != 0) return nullptr;
+        memory.reset(static_cast<uint8_t*>(block));
+    }
+    return memory.get();
+}
+
+int ChecksumPipeline::run(int in, int out, uint64_t size, Sha256& digest, OperationProgress& progress, bool sparse) {
+    if (size < PIPELINE_MIN) {
+        while (true) {
+            if (progress.cancelled) return ECANCELED;
+            ssize_t n = read_some(in, ring);
+            if (n < 0) return errno;
+            if (n == 0) return finish(out, sparse);
+            digest.update(ring, n);
+            if (out >= 0) {
+                int err = store(out, ring, n, sparse);
+                if (err) return err;
+            }
+            progress.bytes_done += n;
+        }
+    }
+
+    std::thread hasher([&] {
+        consume(hashed, [&](const uint8_t* data, size_t length) {
+            digest.update(data, length);
+            if (out < 0) progress.bytes_done += length;
+            return 0;
+        });
+    });
+    std::thread writer;
+    if (out >= 0) {
+        writer = std::thread([&] {
+            consume(written, [&](const uint8_t* data, size_t length) {
+                int err = store(out, data, length, sparse);
+                if (!err) progress.bytes_done += length;
+                return err;
+            });
+        });
+    }
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            changed.wait(lock, [&] {
+                return error || filled - std::min(hashed, out >= 0 ? written : hashed) < SLOTS;
+            });
+            if (error) break;
+        }
+        size_t slot = filled % SLOTS;
+        ssize_t n = progress.cancelled ? -1 : read_some(in, ring + slot * SLOT_SIZE);
+        int err = progress.cancelled ? ECANCELED : n < 0 ? errno : 0;
+        std::lock_guard<std::mutex> lock(mtx);
+        if (err || n == 0) {
+            if (err && !error) error = err;
+            eof = true;
+            changed.notify_all();
+            break;
+        }
+        lengths[slot] = n;
+        filled++;
+        changed.notify_all();
+    }
+    hasher.join();
+    if (writer.joinable()) writer.join();
+    return error ? error : finish(out, sparse);
+}
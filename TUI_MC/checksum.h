@@ -0,0 +1,96 @@
+#pragma once
+
+#include "thread_pool.h"
+
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include <array>
+#include <unistd.h>
+
+// SHA-256 (FIPS 180-4), for the digests of verified copies.
+class Sha256 {
+public:
+    using Digest = std::array<uint8_t, 32>;
+
+private:
+    uint32_t state[8];
+    uint64_t length = 0;          // bytes hashed so far
+    uint8_t block[64];
+    size_t filled = 0;
+
+    static uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+    void compress(const uint8_t* p);
+
+public:
+    Sha256() { reset(); }
+
+    void reset();
+    void update(const void* data, size_t size);
+    Digest finish();
+    static std::string hex(const Digest& digest);
+};
+
+// Moves one file through a ring of aligned buffers: the calling thread reads
+// into free slots while one thread hashes and another writes the filled
+// ones, so reading, hashing and writing overlap and each byte is read once.
+// A slot is reused only when both have passed it. Files below PIPELINE_MIN
+// go through slot 0 in turn on the calling thread, which beats starting two
+// threads for them.
+class ChecksumPipeline {
+public:
+    static constexpr size_t SLOTS = 8;
+    static constexpr size_t SLOT_SIZE = 1024 * 1024;
+    static constexpr size_t ALIGN = 4096;           // O_DIRECT wants aligned buffers
+    static constexpr uint64_t PIPELINE_MIN = 4 * SLOT_SIZE;
+
+private:
+    uint8_t* ring;                                  // SLOTS * SLOT_SIZE bytes
+    size_t lengths[SLOTS];
+    std::mutex mtx;
+    std::condition_variable changed;
+    uint64_t filled = 0;                            // slots read, counted from the start
+    uint64_t hashed = 0;
+    uint64_t written = 0;
+    bool eof = false;
+    int error = 0;
+
+    // Hands the slots to `process` in order as they fill. `position` is
+    // this consumer's count of slots done.
+    template <typename Process>
+    void consume(uint64_t& position, Process process) {
+        while (true) {
+            std::unique_lock<std::mutex> lock(mtx);
+            changed.wait(lock, [&] { return error || position < filled || eof; });
+            if (error || position == filled) return;
+            size_t slot = position % SLOTS;
+            lock.unlock();
+            int err = process(ring + slot * SLOT_SIZE, lengths[slot]);
+            lock.lock();
+            if (err && !error) error = err;
+            position++;
+            changed.notify_all();
+        }
+    }
+
+    static int write_all(int out, const uint8_t* data, size_t size);
+
+    // Writes a slot, or for a sparse source skips over it when it is all
+    // zeros; finish() then sets the length, which also covers a trailing hole.
+    static int store(int out, const uint8_t* data, size_t size, bool sparse);
+    static int finish(int out, bool sparse);
+    static ssize_t read_some(int in, uint8_t* data);
+
+public:
+    explicit ChecksumPipeline(uint8_t* ring) : ring(ring) {}
+
+    // A ring for the calling thread, allocated on first use.
+    static uint8_t* thread_ring();
+
+    // Reads `in` to its end, hashing everything into `digest` and writing it
+    // to `out` unless that is -1. With `sparse`, zero-filled slots become
+    // holes in `out`. `size` only picks the strategy. Returns 0, or the errno
+    // that stopped it.
+    int run(int in, int out, uint64_t size, Sha256& digest, OperationProgress& progress, bool sparse = false);
+};
@@ -0,0 +1,267 @@
+#include "content_search.h"
+#include "profiler.h"
+#include "directory.h"
+
+#include <algorithm>
+#include <cstring>
+#include <dirent.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+std::string ContentSearch::required_literal(const std::string& pattern) {
+    if (pattern.find('|') != std::string::npos) return "";
+    std::string best, run;
+    int depth = 0;
+    auto end_run = [&] {
+        if (run.size() > best.size()) best = run;
+        run.clear();
+    };
+    for (size_t i = 0; i < pattern.size(); i++) {
+        char c = pattern[i];
+        if (c == '\\' && i + 1 < pattern.size()) {
+            char next = pattern[++i];
+            if (isalnum(static_cast<unsigned char>(next)) || depth > 0) {
+                end_run();
+            } else {
+                run.push_back(next);
+            }
+        } else if (c == '*' || c == '?' || c == '{') {
+            // The character before is optional.
+            if (!run.empty()) run.pop_back();
+            end_run();
+            if (c == '{') i = std::min(pattern.find('}', i), pattern.size());
+        } else if (c == '+') {
+            end_run();
+        } else if (c == '[') {
+            size_t close = pattern.find(']', i + 2);
+            i = close == std::string::npos ? pattern.size() : close;
+            end_run();
+        } else if (c == '(') {
+            depth++;
+            end_run();
+        } else if (c == ')') {
+            depth = std::max(0, depth - 1);
+            end_run();
+        } else if (c == '.' || c == '^' || c == '$' || depth > 0) {
+            end_run();
+        } else {
+            run.push_back(c);
+        }
+    }
+    end_run();
+    return best;
+}
+
+bool ContentSearch::literal_at(const char* p) const {
+    if (!ignore_case) return memcmp(p, literal.data(), literal.size()) == 0;
+    for (size_t k = 0; k < literal.size(); k++) {
+        if (tolower(static_cast<unsigned char>(p[k])) != literal[k]) return false;
+    }
+    return true;
+}
+
+size_t ContentSearch::find_literal(const char* data, size_t len, size_t from) const {
+    size_t n = literal.size();
+    size_t i = from;
+#ifdef __SSE2__
+    const unsigned char first = literal[0], last = literal[n - 1];
+    const __m128i first_a = _mm_set1_epi8(first), first_b = _mm_set1_epi8(ignore_case ? toupper(first) : first);
+    const __m128i last_a = _mm_set1_epi8(last), last_b = _mm_set1_epi8(ignore_case ? toupper(last) : last);
+    for (; i + n - 1 + 16 <= len; i += 16) {
+        __m128i head = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        __m128i tail = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + n - 1));
+        __m128i hits = _mm_and_si128(_mm_or_si128(_mm_cmpeq_epi8(head, first_a), _mm_cmpeq_epi8(head, first_b)),
+                                     _mm_or_si128(_mm_cmpeq_epi8(tail, last_a), _mm_cmpeq_epi8(tail, last_b)));
+        unsigned mask = _mm_movemask_epi8(hits);
+        while (mask) {
+            size_t at = i + __builtin_ctz(mask);
+            if (literal_at(data + at)) return at;
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for (; i + n <= len; i++) {
+        if (literal_at(data + i)) return i;
+    }
+    return len;
+}
+
+uint64_t ContentSearch::count_newlines(const char* data, size_t len) {
+    uint64_t count = 0;
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i newline = _mm_set1_epi8('\n');
+    for (; i + 16 <= len; i += 16) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        count += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(block, newline)));
+    }
+#endif
+    for (; i < len; i++) count += data[i] == '\n';
+    return count;
+}
+
+bool ContentSearch::regex_matches(const char* data, size_t begin, size_t end) const {
+    regmatch_t match;
+    match.rm_so = begin;
+    match.rm_eo = end;
+    return regexec(&regex, data, 1, &match, REG_STARTEND) == 0;
+}
+
+size_t ContentSearch::next_match(const char* data, size_t len, size_t pos) const {
+    while (pos < len && !cancelled) {
+        size_t hit;
+        if (!literal.empty()) {
+            hit = find_literal(data, len, pos);
+        } else {
+            regmatch_t match;
+            match.rm_so = pos;
+            match.rm_eo = len;
+            hit = regexec(&regex, data, 1, &match, REG_STARTEND) == 0 ? match.rm_so : len;
+        }
+        if (hit >= len) return len;
+        const void* before = hit > pos ? memrchr(data + pos, '\n', hit - pos) : nullptr;
+        size_t begin = before ? static_cast<const char*>(before) - data + 1 : pos;
+        const void* after = memchr(data + hit, '\n', len - hit);
+        size_t end = after ? static_cast<const char*>(after) - data : len;
+        if (literal.empty() || !use_regex || regex_matches(data, begin, end)) return begin;
+        pos = end + 1;
+    }
+    return len;
+}
+
+void ContentSearch::search_buffer(const std::string& path, const char* data, size_t len) {
+    if (memchr(data, '\0', std::min(len, BINARY_PROBE))) {
+        binaries_skipped++;
+        return;
+    }
+    std::vector<Match> found;
+    uint64_t line = 1;
+    size_t counted = 0;
+    for (size_t pos = next_match(data, len, 0); pos < len; pos = next_match(data, len, pos)) {
+        line += count_newlines(data + counted, pos - counted);
+        counted = pos;
+        const void* after = memchr(data + pos, '\n', len - pos);
+        size_t end = after ? static_cast<const char*>(after) - data : len;
+        found.push_back({path, line, std::string(data + pos, std::min(end - pos, MAX_TEXT))});
+        pos = end + 1;
+    }
+    bytes_searched += len;
+    if (found.empty()) return;
+    match_count += found.size();
+    std::lock_guard<std::mutex> lock(matches_mtx);
+    for (auto& match : found) {
+        if (kept >= MAX_MATCHES) break;
+        pending.push_back(std::move(match));
+        kept++;
+    }
+}
+
+void ContentSearch::search_file(int dir_fd, const std::string& relative, const char* name) {
+    int fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (fd < 0) return;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        files_searched++;
+        if (static_cast<uint64_t>(st.st_size) >= MAP_THRESHOLD) {
+            void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map != MAP_FAILED) {
+                madvise(map, st.st_size, MADV_SEQUENTIAL);
+                search_buffer(relative, static_cast<const char*>(map), st.st_size);
+                munmap(map, st.st_size);
+            }
+        } else {
+            static thread_local std::vector<char> buffer;
+            buffer.resize(st.st_size);
+            size_t got = 0;
+            ssize_t len;
+            while (got < buffer.size() && (len = read(fd, buffer.data() + got, buffer.size() - got)) > 0) got += len;
+            search_buffer(relative, buffer.data(), got);
+        }
+    }
+    close(fd);
+}
+
+void ContentSearch::search_batch(std::string dir, std::vector<std::string> names) {
+    int fd = cancelled ? -1 : open((root + dir).c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return;
+    for (const auto& name : names) {
+        if (cancelled) break;
+        search_file(fd, dir.empty() ? name : dir.substr(1) + "/" + name, name.c_str());
+    }
+    close(fd);
+}
+
+void ContentSearch::scan(std::string dir) {
+    int fd = cancelled ? -1 : open((root + dir).c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) return;
+    std::vector<std::string> batch;
+    DirectoryReader::read(fd, [&] { return cancelled.load(); }, [&](const char* name, unsigned char type) {
+        if (type == DT_UNKNOWN) {
+            struct stat st;
+            Profiler::count(Profiler::STAT);
+            if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) return;
+            type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+        if (type == DT_DIR) {
+            if (!strcmp(name, ".git") || !strcmp(name, ".hg") || !strcmp(name, ".svn")) return;
+            pool.submit(group, [this, child = dir + "/" + name] { scan(child); });
+        } else if (type == DT_REG) {
+            batch.emplace_back(name);
+            if (batch.size() >= FILE_BATCH) {
+                pool.submit(group, [this, dir, names = std::move(batch)] { search_batch(dir, names); });
+                batch.clear();
+            }
+        }
+    });
+    close(fd);
+    search_batch(dir, std::move(batch));
+}
+
+void ContentSearch::run() {
+    ScopedTimer timer(Profiler::SEARCH);
+    pool.submit(group, [this] { scan(""); });
+    group.wait();
+    finished = true;
+}
+
+ContentSearch::~ContentSearch() {
+    cancel();
+    if (compiled) regfree(&regex);
+}
+
+std::string ContentSearch::start(const fs::path& dir, const std::string& pattern) {
+    root = dir.string();
+    ignore_case = std::none_of(pattern.begin(), pattern.end(), [](char c) { return isupper(static_cast<unsigned char>(c)); });
+    int flags = REG_EXTENDED | REG_NEWLINE | (ignore_case ? REG_ICASE : 0);
+    int error = regcomp(&regex, pattern.c_str(), flags);
+    if (error != 0) {
+        char message[256];
+        regerror(error, &regex, message, sizeof(message));
+        return message;
+    }
+    compiled = true;
+    literal = required_literal(pattern);
+    use_regex = literal.size() != pattern.size();
+    if (ignore_case) {
+        for (auto& c : literal) c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+    }
+    coordinator = std::thread(&ContentSearch::run, this);
+    return "";
+}
+
+void ContentSearch::cancel() {
+    cancelled = true;
+    if (coordinator.joinable()) coordinator.join();
+}
+
+bool ContentSearch::take(std::vector<Match>& out) {
+    std::lock_guard<std::mutex> lock(matches_mtx);
+    if (pending.empty()) return false;
+    out.insert(out.end(), std::make_move_iterator(pending.begin()), std::make_move_iterator(pending.end()));
+    pending.clear();
+    return true;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "thread_pool.h"
+
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <sys/mman.h>
+#include <regex.h>
+
+namespace fs = std::filesystem;
+
+// Searches file contents under a directory tree. Directories are walked on
+// the pool and their files searched in batches; version control directories
+// are skipped. Each file is read whole, or mapped when large, and files with
+// a NUL byte in their first 8 KiB are taken for binaries and skipped. The
+// longest literal the pattern requires is located with an SSE2 first/last
+// byte scan over the whole buffer, and only lines containing it are handed
+// to the regex. Matches are streamed to the caller while the search runs.
+class ContentSearch {
+public:
+    struct Match {
+        std::string path;       // relative to the search root
+        uint64_t line = 0;      // 1-based
+        std::string text;
+    };
+
+private:
+    static constexpr size_t FILE_BATCH = 64;
+    static constexpr uint64_t MAP_THRESHOLD = 1 << 20;
+    static constexpr size_t BINARY_PROBE = 8192;
+    static constexpr size_t MAX_MATCHES = 100000;
+    static constexpr size_t MAX_TEXT = 512;
+
+    WorkStealingPool& pool;
+    std::thread coordinator;
+    TaskGroup group;
+    std::atomic<bool> cancelled{false};
+    std::atomic<bool> finished{false};
+    std::atomic<uint64_t> files_searched{0};
+    std::atomic<uint64_t> bytes_searched{0};
+    std::atomic<uint64_t> binaries_skipped{0};
+    std::atomic<uint64_t> match_count{0};
+
+    std::string root;
+    regex_t regex;
+    bool compiled = false;
+    bool use_regex = false;
+    bool ignore_case = false;
+    std::string literal;        // lower-cased when ignoring case
+    std::mutex matches_mtx;
+    std::vector<Match> pending;
+    size_t kept = 0;            // matches handed out or pending, up to MAX_MATCHES
+
+    // Longest run of plain characters every match must contain, from the
+    // top level of an extended regex. Empty if there is none, or if the
+    // pattern has an alternation.
+    static std::string required_literal(const std::string& pattern);
+    bool literal_at(const char* p) const;
+
+    // Offset of the next occurrence of the literal in data[from, len), or len.
+    size_t find_literal(const char* data, size_t len, size_t from) const;
+    static uint64_t count_newlines(const char* data, size_t len);
+    bool regex_matches(const char* data, size_t begin, size_t end) const;
+
+    // Start of the next line that matches, searching from `pos`, or len.
+    size_t next_match(const char* data, size_t len, size_t pos) const;
+    void search_buffer(const std::string& path, const char* data, size_t len);
+    void search_file(int dir_fd, const std::string& relative, const char* name);
+    void search_batch(std::string dir, std::vector<std::string> names);
+
+    // `dir` is relative to the root: empty, or starting with '/'.
+    void scan(std::string dir);
+    void run();
+
+public:
+    explicit ContentSearch(WorkStealingPool& pool) : pool(pool) {}
+
+    ~ContentSearch();
+
+    // Starts searching `dir` for the extended regex `pattern`; lower-case
+    // patterns match case-insensitively. Returns an error message if the
+    // pattern does not compile.
+    std::string start(const fs::path& dir, const std::string& pattern);
+    void cancel();
+
+    bool is_finished() const { return finished; }
+
+    uint64_t files() const { return files_searched; }
+
+    uint64_t bytes() const { return bytes_searched; }
+
+    uint64_t binaries() const { return binaries_skipped; }
+
+    uint64_t matches() const { return match_count; }
+
+    const std::string& directory() const { return root; }
+
+    // Moves the matches found since the last call to the end of `out`.
+    bool take(std::vector<Match>& out);
+};
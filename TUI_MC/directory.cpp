@@ -0,0 +1,330 @@
+#include "directory.h"
+
+#include <climits>
+#include <sys/sysmacros.h>
+#include <fcntl.h>
+
+void DirectoryListing::compact_arena() {
+    std::string packed;
+    packed.reserve(arena.size() - garbage);
+    for (size_t i = 0; i < offsets.size(); i++) {
+        uint32_t offset = packed.size();
+        packed.append(arena, offsets[i], lengths[i] + 1);
+        offsets[i] = offset;
+    }
+    arena.swap(packed);
+    garbage = 0;
+}
+
+void DirectoryListing::reset(const fs::path& dir) {
+    parent = dir;
+    clear();
+}
+
+void DirectoryListing::clear() {
+    arena.clear();
+    offsets.clear();
+    lengths.clear();
+    types.clear();
+    modes.clear();
+    sizes.clear();
+    mtimes.clear();
+    marks.clear();
+    marked = 0;
+    garbage = 0;
+}
+
+size_t DirectoryListing::memory_usage() const {
+    return arena.capacity() + offsets.capacity() * sizeof(uint32_t) + lengths.capacity() * sizeof(uint16_t) +
+           types.capacity() + modes.capacity() * sizeof(uint32_t) + sizes.capacity() * sizeof(uint64_t) +
+           mtimes.capacity() * sizeof(int64_t) + marks.capacity();
+}
+
+void DirectoryListing::set_stat(size_t i, uint32_t mode, uint64_t size, int64_t mtime) {
+    modes[i] = mode;
+    sizes[i] = size;
+    mtimes[i] = mtime;
+}
+
+void DirectoryListing::set_marked(size_t i, bool mark) {
+    marked += mark - marks[i];
+    marks[i] = mark;
+}
+
+void DirectoryListing::clear_marks() {
+    std::fill(marks.begin(), marks.end(), 0);
+    marked = 0;
+}
+
+void DirectoryListing::push_back(std::string_view name, uint8_t type) {
+    offsets.push_back(arena.size());
+    lengths.push_back(std::min<size_t>(name.size(), UINT16_MAX));
+    arena.append(name.data(), lengths.back());
+    arena.push_back('\0');
+    types.push_back(type);
+    modes.push_back(0);
+    sizes.push_back(0);
+    mtimes.push_back(0);
+    marks.push_back(0);
+}
+
+void DirectoryListing::append(DirectoryListing& other) {
+    uint32_t base = arena.size();
+    arena += other.arena;
+    for (uint32_t offset : other.offsets) offsets.push_back(base + offset);
+    lengths.insert(lengths.end(), other.lengths.begin(), other.lengths.end());
+    types.insert(types.end(), other.types.begin(), other.types.end());
+    modes.insert(modes.end(), other.modes.begin(), other.modes.end());
+    sizes.insert(sizes.end(), other.sizes.begin(), other.sizes.end());
+    mtimes.insert(mtimes.end(), other.mtimes.begin(), other.mtimes.end());
+    marks.insert(marks.end(), other.marks.begin(), other.marks.end());
+    marked += other.marked;
+    other.clear();
+}
+
+size_t DirectoryListing::find(std::string_view entry) const {
+    for (size_t i = 0; i < offsets.size(); i++) {
+        if (name(i) == entry) return i;
+    }
+    return offsets.size();
+}
+
+void DirectoryListing::retain(const std::vector<char>& alive) {
+    size_t out = 0;
+    for (size_t i = 0; i < offsets.size(); i++) {
+        if (!alive[i]) {
+            garbage += lengths[i] + 1;
+            marked -= marks[i];
+            continue;
+        }
+        offsets[out] = offsets[i];
+        lengths[out] = lengths[i];
+        types[out] = types[i];
+        modes[out] = modes[i];
+        sizes[out] = sizes[i];
+        mtimes[out] = mtimes[i];
+        marks[out] = marks[i];
+        out++;
+    }
+    offsets.resize(out);
+    lengths.resize(out);
+    types.resize(out);
+    modes.resize(out);
+    sizes.resize(out);
+    mtimes.resize(out);
+    marks.resize(out);
+    if (garbage > arena.size() / 2) compact_arena();
+}
+
+DirectoryListing::Columns DirectoryListing::columns() const {
+    return {offsets.size(), arena, offsets.data(), lengths.data(), types.data(), modes.data(), sizes.data(),
+            mtimes.data()};
+}
+
+void DirectoryListing::assign(const Columns& source) {
+    arena.assign(source.arena.data(), source.arena.size());
+    offsets.assign(source.offsets, source.offsets + source.count);
+    lengths.assign(source.lengths, source.lengths + source.count);
+    types.assign(source.types, source.types + source.count);
+    modes.assign(source.modes, source.modes + source.count);
+    sizes.assign(source.sizes, source.sizes + source.count);
+    mtimes.assign(source.mtimes, source.mtimes + source.count);
+    marks.assign(source.count, 0);
+    marked = 0;
+    garbage = 0;
+}
+
+void DirectoryListing::permute(const std::vector<uint32_t>& order) {
+    auto apply = [&order](auto& column) {
+        std::remove_reference_t<decltype(column)> moved(column.size());
+        for (size_t i = 0; i < order.size(); i++) moved[i] = column[order[i]];
+        column.swap(moved);
+    };
+    apply(offsets);
+    apply(lengths);
+    apply(types);
+    apply(modes);
+    apply(sizes);
+    apply(mtimes);
+    apply(marks);
+}
+
+Wakeup::~Wakeup() {
+    if (fd >= 0) close(fd);
+}
+
+void Wakeup::notify() {
+    uint64_t one = 1;
+    while (fd >= 0 && write(fd, &one, sizeof(one)) < 0 && errno == EINTR) {}
+}
+
+void Wakeup::clear() {
+    uint64_t count;
+    while (fd >= 0 && read(fd, &count, sizeof(count)) < 0 && errno == EINTR) {}
+}
+
+void DirectoryScanner::flush(DirectoryListing& batch) {
+    if (batch.empty()) return;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        pending.append(batch);
+    }
+    if (wakeup) wakeup->notify();
+}
+
+void DirectoryScanner::run(fs::path dir) {
+    ScopedTimer timer(Profiler::SCAN);
+    DirectoryListing batch;
+    int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    int err = fd < 0 ? errno : DirectoryReader::read(fd, [&] { return cancel_flag.load(); },
+        [&](const char* name, unsigned char type) {
+            batch.push_back(name, type);
+            scanned++;
+            if (batch.size() >= BATCH_SIZE) flush(batch);
+        });
+    if (fd >= 0) close(fd);
+    flush(batch);
+    scan_errno = cancel_flag ? 0 : err;
+    complete = !err && !cancel_flag;
+    running = false;
+    if (wakeup) wakeup->notify();
+}
+
+void DirectoryScanner::start(const fs::path& dir) {
+    cancel();
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        pending.clear();
+    }
+    cancel_flag = false;
+    scanned = 0;
+    complete = false;
+    running = true;
+    worker = std::thread(&DirectoryScanner::run, this, dir);
+}
+
+void DirectoryScanner::cancel() {
+    cancel_flag = true;
+    if (worker.joinable()) worker.join();
+    running = false;
+    scan_errno = 0;
+}
+
+bool DirectoryScanner::take(DirectoryListing& out) {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (pending.empty()) return false;
+    out.append(pending);
+    return true;
+}
+
+void MetadataCache::check_directory() {
+    FileMeta dir = fetch(dir_fd, ".");
+    if (dir.mtime_sec != dir_mtime_sec || dir.mtime_nsec != dir_mtime_nsec) {
+        entries.clear();
+        dir_mtime_sec = dir.mtime_sec;
+        dir_mtime_nsec = dir.mtime_nsec;
+    }
+}
+
+MetadataCache::~MetadataCache() {
+    if (dir_fd >= 0) close(dir_fd);
+}
+
+FileMeta MetadataCache::fetch(int dir_fd, const char* name) {
+    FileMeta meta;
+    struct statx stx;
+    Profiler::count(Profiler::STAT);
+    if (statx(dir_fd, name, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC, STATX_FIELDS, &stx) == 0) {
+        meta.valid = true;
+        meta.size = stx.stx_size;
+        meta.blocks = stx.stx_blocks;
+        meta.mode = stx.stx_mode;
+        meta.mtime_sec = stx.stx_mtime.tv_sec;
+        meta.mtime_nsec = stx.stx_mtime.tv_nsec;
+        meta.dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+        meta.ino = stx.stx_ino;
+    }
+    return meta;
+}
+
+void MetadataCache::reset(const fs::path& dir) {
+    if (dir_fd >= 0) close(dir_fd);
+    dir_fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    entries.clear();
+    dir_mtime_sec = 0;
+    dir_mtime_nsec = 0;
+}
+
+void MetadataCache::prefetch(DirectoryListing& listing, const std::vector<uint32_t>& view, int first, int last) {
+    ScopedTimer timer(Profiler::METADATA);
+    if (dir_fd < 0) return;
+    check_directory();
+    first = std::max(first, 0);
+    last = std::min(last, static_cast<int>(view.size()));
+    for (int i = first; i < last; i++) {
+        std::string name(listing.name(view[i]));
+        if (entries.count(name)) continue;
+        FileMeta meta = fetch(dir_fd, name.c_str());
+        if (meta.valid) {
+            listing.set_stat(view[i], meta.mode, meta.size, meta.mtime_sec * 1000000000ll + meta.mtime_nsec);
+        }
+        entries.emplace(std::move(name), meta);
+    }
+}
+
+const FileMeta* MetadataCache::find(const std::string& name) const {
+    auto it = entries.find(name);
+    return it == entries.end() ? nullptr : &it->second;
+}
+
+DirectoryWatcher::~DirectoryWatcher() {
+    if (fd >= 0) close(fd);
+}
+
+void DirectoryWatcher::watch(const fs::path& dir) {
+    changes.clear();
+    touched.clear();
+    rescan = false;
+    if (fd < 0) fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) return;
+    if (wd >= 0) inotify_rm_watch(fd, wd);
+    wd = inotify_add_watch(fd, dir.c_str(), EVENTS);
+}
+
+void DirectoryWatcher::drain() {
+    if (fd < 0) return;
+    alignas(struct inotify_event) char buf[64 * 1024];
+    while (true) {
+        ssize_t len = read(fd, buf, sizeof(buf));
+        if (len <= 0) break;
+        for (char* ptr = buf; ptr < buf + len; ) {
+            auto* event = reinterpret_cast<struct inotify_event*>(ptr);
+            ptr += sizeof(struct inotify_event) + event->len;
+            if (event->wd != wd && !(event->mask & IN_Q_OVERFLOW)) continue;
+            if (event->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF)) {
+                rescan = true;
+                continue;
+            }
+            if (event->len == 0) continue;
+            std::string name(event->name);
+            if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                changes[name] = true;
+                touched.insert(std::move(name));
+            } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                changes[name] = false;
+                touched.insert(std::move(name));
+            } else if (event->mask & (IN_ATTRIB | IN_CLOSE_WRITE)) {
+                touched.insert(std::move(name));
+            }
+        }
+    }
+}
+
+DirectoryWatcher::Batch DirectoryWatcher::take() {
+    Batch batch;
+    batch.changes.swap(changes);
+    batch.touched.swap(touched);
+    batch.rescan = rescan;
+    rescan = false;
+    return batch;
+}
@@ -0,0 +1,305 @@
+#pragma once
+
+#include "profiler.h"
+
+#include <filesystem>
+#include <cerrno>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <unordered_set>
+#include <sys/inotify.h>
+#include <algorithm>
+#include <sys/eventfd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+// Entries of one directory in compact form. The parent path is stored once,
+// names are packed into a single string arena and the per-entry attributes
+// live in fixed-size parallel arrays; a full fs::path is only built when an
+// operation asks for one.
+class DirectoryListing {
+private:
+    fs::path parent;
+    std::string arena;                  // names, each followed by '\0'
+    std::vector<uint32_t> offsets;
+    std::vector<uint16_t> lengths;
+    std::vector<uint8_t> types;         // DT_* as reported by getdents64
+    std::vector<uint32_t> modes;        // 0 until the entry has been stat'ed
+    std::vector<uint64_t> sizes;
+    std::vector<int64_t> mtimes;        // nanoseconds since the epoch
+    std::vector<uint8_t> marks;         // 1 for entries marked for a batch operation
+    size_t marked = 0;
+    size_t garbage = 0;                 // arena bytes of removed entries
+
+    // Rewrites the arena without the names of removed entries.
+    void compact_arena();
+
+public:
+    void reset(const fs::path& dir);
+
+    void set_directory(const fs::path& dir) { parent = dir; }
+
+    void clear();
+
+    size_t size() const { return offsets.size(); }
+
+    bool empty() const { return offsets.empty(); }
+
+    const fs::path& directory() const { return parent; }
+
+    size_t memory_usage() const;
+
+    std::string_view name(size_t i) const { return std::string_view(arena.data() + offsets[i], lengths[i]); }
+
+    const char* c_name(size_t i) const { return arena.data() + offsets[i]; }
+
+    fs::path path(size_t i) const { return parent / name(i); }
+
+    uint8_t type(size_t i) const { return types[i]; }
+
+    bool has_stat(size_t i) const { return modes[i] != 0; }
+
+    uint32_t mode(size_t i) const { return modes[i]; }
+
+    uint64_t file_size(size_t i) const { return sizes[i]; }
+
+    int64_t mtime(size_t i) const { return mtimes[i]; }
+
+    void set_stat(size_t i, uint32_t mode, uint64_t size, int64_t mtime);
+
+    void forget_stat(size_t i) { modes[i] = 0; }
+
+    bool is_marked(size_t i) const { return marks[i]; }
+
+    size_t marked_count() const { return marked; }
+
+    void set_marked(size_t i, bool mark);
+    void clear_marks();
+
+    void forget_stats() { std::fill(modes.begin(), modes.end(), 0); }
+
+    void push_back(std::string_view name, uint8_t type = DT_UNKNOWN);
+
+    // Moves every entry of `other` to the end of this listing.
+    void append(DirectoryListing& other);
+
+    // Index of the entry called `name`, or size() when there is none.
+    size_t find(std::string_view entry) const;
+
+    // Keeps the entries whose `alive` flag is set, in their current order.
+    void retain(const std::vector<char>& alive);
+
+    // The raw columns, for writing the listing out as it is in memory.
+    struct Columns {
+        size_t count = 0;
+        std::string_view arena;
+        const uint32_t* offsets = nullptr;
+        const uint16_t* lengths = nullptr;
+        const uint8_t* types = nullptr;
+        const uint32_t* modes = nullptr;
+        const uint64_t* sizes = nullptr;
+        const int64_t* mtimes = nullptr;
+    };
+
+    Columns columns() const;
+
+    // Replaces the entries with copies of `source`, unmarked.
+    void assign(const Columns& source);
+
+    // Reorders the entries so that entry i is the one that was at order[i].
+    // Only the fixed-size arrays move; names stay where they are in the arena.
+    void permute(const std::vector<uint32_t>& order);
+};
+
+// Lets background threads wake the UI thread out of poll(). Any number of
+// notify() calls before the UI gets to clear() collapse into one wakeup.
+class Wakeup {
+private:
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+public:
+    Wakeup() = default;
+    Wakeup(const Wakeup&) = delete;
+    Wakeup& operator=(const Wakeup&) = delete;
+
+    ~Wakeup();
+
+    int descriptor() const { return fd; }
+
+    void notify();
+    void clear();
+};
+
+// Reads the entries of an open directory with getdents64, so names and
+// d_type come straight from the kernel buffer without an object per entry.
+// "." and ".." are skipped. The buffer is per thread, so a visitor must not
+// read another directory on the same thread.
+class DirectoryReader {
+public:
+    static constexpr size_t BUFFER_SIZE = 64 * 1024;
+
+    // Calls visit(name, d_type) for every entry until the directory ends or
+    // stop() returns true, which is checked once per buffer. Returns 0, or
+    // the errno getdents64 failed with.
+    template <typename Stop, typename Visit>
+    static int read(int fd, Stop stop, Visit visit) {
+        static thread_local std::vector<char> buffer(BUFFER_SIZE);
+        while (!stop()) {
+            ssize_t len = getdents64(fd, buffer.data(), buffer.size());
+            Profiler::count(Profiler::GETDENTS);
+            if (len <= 0) return len < 0 ? errno : 0;
+            for (ssize_t pos = 0; pos < len; ) {
+                auto* entry = reinterpret_cast<struct dirent64*>(buffer.data() + pos);
+                pos += entry->d_reclen;
+                const char* name = entry->d_name;
+                if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+                visit(name, entry->d_type);
+            }
+        }
+        return 0;
+    }
+};
+
+// Walks a directory on a background thread and hands entries over in batches,
+// so the UI can draw the first screen long before a huge directory is read.
+class DirectoryScanner {
+private:
+    static constexpr size_t BATCH_SIZE = 4096;
+
+    std::thread worker;
+    std::mutex mtx;
+    DirectoryListing pending;
+    std::atomic<bool> running{false};
+    std::atomic<bool> complete{false};
+    std::atomic<bool> cancel_flag{false};
+    std::atomic<size_t> scanned{0};
+    std::atomic<int> scan_errno{0};
+    Wakeup* wakeup = nullptr;
+
+    void flush(DirectoryListing& batch);
+    void run(fs::path dir);
+
+public:
+    ~DirectoryScanner() { cancel(); }
+
+    // Notified whenever a batch of entries or the end of the scan is ready.
+    void set_wakeup(Wakeup* target) { wakeup = target; }
+
+    void start(const fs::path& dir);
+    void cancel();
+
+    bool is_running() const { return running; }
+
+    // True once the whole directory has been read; entries still pending
+    // are picked up by the next take().
+    bool is_complete() const { return complete; }
+
+    size_t count() const { return scanned; }
+
+    // The errno that ended the last scan early, opening or reading the
+    // directory, or 0. Cleared by cancel() and start().
+    int error() const { return scan_errno; }
+
+    // Moves everything scanned since the last call to the end of `out`.
+    bool take(DirectoryListing& out);
+};
+
+// What the File info pane shows about an entry, as returned by statx.
+struct FileMeta {
+    bool valid = false;
+    uint64_t size = 0;
+    uint64_t blocks = 0;    // 512-byte blocks allocated, less than size / 512 for sparse files
+    uint32_t mode = 0;
+    int64_t mtime_sec = 0;
+    uint32_t mtime_nsec = 0;
+    uint64_t dev = 0;
+    uint64_t ino = 0;
+};
+
+// Per-directory cache of entry metadata. Entries are filled in batches around
+// the cursor with statx against an open directory fd, so moving through the
+// list costs one batch per page instead of several syscalls per keypress.
+// The cache is dropped when the directory's own mtime changes or on refresh.
+class MetadataCache {
+private:
+    static constexpr unsigned STATX_FIELDS = STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_BLOCKS |
+                                             STATX_MTIME | STATX_INO;
+
+    int dir_fd = -1;
+    int64_t dir_mtime_sec = 0;
+    uint32_t dir_mtime_nsec = 0;
+    std::unordered_map<std::string, FileMeta> entries;
+
+    // Forgets everything if entries were added, removed or renamed since the last batch.
+    void check_directory();
+
+public:
+    ~MetadataCache();
+
+    // AT_STATX_DONT_SYNC lets network filesystems answer from their attribute
+    // cache instead of doing a round trip to the server per entry.
+    static FileMeta fetch(int dir_fd, const char* name);
+
+    int directory_fd() const { return dir_fd; }
+
+    void reset(const fs::path& dir);
+
+    void clear() { entries.clear(); }
+
+    void invalidate(const std::string& name) { entries.erase(name); }
+
+    // Fills in every entry shown in rows [first, last) of `view` that is not
+    // cached yet, and copies the result into the listing's attribute arrays.
+    void prefetch(DirectoryListing& listing, const std::vector<uint32_t>& view, int first, int last);
+    const FileMeta* find(const std::string& name) const;
+};
+
+// Watches one directory with inotify. Events are folded into a pending set
+// keyed by name, so a storm of create/delete/rename events on the same files
+// collapses into one final state per name that is applied in a single pass.
+// One inotify instance lives as long as the watcher and only its watch moves
+// between directories: closing an instance waits for an RCU grace period,
+// which would stall every directory change by several milliseconds.
+class DirectoryWatcher {
+private:
+    static constexpr uint32_t EVENTS = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                                       IN_ATTRIB | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF |
+                                       IN_ONLYDIR;
+
+    int fd = -1;
+    int wd = -1;                                     // the current watch; events of earlier ones are dropped
+    std::unordered_map<std::string, bool> changes;   // name -> exists after the events
+    std::unordered_set<std::string> touched;         // names whose metadata changed
+    bool rescan = false;
+
+public:
+    struct Batch {
+        std::unordered_map<std::string, bool> changes;
+        std::unordered_set<std::string> touched;
+        bool rescan = false;
+    };
+
+    ~DirectoryWatcher();
+
+    // Replaces the previous watch. Without inotify the manager simply
+    // behaves as before and only sees its own changes.
+    void watch(const fs::path& dir);
+
+    // Reads every queued event without blocking.
+    void drain();
+
+    bool pending() const { return rescan || !changes.empty() || !touched.empty(); }
+
+    // Becomes readable when events are queued; -1 without inotify.
+    int descriptor() const { return fd; }
+
+    Batch take();
+};
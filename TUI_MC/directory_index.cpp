@@ -0,0 +1,223 @@
+#include "directory_index.h"
+#include "profiler.h"
+
+#include <set>
+#include <algorithm>
+#include <cstring>
+#include <climits>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+uint64_t DirectoryIndex::record_size(size_t count, size_t arena_size, size_t path_length) {
+    return align8(sizeof(Record) + path_length) + align8(count * ENTRY_BYTES) + align8(arena_size);
+}
+
+const DirectoryIndex::Record* DirectoryIndex::find(uint64_t dev, uint64_t ino) const {
+    if (!map) return nullptr;
+    uint64_t mask = header().slot_count - 1;
+    for (uint64_t probe = 0, i = slot_hash(dev, ino) & mask; probe <= mask; probe++, i = (i + 1) & mask) {
+        const Slot& slot = slots()[i];
+        if (slot.at == 0) return nullptr;
+        if (slot.dev != dev || slot.ino != ino) continue;
+        if (slot.at % 8 || slot.at > map_size - sizeof(Record)) return nullptr;
+        const Record* record = reinterpret_cast<const Record*>(map + slot.at);
+        if (record->size > map_size - slot.at || record->count > UINT32_MAX || record->arena_size > UINT32_MAX ||
+            record->size != record_size(record->count, record->arena_size, record->path_length)) {
+            return nullptr;
+        }
+        return record;
+    }
+    return nullptr;
+}
+
+std::string_view DirectoryIndex::record_path(const Record* record) {
+    return std::string_view(reinterpret_cast<const char*>(record + 1), record->path_length);
+}
+
+DirectoryListing::Columns DirectoryIndex::record_columns(const Record* record) {
+    const uint8_t* at = reinterpret_cast<const uint8_t*>(record) + align8(sizeof(Record) + record->path_length);
+    size_t n = record->count;
+    DirectoryListing::Columns columns;
+    columns.count = n;
+    columns.mtimes = reinterpret_cast<const int64_t*>(at);
+    columns.sizes = reinterpret_cast<const uint64_t*>(at + n * 8);
+    columns.offsets = reinterpret_cast<const uint32_t*>(at + n * 16);
+    columns.modes = reinterpret_cast<const uint32_t*>(at + n * 20);
+    columns.lengths = reinterpret_cast<const uint16_t*>(at + n * 24);
+    columns.types = at + n * 26;
+    columns.arena = std::string_view(reinterpret_cast<const char*>(at + align8(n * ENTRY_BYTES)), record->arena_size);
+    return columns;
+}
+
+bool DirectoryIndex::names_valid(const DirectoryListing::Columns& columns) {
+    for (size_t i = 0; i < columns.count; i++) {
+        uint64_t end = static_cast<uint64_t>(columns.offsets[i]) + columns.lengths[i];
+        if (end >= columns.arena.size() || columns.arena[end] != '\0') return false;
+    }
+    return true;
+}
+
+void DirectoryIndex::write_columns(FILE* out, const Source& source) {
+    static const char padding[8] = {0};
+    DirectoryListing::Columns columns = source.listing->columns();
+    size_t n = columns.count;
+    Record record{};
+    record.dev = source.dev;
+    record.ino = source.ino;
+    record.mtime = source.mtime;
+    record.count = n;
+    record.arena_size = columns.arena.size();
+    record.size = record_size(n, columns.arena.size(), source.path.size());
+    record.path_length = source.path.size();
+    record.mode = source.mode;
+    record.reversed = source.reversed;
+    record.sorted = source.sorted;
+    fwrite(&record, sizeof(record), 1, out);
+    fwrite(source.path.data(), 1, source.path.size(), out);
+    fwrite(padding, 1, align8(sizeof(Record) + source.path.size()) - sizeof(Record) - source.path.size(), out);
+    fwrite(columns.mtimes, sizeof(int64_t), n, out);
+    fwrite(columns.sizes, sizeof(uint64_t), n, out);
+    fwrite(columns.offsets, sizeof(uint32_t), n, out);
+    fwrite(columns.modes, sizeof(uint32_t), n, out);
+    fwrite(columns.lengths, sizeof(uint16_t), n, out);
+    fwrite(columns.types, sizeof(uint8_t), n, out);
+    fwrite(padding, 1, align8(n * ENTRY_BYTES) - n * ENTRY_BYTES, out);
+    fwrite(columns.arena.data(), 1, columns.arena.size(), out);
+    fwrite(padding, 1, align8(columns.arena.size()) - columns.arena.size(), out);
+}
+
+bool DirectoryIndex::same_collation() const {
+    if (!map) return false;
+    const Header& head = header();
+    return strnlen(head.collation, sizeof(head.collation)) < sizeof(head.collation) &&
+           ListingSorter::collation() == head.collation;
+}
+
+void DirectoryIndex::unmap() {
+    if (map) munmap(const_cast<uint8_t*>(map), map_size);
+    map = nullptr;
+    map_size = 0;
+}
+
+bool DirectoryIndex::open(const std::string& path) {
+    ScopedTimer timer(Profiler::INDEX);
+    unmap();
+    file = path;
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st;
+    void* mapped = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(Header)) {
+        mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (mapped == MAP_FAILED) return false;
+    map = static_cast<const uint8_t*>(mapped);
+    map_size = st.st_size;
+
+    const Header& head = header();
+    bool valid = memcmp(head.magic, MAGIC, sizeof(MAGIC)) == 0 && head.version == VERSION &&
+                 head.byte_order == ENDIAN_MARK && head.file_size == map_size && head.slot_count > 0 &&
+                 (head.slot_count & (head.slot_count - 1)) == 0 && head.slots_at % 8 == 0 &&
+                 head.slots_at <= map_size && head.slot_count <= (map_size - head.slots_at) / sizeof(Slot);
+    if (!valid) {
+        unmap();
+        return false;
+    }
+    return true;
+}
+
+bool DirectoryIndex::load(uint64_t dev, uint64_t ino, const fs::path& path, Listing& out) const {
+    ScopedTimer timer(Profiler::INDEX);
+    const Record* record = find(dev, ino);
+    if (!record || record_path(record) != path.native()) return false;
+    DirectoryListing::Columns columns = record_columns(record);
+    if (!names_valid(columns)) return false;
+    out.listing.assign(columns);
+    out.listing.set_directory(path);
+    out.mtime = record->mtime;
+    out.mode = static_cast<ListingSorter::Mode>(std::min<uint8_t>(record->mode, ListingSorter::MTIME));
+    out.reversed = record->reversed;
+    // An order made under another collation is re-sorted, not trusted.
+    out.sorted = record->sorted && same_collation();
+    return true;
+}
+
+bool DirectoryIndex::save(const std::vector<Source>& sources) {
+    ScopedTimer timer(Profiler::INDEX);
+    if (file.empty()) return false;
+    bool changed = false;
+    std::set<std::pair<uint64_t, uint64_t>> replaced;
+    for (const Source& source : sources) {
+        const Record* old = find(source.dev, source.ino);
+        changed = changed || !old || old->mtime != source.mtime || old->count != source.listing->size() ||
+                  old->mode != source.mode || old->reversed != source.reversed ||
+                  old->sorted != source.sorted || record_path(old) != source.path;
+        replaced.insert({source.dev, source.ino});
+    }
+    if (!changed && same_collation()) return true;
+
+    // Records to keep from the current file, valid ones only.
+    uint64_t total = 0;
+    for (const Source& source : sources) {
+        total += record_size(source.listing->size(), source.listing->columns().arena.size(), source.path.size());
+    }
+    std::vector<const Record*> kept;
+    for (uint64_t i = 0; map && i < header().slot_count; i++) {
+        const Slot& slot = slots()[i];
+        if (slot.at == 0 || replaced.count({slot.dev, slot.ino})) continue;
+        const Record* record = find(slot.dev, slot.ino);
+        if (!record || total + record->size > MAX_BYTES) continue;
+        total += record->size;
+        kept.push_back(record);
+    }
+
+    size_t records = sources.size() + kept.size();
+    uint64_t slot_count = 16;
+    while (slot_count < records * 2) slot_count *= 2;
+    Header head{};
+    memcpy(head.magic, MAGIC, sizeof(MAGIC));
+    head.version = VERSION;
+    head.byte_order = ENDIAN_MARK;
+    snprintf(head.collation, sizeof(head.collation), "%s", ListingSorter::collation().c_str());
+    head.records = records;
+    head.slot_count = slot_count;
+    head.slots_at = align8(sizeof(Header));
+    std::vector<Slot> table(slot_count, Slot{0, 0, 0});
+    uint64_t at = head.slots_at + slot_count * sizeof(Slot);
+    auto place = [&](uint64_t dev, uint64_t ino, uint64_t size) {
+        uint64_t i = slot_hash(dev, ino) & (slot_count - 1);
+        while (table[i].at) i = (i + 1) & (slot_count - 1);
+        table[i] = {dev, ino, at};
+        at += size;
+    };
+    for (const Source& source : sources) {
+        place(source.dev, source.ino,
+              record_size(source.listing->size(), source.listing->columns().arena.size(), source.path.size()));
+    }
+    for (const Record* record : kept) place(record->dev, record->ino, record->size);
+    head.file_size = at;
+
+    std::string temporary = file + ".tmp." + std::to_string(getpid());
+    FILE* out = fopen(temporary.c_str(), "wbe");
+    if (!out) return false;
+    fwrite(&head, sizeof(head), 1, out);
+    fwrite(table.data(), sizeof(Slot), table.size(), out);
+    for (const Source& source : sources) write_columns(out, source);
+    bool same = same_collation();
+    for (const Record* record : kept) {
+        Record copy = *record;
+        copy.sorted = copy.sorted && same;
+        fwrite(&copy, sizeof(copy), 1, out);
+        fwrite(record + 1, 1, record->size - sizeof(Record), out);
+    }
+    bool ok = fflush(out) == 0 && fsync(fileno(out)) == 0;
+    ok = fclose(out) == 0 && ok;
+    if (!ok || rename(temporary.c_str(), file.c_str()) != 0) {
+        unlink(temporary.c_str());
+        return false;
+    }
+    return true;
+}
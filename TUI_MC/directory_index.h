@@ -0,0 +1,128 @@
+#pragma once
+
+#include "directory.h"
+#include "listing.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <functional>
+
+namespace fs = std::filesystem;
+
+// Directory listings kept on disk between runs, so the first screen after
+// start-up comes from one mmap'ed file instead of a scan. The file holds
+//
+//   header    magic, format version, byte-order mark, counts, the collation
+//             locale the stored orders were made in
+//   slots     open-addressed table from (dev, ino) to a record offset
+//   records   per directory: a fixed header, the path, the listing's
+//             columns widest first (so each is naturally aligned), then
+//             the name arena, everything padded to 8 bytes
+//
+// It is only ever replaced whole through rename(), so a reader sees either
+// the old file or the new one. A file or record that fails any check is
+// ignored and the directory is scanned as if there were no index.
+class DirectoryIndex {
+public:
+    struct Listing {
+        DirectoryListing listing;
+        int64_t mtime = 0;                // directory mtime the listing was read at
+        ListingSorter::Mode mode = ListingSorter::NAME;
+        bool reversed = false;
+        bool sorted = false;              // entries are in order for mode/reversed
+    };
+
+    // One directory to write out.
+    struct Source {
+        uint64_t dev = 0, ino = 0;
+        int64_t mtime = 0;
+        std::string path;
+        const DirectoryListing* listing = nullptr;
+        ListingSorter::Mode mode = ListingSorter::NAME;
+        bool reversed = false;
+        bool sorted = false;
+    };
+
+private:
+    static constexpr char MAGIC[8] = {'F', 'M', 'I', 'N', 'D', 'E', 'X', '\n'};
+    static constexpr uint32_t VERSION = 2;
+    static constexpr uint32_t ENDIAN_MARK = 0x01020304;
+    static constexpr uint64_t MAX_BYTES = 4ull << 30;     // records of earlier runs are dropped past this
+    static constexpr size_t ENTRY_BYTES = sizeof(int64_t) + sizeof(uint64_t) + 2 * sizeof(uint32_t) +
+                                          sizeof(uint16_t) + sizeof(uint8_t);
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order;
+        uint64_t file_size;
+        uint64_t records;
+        uint64_t slot_count;              // a power of two
+        uint64_t slots_at;
+        char collation[48];               // ListingSorter::collation() the orders were made in
+    };
+
+    struct Slot {
+        uint64_t dev, ino;
+        uint64_t at;                      // record offset, 0 for an empty slot
+    };
+
+    struct Record {
+        uint64_t dev, ino;
+        int64_t mtime;
+        uint64_t count;
+        uint64_t arena_size;
+        uint64_t size;                    // of the whole record
+        uint32_t path_length;
+        uint8_t mode, reversed, sorted, unused;
+    };
+
+    std::string file;
+    const uint8_t* map = nullptr;
+    size_t map_size = 0;
+
+    static size_t align8(size_t n) { return (n + 7) & ~static_cast<size_t>(7); }
+
+    static size_t slot_hash(uint64_t dev, uint64_t ino) { return std::hash<uint64_t>()(ino * 31 + dev); }
+
+    static uint64_t record_size(size_t count, size_t arena_size, size_t path_length);
+
+    const Header& header() const { return *reinterpret_cast<const Header*>(map); }
+
+    const Slot* slots() const { return reinterpret_cast<const Slot*>(map + header().slots_at); }
+
+    // The record for (dev, ino) if the index has one that lies within the file.
+    const Record* find(uint64_t dev, uint64_t ino) const;
+    static std::string_view record_path(const Record* record);
+    static DirectoryListing::Columns record_columns(const Record* record);
+
+    // Every name must lie inside the arena and end in '\0'.
+    static bool names_valid(const DirectoryListing::Columns& columns);
+    static void write_columns(FILE* out, const Source& source);
+    bool same_collation() const;
+    void unmap();
+
+public:
+    DirectoryIndex() = default;
+    DirectoryIndex(const DirectoryIndex&) = delete;
+    DirectoryIndex& operator=(const DirectoryIndex&) = delete;
+
+    ~DirectoryIndex() { unmap(); }
+
+    bool is_open() const { return !file.empty(); }
+
+    // Uses `path` as the index, mapping it if it exists and is valid.
+    // Returns false when there was nothing usable to map.
+    bool open(const std::string& path);
+
+    // Copies the stored listing of the directory (dev, ino) at `path` into `out`.
+    bool load(uint64_t dev, uint64_t ino, const fs::path& path, Listing& out) const;
+
+    // Writes `sources` plus the records of directories not among them to a
+    // new file that replaces the index. Skipped when every source is stored
+    // already as it is, which is the common case of a run that only looked.
+    bool save(const std::vector<Source>& sources);
+};
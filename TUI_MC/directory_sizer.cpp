@@ -0,0 +1,76 @@
+#include "directory_sizer.h"
+#include "profiler.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+DirectorySizer::Totals DirectorySizer::snapshot(const Job& job) {
+    Totals totals;
+    totals.bytes = job.bytes;
+    totals.disk = job.disk;
+    totals.files = job.files;
+    totals.dirs = job.dirs;
+    totals.done = job.pending == 0;
+    return totals;
+}
+
+void DirectorySizer::scan(WorkStealingPool& pool, std::shared_ptr<Job> job, std::string path) {
+    int fd = job->cancelled ? -1 : open(path.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd >= 0) {
+        DirectoryReader::read(fd, [&] { return job->cancelled.load(); }, [&](const char* name, unsigned char) {
+            struct stat st;
+            Profiler::count(Profiler::STAT);
+            if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) return;
+            if (S_ISDIR(st.st_mode)) {
+                job->dirs++;
+                job->disk += st.st_blocks * 512;
+                job->pending++;
+                pool.submit([&pool, job, child = path + "/" + name] { scan(pool, job, child); });
+                return;
+            }
+            if (st.st_nlink > 1) {
+                std::lock_guard<std::mutex> lock(job->seen_mtx);
+                if (!job->seen.insert({st.st_dev, st.st_ino}).second) return;
+            }
+            job->files++;
+            job->bytes += st.st_size;
+            job->disk += st.st_blocks * 512;
+        });
+        close(fd);
+    }
+    if (--job->pending == 0 && job->wakeup && !job->cancelled) job->wakeup->notify();
+}
+
+DirectorySizer::~DirectorySizer() {
+    if (current) current->cancelled = true;
+}
+
+void DirectorySizer::clear() {
+    if (current) current->cancelled = true;
+    current.reset();
+    cache.clear();
+}
+
+DirectorySizer::Totals DirectorySizer::query(WorkStealingPool& pool, const fs::path& dir, const FileMeta& meta) {
+    Key key{meta.dev, meta.ino, meta.mtime_sec, meta.mtime_nsec};
+    auto cached = cache.find(key);
+    if (cached != cache.end()) return cached->second;
+
+    if (current && current->key == key) {
+        Totals totals = snapshot(*current);
+        if (totals.done) {
+            cache[key] = totals;
+            current.reset();
+        }
+        return totals;
+    }
+
+    if (current) current->cancelled = true;
+    current = std::make_shared<Job>();
+    current->key = key;
+    current->pending = 1;
+    current->wakeup = wakeup;
+    pool.submit([&pool, job = current, path = dir.string()] { scan(pool, job, path); });
+    return snapshot(*current);
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "directory.h"
+#include "thread_pool.h"
+
+#include <filesystem>
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <unordered_set>
+#include <functional>
+#include <memory>
+
+namespace fs = std::filesystem;
+
+// Recursive size of directories for the File info pane. The walk runs on the
+// worker pool, one task per directory, and the pane polls the running totals
+// so they fill in while it counts. Files with several hard links are counted
+// once per (dev, ino). Finished totals are cached by the directory's
+// (dev, ino, mtime), so coming back to an unchanged directory is instant.
+class DirectorySizer {
+public:
+    struct Totals {
+        uint64_t bytes = 0;
+        uint64_t disk = 0;
+        uint64_t files = 0;
+        uint64_t dirs = 0;
+        bool done = false;
+    };
+
+private:
+    struct Key {
+        uint64_t dev, ino;
+        int64_t mtime_sec;
+        uint32_t mtime_nsec;
+        bool operator==(const Key& other) const {
+            return dev == other.dev && ino == other.ino &&
+                   mtime_sec == other.mtime_sec && mtime_nsec == other.mtime_nsec;
+        }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key& key) const {
+            return std::hash<uint64_t>()(key.ino * 31 + key.dev) ^ std::hash<int64_t>()(key.mtime_sec);
+        }
+    };
+
+    struct InodeHash {
+        size_t operator()(const std::pair<uint64_t, uint64_t>& id) const {
+            return std::hash<uint64_t>()(id.second * 31 + id.first);
+        }
+    };
+
+    // One running walk. Tasks hold it by shared_ptr, so a cancelled walk can
+    // wind down on its own after the pane moved on.
+    struct Job {
+        Key key;
+        std::atomic<uint64_t> bytes{0}, disk{0}, files{0}, dirs{0};
+        std::atomic<bool> cancelled{false};
+        std::atomic<int> pending{0};
+        Wakeup* wakeup = nullptr;
+        std::mutex seen_mtx;
+        std::unordered_set<std::pair<uint64_t, uint64_t>, InodeHash> seen;
+    };
+
+    std::unordered_map<Key, Totals, KeyHash> cache;
+    std::shared_ptr<Job> current;
+    Wakeup* wakeup = nullptr;
+
+    static Totals snapshot(const Job& job);
+    static void scan(WorkStealingPool& pool, std::shared_ptr<Job> job, std::string path);
+
+public:
+    ~DirectorySizer();
+
+    // Notified when a walk finishes, so its final totals get drawn.
+    void set_wakeup(Wakeup* target) { wakeup = target; }
+
+    // True while a walk for the pane is still adding up.
+    bool is_counting() const { return current && !current->cancelled && current->pending > 0; }
+
+    void clear();
+
+    // Returns the totals for `dir` so far, starting a walk when there is no
+    // cached or running one. Moving to another directory abandons the old walk.
+    Totals query(WorkStealingPool& pool, const fs::path& dir, const FileMeta& meta);
+};
@@ -0,0 +1,253 @@
+#include "duplicate_finder.h"
+#include "profiler.h"
+#include "directory.h"
+
+#include <cerrno>
+#include <algorithm>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+uint64_t DuplicateFinder::read64(const unsigned char* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint64_t DuplicateFinder::read32(const unsigned char* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint64_t DuplicateFinder::hash(const void* data, size_t len, uint64_t seed) {
+    const uint64_t P1 = 11400714785074694791ull, P2 = 14029467366897019727ull,
+                   P3 = 1609587929392839161ull, P4 = 9650029242287828579ull, P5 = 2870177450012600261ull;
+    auto round = [&](uint64_t acc, uint64_t input) { return rotl(acc + input * P2, 31) * P1; };
+    auto merge = [&](uint64_t acc, uint64_t value) { return (acc ^ round(0, value)) * P1 + P4; };
+
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    const unsigned char* end = p + len;
+    uint64_t h;
+    if (len >= 32) {
+        uint64_t v1 = seed + P1 + P2, v2 = seed + P2, v3 = seed, v4 = seed - P1;
+        for (; p + 32 <= end; p += 32) {
+            v1 = round(v1, read64(p));
+            v2 = round(v2, read64(p + 8));
+            v3 = round(v3, read64(p + 16));
+            v4 = round(v4, read64(p + 24));
+        }
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = merge(merge(merge(merge(h, v1), v2), v3), v4);
+    } else {
+        h = seed + P5;
+    }
+    h += len;
+    for (; p + 8 <= end; p += 8) h = rotl(h ^ round(0, read64(p)), 27) * P1 + P4;
+    if (p + 4 <= end) {
+        h = rotl(h ^ (read32(p) * P1), 23) * P2 + P3;
+        p += 4;
+    }
+    for (; p < end; p++) h = rotl(h ^ (*p * P5), 11) * P1;
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    return h ^ (h >> 32);
+}
+
+void DuplicateFinder::scan(std::string path) {
+    int fd = progress.cancelled ? -1 : open(path.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        if (!progress.cancelled) progress.fail(path + ": " + std::strerror(errno));
+        return;
+    }
+    DirectoryReader::read(fd, [&] { return progress.cancelled.load(); }, [&](const char* name, unsigned char type) {
+        if (type == DT_DIR) {
+            pool.submit(group, [this, child = path + "/" + name] { scan(child); });
+            return;
+        }
+        if (type != DT_REG && type != DT_UNKNOWN) return;
+
+        struct stat st;
+        Profiler::count(Profiler::STAT);
+        if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) return;
+        if (S_ISDIR(st.st_mode)) {
+            pool.submit(group, [this, child = path + "/" + name] { scan(child); });
+            return;
+        }
+        if (!S_ISREG(st.st_mode) || st.st_size == 0) return;
+        std::lock_guard<std::mutex> lock(files_mtx);
+        if (st.st_nlink > 1 && !seen.insert({st.st_dev, st.st_ino}).second) return;
+        files.push_back({path + "/" + name, static_cast<uint64_t>(st.st_size), 0});
+        progress.files_total++;
+    });
+    close(fd);
+}
+
+void DuplicateFinder::hash_edges(Candidate& file) {
+    int fd = open(file.path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        progress.fail(file.path + ": " + std::strerror(errno));
+        file.size = 0;
+        return;
+    }
+    unsigned char buf[2 * EDGE_BYTES];
+    bool whole = file.size <= 2 * EDGE_BYTES;
+    size_t len = whole ? file.size : 2 * EDGE_BYTES;
+    bool ok = whole ? pread(fd, buf, len, 0) == static_cast<ssize_t>(len)
+                    : pread(fd, buf, EDGE_BYTES, 0) == EDGE_BYTES &&
+                      pread(fd, buf + EDGE_BYTES, EDGE_BYTES, file.size - EDGE_BYTES) == EDGE_BYTES;
+    if (ok) {
+        file.hash = hash(buf, len, file.size);
+    } else {
+        progress.fail(file.path + ": short read");
+        file.size = 0;
+    }
+    close(fd);
+    progress.files_done++;
+}
+
+void DuplicateFinder::hash_contents(Candidate& file) {
+    int fd = open(file.path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        progress.fail(file.path + ": " + std::strerror(errno));
+        file.size = 0;
+        return;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    static thread_local std::vector<char> buffer(HASH_CHUNK);
+    uint64_t h = file.size;
+    for (uint64_t offset = 0; offset < file.size && !progress.cancelled; offset += HASH_CHUNK) {
+        uint64_t len = std::min(HASH_CHUNK, file.size - offset);
+        ssize_t got = pread(fd, buffer.data(), len, offset);
+        if (got != static_cast<ssize_t>(len)) {
+            // Changed since the scan; it can no longer match anything.
+            progress.fail(file.path + ": " + (got < 0 ? std::strerror(errno) : "file shrank while hashing"));
+            file.size = 0;
+            break;
+        }
+        h = hash(buffer.data(), len, h);
+        progress.bytes_done += len;
+    }
+    file.hash = h;
+    close(fd);
+}
+
+void DuplicateFinder::keep_collisions() {
+    std::sort(files.begin(), files.end(), [](const Candidate& a, const Candidate& b) {
+        return a.size != b.size ? a.size < b.size : a.hash < b.hash;
+    });
+    size_t out = 0;
+    for (size_t i = 0; i < files.size(); ) {
+        size_t j = i;
+        while (j < files.size() && files[j].size == files[i].size && files[j].hash == files[i].hash) j++;
+        if (j - i > 1 && files[i].size > 0) {
+            for (size_t k = i; k < j; k++, out++) {
+                if (out != k) files[out] = std::move(files[k]);
+            }
+        }
+        i = j;
+    }
+    files.resize(out);
+}
+
+void DuplicateFinder::run(fs::path root) {
+    ScopedTimer timer(Profiler::DUPLICATES);
+    pool.submit(group, [this, path = root.string()] { scan(path); });
+    group.wait();
+    seen.clear();
+    keep_collisions();
+    progress.planning = false;
+
+    progress.files_total = files.size();
+    for (size_t first = 0; first < files.size() && !progress.cancelled; first += EDGE_BATCH) {
+        pool.submit(group, [this, first] {
+            for (size_t i = first; i < std::min(files.size(), first + EDGE_BATCH) && !progress.cancelled; i++) {
+                hash_edges(files[i]);
+            }
+        });
+    }
+    group.wait();
+    keep_collisions();
+
+    for (const auto& file : files) {
+        if (file.size > 2 * EDGE_BYTES) progress.bytes_total += file.size;
+    }
+    for (auto& file : files) {
+        if (file.size > 2 * EDGE_BYTES && !progress.cancelled) {
+            pool.submit(group, [this, &file] { hash_contents(file); });
+        }
+    }
+    group.wait();
+    keep_collisions();
+
+    for (size_t i = 0; i < files.size(); ) {
+        Group found;
+        found.size = files[i].size;
+        size_t j = i;
+        for (; j < files.size() && files[j].size == files[i].size && files[j].hash == files[i].hash; j++) {
+            found.paths.push_back(std::move(files[j].path));
+        }
+        std::sort(found.paths.begin(), found.paths.end());
+        groups.push_back(std::move(found));
+        i = j;
+    }
+    // Most space to reclaim first.
+    std::stable_sort(groups.begin(), groups.end(), [](const Group& a, const Group& b) {
+        return a.size * (a.paths.size() - 1) > b.size * (b.paths.size() - 1);
+    });
+    files.clear();
+    progress.finish();
+}
+
+DuplicateFinder::~DuplicateFinder() {
+    if (coordinator.joinable()) progress.cancelled = true;
+    wait();
+}
+
+void DuplicateFinder::start(fs::path root) {
+    coordinator = std::thread(&DuplicateFinder::run, this, std::move(root));
+}
+
+void DuplicateFinder::wait() {
+    if (coordinator.joinable()) coordinator.join();
+}
+
+int DuplicateFinder::identical(const std::string& a, const std::string& b, uint64_t size, bool& same) {
+    same = false;
+    int fa = open(a.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fa < 0) return errno;
+    int fb = open(b.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fb < 0) {
+        int err = errno;
+        close(fa);
+        return err;
+    }
+    struct stat sa, sb;
+    int err = fstat(fa, &sa) != 0 || fstat(fb, &sb) != 0 ? errno : 0;
+    if (!err && uint64_t(sa.st_size) == size && uint64_t(sb.st_size) == size) {
+        same = sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+        posix_fadvise(fa, 0, 0, POSIX_FADV_SEQUENTIAL);
+        posix_fadvise(fb, 0, 0, POSIX_FADV_SEQUENTIAL);
+        std::vector<char> ba(1024 * 1024), bb(ba.size());
+        for (uint64_t offset = 0; !same && !err; ) {
+            ssize_t na = pread(fa, ba.data(), ba.size(), offset);
+            ssize_t nb = na <= 0 ? 0 : pread(fb, bb.data(), na, offset);
+            if (na < 0 || nb < 0) {
+                err = errno;
+            } else if (na == 0) {
+                same = offset == size;
+                break;
+            } else if (nb != na || memcmp(ba.data(), bb.data(), na) != 0) {
+                break;
+            }
+            offset += na;
+        }
+    }
+    close(fa);
+    close(fb);
+    return err;
+}
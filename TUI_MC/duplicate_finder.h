@@ -0,0 +1,89 @@
+#pragma once
+
+#include "thread_pool.h"
+
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <unordered_set>
+#include <functional>
+
+namespace fs = std::filesystem;
+
+// Finds files with identical content under a directory tree. The tree is
+// walked on the pool, one task per directory, and hard links to an inode
+// already seen are skipped. Files whose size is unique are dropped without
+// being read; the rest get a hash of their first and last 4 KiB, and only
+// files that still collide are hashed in full with pread on the pool.
+class DuplicateFinder {
+public:
+    struct Group {
+        uint64_t size = 0;
+        std::vector<std::string> paths;
+    };
+
+private:
+    static constexpr uint64_t EDGE_BYTES = 4096;
+    static constexpr uint64_t HASH_CHUNK = 4 * 1024 * 1024;
+    static constexpr size_t EDGE_BATCH = 256;
+
+    struct Candidate {
+        std::string path;
+        uint64_t size = 0;
+        uint64_t hash = 0;
+    };
+
+    struct InodeHash {
+        size_t operator()(const std::pair<uint64_t, uint64_t>& id) const {
+            return std::hash<uint64_t>()(id.second * 31 + id.first);
+        }
+    };
+
+    WorkStealingPool& pool;
+    OperationProgress& progress;
+    std::thread coordinator;
+    TaskGroup group;
+    std::mutex files_mtx;
+    std::vector<Candidate> files;
+    std::unordered_set<std::pair<uint64_t, uint64_t>, InodeHash> seen;
+    std::vector<Group> groups;
+
+    static uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+    static uint64_t read64(const unsigned char* p);
+    static uint64_t read32(const unsigned char* p);
+
+    // XXH64 of data[0, len).
+    static uint64_t hash(const void* data, size_t len, uint64_t seed);
+    void scan(std::string path);
+
+    // Hash of the first and last EDGE_BYTES; for files up to twice that it
+    // covers the whole content.
+    void hash_edges(Candidate& file);
+
+    // Hash of the whole file, chained over HASH_CHUNK pieces read with pread
+    // so cancelling and progress work on huge files. A file that shrank
+    // since the scan is reported and dropped.
+    void hash_contents(Candidate& file);
+
+    // Keeps only runs of files that agree on (size, hash), in that order.
+    void keep_collisions();
+    void run(fs::path root);
+
+public:
+    DuplicateFinder(WorkStealingPool& pool, OperationProgress& progress) : pool(pool), progress(progress) {}
+
+    ~DuplicateFinder();
+    void start(fs::path root);
+    void wait();
+
+    // Sets of identical files, valid after wait().
+    std::vector<Group>& results() { return groups; }
+
+    // Whether `a` and `b` still hold the same `size` bytes, compared byte for
+    // byte: the hashes are from the scan, and either file may have changed
+    // since. Returns 0, or the errno that stopped the comparison.
+    static int identical(const std::string& a, const std::string& b, uint64_t size, bool& same);
+};
@@ -0,0 +1,1743 @@
+#include "file_manager.h"
+#include "profiler.h"
+#include "key_log.h"
+#include "checksum.h"
+#include "pager.h"
+
+#include <cstdio>
+#include <cerrno>
+#include <fstream>
+#include <string_view>
+#include <ctime>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <unordered_set>
+#include <cstring>
+#include <poll.h>
+#include <fnmatch.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+int64_t FileManager::directory_mtime() const {
+    FileMeta dir = MetadataCache::fetch(metadata.directory_fd(), ".");
+    return dir.mtime_sec * 1000000000ll + dir.mtime_nsec;
+}
+
+void FileManager::show_stored_listing(int64_t mtime) {
+    listing_mtime = mtime;
+    listing_complete = true;
+    sort_list(NO_ENTRY);
+    if (mtime != scan_mtime) {
+        revalidating = true;
+        scanner.start(current_dir);
+    }
+}
+
+void FileManager::load_directory(const fs::path& dir, bool use_cache) {
+    ScopedTimer timer(Profiler::LOAD_DIRECTORY);
+    current_dir = dir;
+    metadata.reset(current_dir);
+    watcher.watch(current_dir);
+    FileMeta stat = MetadataCache::fetch(metadata.directory_fd(), ".");
+    dir_dev = stat.dev;
+    dir_ino = stat.ino;
+    scan_mtime = stat.mtime_sec * 1000000000ll + stat.mtime_nsec;
+    filter.set_query("");
+    revalidating = false;
+    fresh.clear();
+    selected = 0;
+    menu_top = 0;
+    menu_full_redraw = true;
+
+    ListingCache::Entry cached;
+    if (use_cache && stat.valid && listing_cache.take(dir_dev, dir_ino, cached)) {
+        scanner.cancel();
+        list = std::move(cached.listing);
+        list.set_directory(current_dir);
+        if (cached.sorter.mode() == sorter.mode() && cached.sorter.is_reversed() == sorter.is_reversed()) {
+            sorter = std::move(cached.sorter);
+        } else {
+            sorter.clear();
+        }
+        show_stored_listing(cached.mtime);
+        return;
+    }
+
+    DirectoryIndex::Listing stored;
+    if (use_cache && stat.valid && index.load(dir_dev, dir_ino, current_dir, stored)) {
+        scanner.cancel();
+        list = std::move(stored.listing);
+        sorter.clear();
+        if (stored.sorted && stored.mode == sorter.mode() && stored.reversed == sorter.is_reversed()) {
+            sorter.assume_sorted(list.size());
+        }
+        show_stored_listing(stored.mtime);
+        return;
+    }
+
+    list.reset(current_dir);
+    sorter.clear();
+    list_changed(true);
+    listing_complete = false;
+    scanner.start(current_dir);
+}
+
+void FileManager::update_file_list() {
+    if (!view.empty()) wanted_entry = list.name(selected_index());
+    load_directory(current_dir.empty() ? fs::current_path() : current_dir, false);
+}
+
+void FileManager::remember_directory() {
+    if (!view.empty()) cursors[current_dir.string()] = list.name(selected_index());
+    if (!listing_complete) return;
+    watcher.drain();
+    ListingCache::Entry entry;
+    entry.dev = dir_dev;
+    entry.ino = dir_ino;
+    entry.mtime = watcher.pending() ? 0 : listing_mtime;   // unapplied events: revalidate next time
+    entry.listing = std::move(list);
+    entry.sorter = std::move(sorter);
+    listing_cache.put(std::move(entry));
+}
+
+void FileManager::change_directory(const fs::path& dir, const std::string& focus) {
+    if (chdir(dir.c_str()) != 0) {
+        beep();
+        return;
+    }
+    remember_directory();
+    auto it = cursors.find(dir.string());
+    wanted_entry = !focus.empty() ? focus : it != cursors.end() ? it->second : std::string();
+    load_directory(dir, true);
+}
+
+std::string FileManager::member_path(size_t index) const {
+    std::string name(list.name(index));
+    return archive_dir.empty() ? name : archive_dir + "/" + name;
+}
+
+void FileManager::show_archive_directory(const std::string& dir, const std::string& focus) {
+    ScopedTimer timer(Profiler::LOAD_DIRECTORY);
+    archive_dir = dir;
+    scanner.cancel();
+    revalidating = false;
+    fresh.clear();
+    listing_complete = false;        // never cached or indexed as the real directory
+    filter.set_query("");
+    selected = 0;
+    menu_top = 0;
+    menu_full_redraw = true;
+
+    list.reset(dir.empty() ? archive->path() : archive->path() / dir);
+    for (uint32_t id : archive->entries(dir)) {
+        const TarArchive::Member& member = archive->member(id);
+        std::string_view path = archive->name(member);
+        uint8_t type = S_ISDIR(member.mode) ? DT_DIR : S_ISLNK(member.mode) ? DT_LNK : DT_REG;
+        list.push_back(path.substr(path.rfind('/') + 1), type);
+        list.set_stat(list.size() - 1, member.mode, archive->resolve(member).size, member.mtime * 1000000000ll);
+    }
+    auto it = cursors.find(list.directory().string());
+    wanted_entry = !focus.empty() ? focus : it != cursors.end() ? it->second : std::string();
+    sorter.clear();
+    sort_list(NO_ENTRY);
+}
+
+void FileManager::enter_archive(WINDOW* win, const fs::path& file) {
+    struct stat st;
+    if (stat(file.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+        beep();
+        return;
+    }
+    int64_t mtime = st.st_mtim.tv_sec * 1000000000ll + st.st_mtim.tv_nsec;
+    std::shared_ptr<const TarArchive> found;
+    for (auto it = archives.begin(); it != archives.end(); ++it) {
+        if ((*it)->matches(st.st_dev, st.st_ino, mtime) && (*it)->path() == file) {
+            found = *it;
+            archives.erase(it);
+            break;
+        }
+    }
+    if (!found) {
+        OperationProgress progress(&wakeup);
+        std::string error;
+        std::thread reader([&] {
+            found = TarArchive::open(file, progress, error);
+            progress.finish();
+        });
+        std::string title = "Reading " + file.filename().string();
+        show_progress(win, title, progress, false);
+        reader.join();
+        if (!found) {
+            if (progress.cancelled) return;
+            progress.fail(file.filename().string() + ": " + error);
+            draw_progress(win, title, progress);
+            KeyLog::read(win);
+            return;
+        }
+        werase(win);
+        box(win, 0, 0);
+        wrefresh(win);
+    }
+    archives.push_front(found);
+    if (archives.size() > ARCHIVE_CACHE) archives.pop_back();
+    remember_directory();
+    archive = std::move(found);
+    show_archive_directory(std::string(), std::string());
+}
+
+void FileManager::leave_archive() {
+    wanted_entry = archive->path().filename().string();
+    archive.reset();
+    archive_dir.clear();
+    load_directory(current_dir, true);
+}
+
+bool FileManager::is_directory(size_t index) const {
+    uint8_t type = list.type(index);
+    if (type == DT_DIR) return true;
+    if (type != DT_LNK && type != DT_UNKNOWN) return false;
+    struct stat st;
+    Profiler::count(Profiler::STAT);
+    return stat(list.path(index).c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+bool FileManager::poll_revalidation() {
+    bool complete = scanner.is_complete();
+    scanner.take(fresh);
+    if (!complete) return false;
+
+    std::unordered_set<std::string_view> found;
+    found.reserve(fresh.size());
+    for (size_t i = 0; i < fresh.size(); i++) found.insert(fresh.name(i));
+    std::vector<char> alive(list.size());
+    for (size_t i = 0; i < list.size(); i++) alive[i] = found.erase(list.name(i)) ? 1 : 0;
+    size_t kept = retain(alive, selected_index());
+    for (size_t i = 0; i < fresh.size(); i++) {
+        if (found.count(fresh.name(i))) list.push_back(fresh.name(i), fresh.type(i));
+    }
+    fresh.clear();
+    revalidating = false;
+    listing_mtime = scan_mtime;
+    sort_list(kept);
+    return true;
+}
+
+std::vector<fs::path> FileManager::operation_targets() const {
+    if (list.marked_count() == 0) return {selected_path()};
+    std::vector<fs::path> targets;
+    targets.reserve(list.marked_count());
+    for (size_t i = 0; i < list.size(); i++) {
+        if (list.is_marked(i)) targets.push_back(list.path(i));
+    }
+    return targets;
+}
+
+std::string FileManager::describe_targets(const std::vector<fs::path>& targets) {
+    return targets.size() == 1 ? targets[0].filename().string() : std::to_string(targets.size()) + " entries";
+}
+
+void FileManager::select_entry(size_t index) {
+    if (index != NO_ENTRY) {
+        auto it = std::find(view.begin(), view.end(), static_cast<uint32_t>(index));
+        if (it != view.end()) {
+            selected = it - view.begin();
+            return;
+        }
+    }
+    selected = std::max(0, std::min(selected, static_cast<int>(view.size()) - 1));
+}
+
+void FileManager::list_changed(bool structural, size_t keep) {
+    if (!structural && keep == NO_ENTRY) keep = selected_index();
+    list_version++;
+    if (structural) {
+        filter.clear();
+        view.clear();
+    }
+    if (filter.active()) {
+        filter.add_names(list);
+        view = filter.results();
+    } else {
+        for (size_t i = view.size(); i < list.size(); i++) view.push_back(i);
+    }
+    select_entry(keep);
+}
+
+void FileManager::sort_list(size_t keep) {
+    ScopedTimer timer(Profiler::SORT);
+    if (!wanted_entry.empty()) {
+        size_t found = list.find(wanted_entry);
+        if (found < list.size()) {
+            keep = found;
+            wanted_entry.clear();
+        }
+    }
+    WorkStealingPool* workers = list.size() >= ListingSorter::PARALLEL_MIN ? &worker_pool() : nullptr;
+    std::vector<uint32_t> moved;
+    sorter.merge(list, metadata.directory_fd(), workers, moved);
+    list_changed(true, keep < moved.size() ? moved[keep] : NO_ENTRY);
+}
+
+size_t FileManager::retain(const std::vector<char>& alive, size_t index) {
+    size_t kept = NO_ENTRY;
+    if (index != NO_ENTRY && alive[index]) kept = std::count(alive.begin(), alive.begin() + index, 1);
+    sorter.retain(alive);
+    list.retain(alive);
+    return kept;
+}
+
+void FileManager::apply_changes(DirectoryWatcher::Batch& batch) {
+    for (const auto& name : batch.touched) metadata.invalidate(name);
+    std::vector<char> alive(list.size(), 1);
+    std::string name;
+    for (size_t i = 0; i < list.size(); i++) {
+        name.assign(list.name(i));
+        if (batch.touched.count(name)) list.forget_stat(i);
+        auto it = batch.changes.find(name);
+        if (it == batch.changes.end()) continue;
+        if (!it->second) alive[i] = 0;     // deleted or moved away
+        else batch.changes.erase(it);      // created, but already listed
+    }
+    if (std::count(alive.begin(), alive.end(), 0) == 0 && batch.changes.empty()) return;
+
+    size_t kept = retain(alive, selected_index());
+    for (const auto& [created, exists] : batch.changes) {
+        if (exists) list.push_back(created);
+    }
+    listing_mtime = directory_mtime();
+
+    sort_list(kept);
+}
+
+WorkStealingPool& FileManager::worker_pool() {
+    if (!pool) pool = std::make_unique<WorkStealingPool>();
+    return *pool;
+}
+
+void FileManager::draw_menu_row(WINDOW* win, int row, const MenuRow& content) const {
+    mvwhline(win, row + 1, 1, ' ', xMax - 2);
+    if (content.highlighted) wattron(win, A_REVERSE);
+    mvwaddnstr(win, row + 1, 1, content.text.c_str(), xMax - 2);
+    if (content.highlighted) wattroff(win, A_REVERSE);
+}
+
+std::string FileManager::menu_title() const {
+    std::string title = "File Manager";
+    if (sorter.mode() != ListingSorter::NAME || sorter.is_reversed()) {
+        title += std::string(" [") + (sorter.is_reversed() ? "-" : "") + sorter.mode_name() + "]";
+    }
+    if (list.marked_count()) {
+        title += " [" + std::to_string(list.marked_count()) + " marked]";
+    }
+    if (filter.active() || filter_editing) {
+        title += " /" + filter.text() + (filter_editing ? "_" : "") +
+                 " (" + std::to_string(view.size()) + " of " + std::to_string(list.size()) + ")";
+    }
+    if (scanner.is_running()) {
+        title += " - scanning " + std::to_string(scanner.count()) + " entries... (ESC to stop)";
+    }
+    return title;
+}
+
+FileManager::FileManager(const std::string& index_file) {
+    scanner.set_wakeup(&wakeup);
+    sizer.set_wakeup(&wakeup);
+    preview.set_wakeup(&wakeup);
+    if (!index_file.empty()) index.open(index_file);
+    load_directory(fs::current_path(), true);
+}
+
+void FileManager::save_index() {
+    if (!index.is_open()) return;
+    watcher.drain();
+    std::vector<DirectoryIndex::Source> sources;
+    auto add = [&sources](uint64_t dev, uint64_t ino, int64_t mtime, const DirectoryListing& listing,
+                          const ListingSorter& order) {
+        sources.push_back({dev, ino, mtime, listing.directory().string(), &listing, order.mode(),
+                           order.is_reversed(), order.size() == listing.size()});
+    };
+    if (listing_complete) add(dir_dev, dir_ino, watcher.pending() ? 0 : listing_mtime, list, sorter);
+    listing_cache.for_each([&add](const ListingCache::Entry& entry) {
+        add(entry.dev, entry.ino, entry.mtime, entry.listing, entry.sorter);
+    });
+    index.save(sources);
+}
+
+void FileManager::wipe_preview(WINDOW* win) {
+    if (drawn_preview) redrawwin(win);
+    drawn_preview = 0;
+}
+
+void FileManager::cancel_scan() {
+    scanner.cancel();
+    if (revalidating) {
+        revalidating = false;
+        fresh.clear();
+    }
+}
+
+bool FileManager::poll_scan() {
+    if (archive) return false;
+    if (revalidating) return poll_revalidation();
+    if (!listing_complete && scanner.is_complete()) {
+        listing_complete = true;
+        listing_mtime = scan_mtime;
+    }
+    // A cursor still on the first row stays at the top of the list as
+    // earlier names arrive, rather than following whichever entry
+    // happened to be first in the first frame's batches.
+    size_t keep = selected == 0 ? NO_ENTRY : selected_index();
+    if (!scanner.take(list)) return false;
+    sort_list(keep);
+    return true;
+}
+
+bool FileManager::enter_selected(WINDOW* win) {
+    if (view.empty()) return false;
+    size_t index = selected_index();
+    if (archive) {
+        if (!is_directory(index)) return false;
+        cursors[list.directory().string()] = list.name(index);
+        show_archive_directory(member_path(index), std::string());
+        return true;
+    }
+    if (is_directory(index)) {
+        change_directory(selected_path(), std::string());
+        return true;
+    }
+    if (!TarArchive::is_archive_name(std::string(list.name(index)))) return false;
+    enter_archive(win, selected_path());
+    return true;
+}
+
+void FileManager::leave_directory() {
+    if (archive) {
+        if (!view.empty()) cursors[list.directory().string()] = list.name(selected_index());
+        if (archive_dir.empty()) {
+            leave_archive();
+            return;
+        }
+        size_t slash = archive_dir.rfind('/');
+        std::string parent = slash == std::string::npos ? std::string() : archive_dir.substr(0, slash);
+        show_archive_directory(parent, archive_dir.substr(slash + 1));
+        return;
+    }
+    fs::path parent = current_dir.parent_path();
+    if (parent == current_dir) return;
+    change_directory(parent, current_dir.filename().string());
+}
+
+bool FileManager::poll_watcher() {
+    watcher.drain();
+    if (archive || scanner.is_running() || !watcher.pending()) return false;
+    DirectoryWatcher::Batch batch = watcher.take();
+    if (batch.rescan) {
+        update_file_list();
+        return true;
+    }
+    apply_changes(batch);
+    return true;
+}
+
+void FileManager::refresh_metadata() {
+    if (archive) {
+        if (!view.empty()) show_archive_directory(archive_dir, std::string(list.name(selected_index())));
+        return;
+    }
+    metadata.clear();
+    list.forget_stats();
+    sizer.clear();
+    preview.clear();
+    if (sorter.mode() == ListingSorter::SIZE || sorter.mode() == ListingSorter::MTIME) {
+        sorter.clear();
+        sort_list(selected_index());
+    }
+}
+
+void FileManager::set_sort(ListingSorter::Mode mode) {
+    size_t keep = selected_index();
+    sorter.set_mode(mode);
+    sort_list(keep);
+}
+
+void FileManager::set_filter(const std::string& text) {
+    size_t keep = selected_index();
+    if (text.empty()) {
+        filter.set_query(text);
+        view.clear();
+        list_changed(false, keep);
+        return;
+    }
+    filter.add_names(list);
+    filter.set_query(text);
+    view = filter.results();
+    list_version++;
+    selected = 0;
+}
+
+void FileManager::edit_filter(WINDOW* menuwin, WINDOW* infowin) {
+    std::string text = filter.text();
+    filter_editing = true;
+    while (true) {
+        draw_menu(menuwin);
+        draw_file_info(infowin);
+        wtimeout(menuwin, is_scanning() ? 50 : 200);
+        int ch = KeyLog::read(menuwin);
+        if (ch == ERR) {
+            poll_scan();
+            poll_watcher();
+            continue;
+        }
+        if (ch == 27) {
+            text.clear();
+            set_filter(text);
+            break;
+        } else if (ch == '\n' || ch == KEY_ENTER) {
+            break;
+        } else if (ch == KEY_UP) {
+            update_selected(-1);
+        } else if (ch == KEY_DOWN) {
+            update_selected(1);
+        } else if (ch == KEY_BACKSPACE || ch == 127 || ch == 8) {
+            if (!text.empty()) {
+                text.pop_back();
+                set_filter(text);
+            }
+        } else if (ch >= 32 && ch < 256) {
+            text.push_back(static_cast<char>(ch));
+            set_filter(text);
+        }
+    }
+    filter_editing = false;
+}
+
+void FileManager::toggle_mark() {
+    if (view.empty()) return;
+    size_t index = selected_index();
+    list.set_marked(index, !list.is_marked(index));
+    list_version++;
+    update_selected(1);
+}
+
+void FileManager::mark_matching(const std::string& pattern, bool mark) {
+    if (pattern.empty()) return;
+    for (uint32_t index : view) {
+        if (fnmatch(pattern.c_str(), list.c_name(index), FNM_PERIOD) == 0) list.set_marked(index, mark);
+    }
+    list_version++;
+}
+
+void FileManager::invert_marks() {
+    for (uint32_t index : view) list.set_marked(index, !list.is_marked(index));
+    list_version++;
+}
+
+void FileManager::prompt_marks(WINDOW* win, bool mark) {
+    mark_matching(prompt_input(win, mark ? "Mark files matching" : "Unmark files matching", "*"), mark);
+}
+
+void FileManager::set_window_size(int y, int x) {
+    yMax = y;
+    xMax = x;
+}
+
+void FileManager::draw_menu(WINDOW* win) {
+    ScopedTimer timer(Profiler::DRAW_MENU);
+    int rows = visible_rows();
+    int count = static_cast<int>(view.size());
+    if (selected < menu_top) menu_top = selected;
+    if (selected >= menu_top + rows) menu_top = selected - rows + 1;
+    menu_top = std::max(0, std::min(menu_top, count - rows));
+
+    bool full = menu_full_redraw || static_cast<int>(menu_rows.size()) != rows;
+    if (full) {
+        werase(win);
+        box(win, 0, 0);
+        mvwprintw(win, yMax - 2, xMax - 19, "Press ESC to exit");
+        mvwaddnstr(win, yMax - 2, 1, list.directory().c_str(), std::max(0, xMax - 21));
+        menu_rows.assign(rows, MenuRow());
+        drawn_title.clear();
+        menu_full_redraw = false;
+    }
+
+    bool content_changed = full || menu_top != drawn_top || list_version != drawn_version;
+    for (int r = 0; r < rows; r++) {
+        int i = menu_top + r;
+        bool highlighted = i == selected && i < count;
+        MenuRow& row = menu_rows[r];
+        if (content_changed) {
+            std::string text;
+            if (i < count) {
+                if (list.is_marked(view[i])) text = "* ";
+                text += list.name(view[i]);
+            }
+            if (!full && text == row.text && highlighted == row.highlighted) continue;
+            row.text = std::move(text);
+        } else if (highlighted == row.highlighted) {
+            continue;
+        }
+        row.highlighted = highlighted;
+        draw_menu_row(win, r, row);
+    }
+    drawn_top = menu_top;
+    drawn_version = list_version;
+
+    std::string title = menu_title();
+    if (title != drawn_title) {
+        mvwhline(win, 0, 1, ACS_HLINE, xMax - 2);
+        mvwaddnstr(win, 0, 1, title.c_str(), xMax - 2);
+        drawn_title = std::move(title);
+    }
+    wrefresh(win);
+}
+
+void FileManager::draw_options(WINDOW* win, int operation_selected) const {
+    ScopedTimer timer(Profiler::DRAW_OPTIONS);
+    werase(win);
+    box(win, 0, 0);
+    mvwprintw(win, 0, 1, "Operations");
+    
+    for(int i = 0; i < operations.size(); i++) {
+        if (i == operation_selected) wattron(win, A_REVERSE);
+        mvwprintw(win, i + 1, 1, operations[i].c_str());
+        if (i == operation_selected) wattroff(win, A_REVERSE);
+    }
+    
+    wrefresh(win);
+}
+
+void FileManager::update_selected(int change) {
+    wanted_entry.clear();
+    selected += change;
+    if (selected >= static_cast<int>(view.size())) selected = view.size() - 1;
+    if (selected < 0) selected = 0;
+}
+
+std::string FileManager::prompt_input(WINDOW* win, const std::string& title, const std::string& initial) {
+    curs_set(1);
+    std::string text = initial;
+    
+    werase(win);
+    box(win, 0, 0);
+    std::string msg = "Selected: " + selected_path().filename().string();
+    mvwaddnstr(win, yMax - 2, 1, msg.c_str(), xMax - 2);
+    
+    wattron(win, A_BOLD | A_UNDERLINE);
+    mvwprintw(win, 0, std::max(1, xMax / 2 - static_cast<int>(title.size()) / 2), "%s", title.c_str());
+    wattroff(win, A_BOLD | A_UNDERLINE);
+    
+    int width = xMax - 3;
+    while(true) {
+        // Long input scrolls so its end (and the cursor) stays visible.
+        size_t start = text.size() > static_cast<size_t>(width) ? text.size() - width : 0;
+        mvwhline(win, 1, 1, ' ', xMax - 2);
+        mvwaddnstr(win, 1, 1, text.c_str() + start, width);
+        wmove(win, 1, 1 + static_cast<int>(text.size() - start));
+        wrefresh(win);
+
+        int ch = KeyLog::read(win);
+        if (ch == 27) {
+            text.clear();
+            break;
+        } else if (ch == '\n' || ch == KEY_ENTER) {
+            break;
+        } else if (ch == KEY_BACKSPACE || ch == 127 || ch == 8) {
+            if (!text.empty()) text.pop_back();
+        } else if (ch >= 32 && ch < 256) {
+            text.push_back(static_cast<char>(ch));
+        }
+    }
+    
+    curs_set(0);
+    return text;
+}
+
+void FileManager::rename_file(WINDOW* win, const fs::path& file) {
+    std::string new_filename = prompt_input(win, "Write new filename");
+
+    if (!new_filename.empty()) {
+        fs::path target = file.parent_path() / new_filename;
+        std::error_code ec;
+        fs::rename(file, target, ec);
+        if (!ec) {
+            // Re-insert the entry under its new name; an overwritten
+            // target drops out of the list, and a target in another
+            // directory leaves it.
+            metadata.invalidate(file.filename().string());
+            metadata.invalidate(new_filename);
+            std::vector<char> alive(list.size(), 1);
+            for (size_t i = 0; i < list.size(); i++) {
+                if (list.name(i) == file.filename().native() || list.name(i) == new_filename) alive[i] = 0;
+            }
+            retain(alive, NO_ENTRY);
+            if (new_filename.find('/') == std::string::npos) {
+                list.push_back(new_filename);
+                sort_list(list.size() - 1);
+            } else {
+                sort_list(NO_ENTRY);   // the cursor stays where the entry was
+            }
+        } else {
+            beep();
+            mvwhline(win, yMax - 2, 1, ' ', xMax - 2);
+            std::string message = "Rename failed: " + ec.message() + ". Press any key";
+            mvwaddnstr(win, yMax - 2, 1, message.c_str(), xMax - 2);
+            wrefresh(win);
+            KeyLog::read(win);
+        }
+    }
+}
+
+std::string FileManager::format_bytes(uint64_t bytes) {
+    const char* units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+    double value = static_cast<double>(bytes);
+    int unit = 0;
+    while (value >= 1024 && unit < 4) {
+        value /= 1024;
+        unit++;
+    }
+    char buf[32];
+    snprintf(buf, sizeof(buf), unit == 0 ? "%.0f %s" : "%.1f %s", value, units[unit]);
+    return buf;
+}
+
+std::string FileManager::format_duration(double seconds) {
+    long total = static_cast<long>(seconds + 0.5);
+    char buf[32];
+    if (total >= 3600) {
+        snprintf(buf, sizeof(buf), "%ld:%02ld:%02ld", total / 3600, total / 60 % 60, total % 60);
+    } else {
+        snprintf(buf, sizeof(buf), "%02ld:%02ld", total / 60, total % 60);
+    }
+    return buf;
+}
+
+void FileManager::draw_progress(WINDOW* win, const std::string& title, OperationProgress& progress) const {
+    werase(win);
+    box(win, 0, 0);
+    wattron(win, A_BOLD);
+    mvwprintw(win, 0, 1, "%s", title.c_str());
+    wattroff(win, A_BOLD);
+
+    // Operations that move no data (delete) measure progress in entries.
+    bool by_bytes = progress.bytes_total > 0 || progress.files_total == 0;
+    uint64_t done = by_bytes ? progress.bytes_done : progress.files_done;
+    uint64_t total = by_bytes ? progress.bytes_total : progress.files_total;
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - progress.started).count();
+    double rate = elapsed > 0 ? done / elapsed : 0;
+
+    std::string files = "Files: " + std::to_string(progress.files_done) + " / " + std::to_string(progress.files_total);
+    if (progress.planning) files += " (counting...)";
+    int percent = total ? static_cast<int>(std::min(done, total) * 100 / total) : 100;
+    std::string bytes = by_bytes ? "Bytes: " + format_bytes(done) + " / " + format_bytes(total) +
+                                   " (" + std::to_string(percent) + "%)"
+                                 : "Done: " + std::to_string(percent) + "%";
+    std::string speed = "Speed: " + (by_bytes ? format_bytes(static_cast<uint64_t>(rate)) + "/s"
+                                              : std::to_string(static_cast<uint64_t>(rate)) + " entries/s");
+    std::string eta = "ETA: " + (rate > 0 && !progress.planning ? format_duration((total - std::min(done, total)) / rate) : std::string("--:--"));
+    std::string time = "Elapsed: " + format_duration(elapsed);
+
+    mvwprintw(win, 1, 1, "%s", files.c_str());
+    mvwprintw(win, 2, 1, "%s", bytes.c_str());
+    mvwprintw(win, 3, 1, "%s", speed.c_str());
+    mvwprintw(win, 4, 1, "%s", eta.c_str());
+    mvwprintw(win, 5, 1, "%s", time.c_str());
+
+    int bar = xMax - 4;
+    mvwaddch(win, 6, 1, '[');
+    for (int i = 0; i < bar; i++) waddch(win, i < bar * percent / 100 ? '#' : ' ');
+    waddch(win, ']');
+
+    if (progress.errors) {
+        std::lock_guard<std::mutex> lock(progress.error_mtx);
+        std::string errors = "Errors: " + std::to_string(progress.errors) + " - " + progress.first_error;
+        mvwaddnstr(win, 8, 1, errors.c_str(), xMax - 2);
+    }
+    if (progress.finished) {
+        mvwprintw(win, yMax - 2, 1, "%s", progress.cancelled ? "Cancelled. Press any key" : "Done. Press any key");
+    } else {
+        mvwprintw(win, yMax - 2, 1, "%s", progress.cancelled ? "Cancelling..." : "Press ESC to cancel");
+    }
+    wrefresh(win);
+}
+
+void FileManager::show_progress(WINDOW* win, const std::string& title, OperationProgress& progress, bool wait_key) {
+    wtimeout(win, 0);
+    while (!progress.finished) {
+        draw_progress(win, title, progress);
+        // Sleeps until a key, the engine finishing, or the next redraw is due.
+        pollfd fds[2] = {{input_fd, POLLIN, 0}, {wakeup.descriptor(), POLLIN, 0}};
+        poll(fds, 2, 100);
+        wakeup.clear();
+        if (KeyLog::read(win) == 27) progress.cancelled = true;
+    }
+    wtimeout(win, -1);
+    if (!wait_key) return;
+    draw_progress(win, title, progress);
+    KeyLog::read(win);
+}
+
+fs::path FileManager::destination_path(const std::string& destination) const {
+    fs::path target(destination);
+    return target.is_absolute() ? target : current_dir / target;
+}
+
+void FileManager::show_failures(const std::string& title, OperationProgress& progress) {
+    if (progress.failures.empty()) return;
+    WINDOW* win = newwin(0, 0, 0, 0);
+    keypad(win, TRUE);
+    const std::vector<std::string>& lines = progress.failures;
+    int cursor = 0, top = 0;
+    while (true) {
+        int rows, cols;
+        getmaxyx(win, rows, cols);
+        rows--;
+        int count = static_cast<int>(lines.size());
+        cursor = std::max(0, std::min(cursor, count - 1));
+        if (cursor < top) top = cursor;
+        if (cursor >= top + rows) top = cursor - rows + 1;
+
+        werase(win);
+        for (int r = 0; r < rows && top + r < count; r++) {
+            if (top + r == cursor) wattron(win, A_REVERSE);
+            mvwaddnstr(win, r, 0, lines[top + r].c_str(), cols);
+            if (top + r == cursor) wattroff(win, A_REVERSE);
+        }
+        std::string bar = title + ": " + std::to_string(progress.errors) + " errors" +
+                          (progress.errors > lines.size() ? " (list truncated)" : "") + "  q:close";
+        wattron(win, A_REVERSE);
+        mvwhline(win, rows, 0, ' ', cols);
+        mvwaddnstr(win, rows, 0, bar.c_str(), cols);
+        wattroff(win, A_REVERSE);
+        wrefresh(win);
+
+        int ch = KeyLog::read(win);
+        if (ch == 'q' || ch == 27 || ch == '\n' || ch == KEY_ENTER) break;
+        switch (ch) {
+            case KEY_DOWN: case 'j':
+                cursor++;
+                break;
+            case KEY_UP: case 'k':
+                cursor--;
+                break;
+            case KEY_NPAGE: case ' ':
+                cursor += rows;
+                break;
+            case KEY_PPAGE: case 'b':
+                cursor -= rows;
+                break;
+            case KEY_HOME: case 'g':
+                cursor = 0;
+                break;
+            case KEY_END: case 'G':
+                cursor = count - 1;
+                break;
+            default:
+                break;
+        }
+    }
+    delwin(win);
+    invalidate_menu();
+}
+
+void FileManager::finish_operation(WINDOW* win, const std::string& title, OperationProgress& progress) {
+    show_progress(win, title, progress);
+    show_failures(title, progress);
+    if (list.marked_count()) {
+        list.clear_marks();
+        list_version++;
+    }
+}
+
+void FileManager::copy_selected(WINDOW* win, const std::vector<fs::path>& files, bool verify) {
+    std::string title = verify ? "Verified copy to" : "Copy to";
+    std::string destination = prompt_input(win, title, current_dir.string() + "/");
+    if (destination.empty()) return;
+
+    OperationProgress progress(&wakeup);
+    CopyEngine engine(worker_pool(), progress);
+    engine.set_verify(verify);
+    engine.start(files, destination_path(destination));
+    finish_operation(win, (verify ? "Verified copy of " : "Copying ") + describe_targets(files), progress);
+    engine.wait();
+    if (verify && !engine.file_digests().empty()) export_digests(win, engine.file_digests());
+}
+
+void FileManager::export_digests(WINDOW* win, const std::vector<CopyEngine::FileDigest>& digests) {
+    std::string file = prompt_input(win, "Save SHA-256 digests to (ESC to skip)",
+                                    (current_dir / "SHA256SUMS").string());
+    if (file.empty()) return;
+    std::vector<const CopyEngine::FileDigest*> sorted;
+    for (const auto& entry : digests) sorted.push_back(&entry);
+    std::sort(sorted.begin(), sorted.end(), [](auto* a, auto* b) { return a->target < b->target; });
+    std::ofstream out(destination_path(file));
+    for (const auto* entry : sorted) out << Sha256::hex(entry->digest) << "  " << entry->target.string() << "\n";
+    out.close();
+    if (!out) {
+        beep();
+        mvwhline(win, yMax - 2, 1, ' ', xMax - 2);
+        std::string error = "Could not write " + file + ". Press any key";
+        mvwaddnstr(win, yMax - 2, 1, error.c_str(), xMax - 2);
+        wrefresh(win);
+        KeyLog::read(win);
+    }
+}
+
+void FileManager::view_member() {
+    const TarArchive::Member* member = archive->find(member_path(selected_index()));
+    if (!member || !S_ISREG(member->mode)) {
+        beep();
+        return;
+    }
+    const TarArchive::Member& data = archive->resolve(*member);
+    std::string title = selected_path().filename().string();
+    if (!archive->is_compressed()) {
+        Pager pager(open(archive->path().c_str(), O_RDONLY | O_CLOEXEC), data.offset, data.size, title);
+        if (!pager.is_open()) return;
+        pager.run();
+        invalidate_menu();
+        return;
+    }
+    int fd = memfd_create(title.c_str(), MFD_CLOEXEC);
+    if (fd < 0) {
+        beep();
+        return;
+    }
+    uint64_t limit = std::min(data.size, VIEW_LIMIT);
+    uint64_t kept = 0;
+    TarArchive::Reader reader(*archive);
+    int err = reader.read(*member, [&](const uint8_t* bytes, size_t length) {
+        size_t take = std::min<uint64_t>(length, limit - kept);
+        for (size_t written = 0; written < take; ) {
+            ssize_t n = write(fd, bytes + written, take - written);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) return false;
+            written += n;
+        }
+        kept += take;
+        return kept < limit;
+    });
+    if (err && kept < limit) {
+        close(fd);
+        beep();
+        return;
+    }
+    if (kept < data.size) title += " (first " + format_bytes(kept) + ")";
+    Pager pager(fd, 0, kept, title);
+    if (!pager.is_open()) return;
+    pager.run();
+    invalidate_menu();
+}
+
+void FileManager::extract_selected(WINDOW* win) {
+    std::vector<std::string> sources;
+    if (list.marked_count() == 0) sources.push_back(member_path(selected_index()));
+    for (size_t i = 0; i < list.size() && list.marked_count(); i++) {
+        if (list.is_marked(i)) sources.push_back(member_path(i));
+    }
+    std::string destination = prompt_input(win, "Copy to", current_dir.string() + "/");
+    if (destination.empty()) return;
+
+    std::string what = sources.size() == 1 ? fs::path(sources[0]).filename().string()
+                                           : std::to_string(sources.size()) + " entries";
+    OperationProgress progress(&wakeup);
+    ArchiveExtractor extractor(archive, progress);
+    extractor.start(std::move(sources), destination_path(destination));
+    finish_operation(win, "Extracting " + what, progress);
+    extractor.wait();
+}
+
+void FileManager::archive_operation(WINDOW* win, int operation) {
+    if (operation == 0) {
+        view_member();
+    } else if (operation == 3) {
+        extract_selected(win);
+    } else {
+        beep();
+        mvwhline(win, yMax - 2, 1, ' ', xMax - 2);
+        mvwaddnstr(win, yMax - 2, 1, "Not available inside an archive. Press any key", xMax - 2);
+        wrefresh(win);
+        KeyLog::read(win);
+    }
+}
+
+void FileManager::open_selected(const fs::path& file) {
+    Pager pager(file);
+    if (!pager.is_open()) return;
+    pager.run();
+    invalidate_menu();
+}
+
+std::string FileManager::link_duplicates(const DuplicateFinder::Group& set, size_t keep) {
+    const std::vector<std::string>& paths = set.paths;
+    for (size_t i = 0; i < paths.size(); i++) {
+        if (i == keep) continue;
+        std::string refused = recheck_duplicate(paths[i], paths[keep], set.size);
+        if (!refused.empty()) return refused;
+        std::string temporary = paths[i] + ".dup-link";
+        if (link(paths[keep].c_str(), temporary.c_str()) != 0) {
+            return paths[i] + ": " + std::strerror(errno);
+        }
+        if (rename(temporary.c_str(), paths[i].c_str()) != 0) {
+            std::string error = paths[i] + ": " + std::strerror(errno);
+            unlink(temporary.c_str());
+            return error;
+        }
+    }
+    return "";
+}
+
+std::string FileManager::recheck_duplicate(const std::string& path, const std::string& kept, uint64_t size) {
+    bool same;
+    int err = DuplicateFinder::identical(path, kept, size, same);
+    if (err) return path + ": " + std::strerror(err);
+    if (!same) return path + ": changed since the scan, left alone";
+    return "";
+}
+
+bool FileManager::confirm(WINDOW* win, const std::string& question) {
+    int rows, cols;
+    getmaxyx(win, rows, cols);
+    wattron(win, A_REVERSE);
+    mvwhline(win, rows - 1, 0, ' ', cols);
+    mvwaddnstr(win, rows - 1, 0, (question + " (y/n)").c_str(), cols);
+    wattroff(win, A_REVERSE);
+    wrefresh(win);
+    int ch = KeyLog::read(win);
+    return ch == 'y' || ch == 'Y';
+}
+
+void FileManager::browse_duplicates(std::vector<DuplicateFinder::Group>& groups, const std::string& summary) {
+    WINDOW* win = newwin(0, 0, 0, 0);
+    keypad(win, TRUE);
+    size_t group = 0, member = 0;
+    int top = 0;
+    std::string status = summary;
+    while (true) {
+        int rows, cols;
+        getmaxyx(win, rows, cols);
+        rows--;
+
+        // One header row per set followed by its files.
+        int cursor = 0, total = 0;
+        uint64_t reclaimable = 0;
+        for (size_t g = 0; g < groups.size(); g++) {
+            if (g == group) cursor = total + 1 + member;
+            total += 1 + groups[g].paths.size();
+            reclaimable += groups[g].size * (groups[g].paths.size() - 1);
+        }
+        if (cursor < top) top = std::max(0, cursor - 1);
+        if (cursor >= top + rows) top = cursor - rows + 1;
+
+        werase(win);
+        int row = 0;
+        for (size_t g = 0; g < groups.size() && row < top + rows; g++) {
+            const auto& set = groups[g];
+            if (row >= top) {
+                std::string header = std::to_string(set.paths.size()) + " copies of " + format_bytes(set.size) +
+                                     ", " + format_bytes(set.size * (set.paths.size() - 1)) + " reclaimable";
+                wattron(win, A_BOLD);
+                mvwaddnstr(win, row - top, 0, header.c_str(), cols);
+                wattroff(win, A_BOLD);
+            }
+            row++;
+            for (size_t m = 0; m < set.paths.size() && row < top + rows; m++, row++) {
+                if (row < top) continue;
+                bool highlighted = g == group && m == member;
+                if (highlighted) wattron(win, A_REVERSE);
+                mvwaddnstr(win, row - top, 2, set.paths[m].c_str(), cols - 2);
+                if (highlighted) wattroff(win, A_REVERSE);
+            }
+        }
+        if (groups.empty()) mvwaddnstr(win, 0, 0, "No duplicates found", cols);
+
+        std::string bar = std::to_string(groups.size()) + " sets, " + format_bytes(reclaimable) + " reclaimable  " +
+                          (status.empty() ? "d:delete l:link others to this q:close" : status);
+        wattron(win, A_REVERSE);
+        mvwhline(win, rows, 0, ' ', cols);
+        mvwaddnstr(win, rows, 0, bar.c_str(), cols);
+        wattroff(win, A_REVERSE);
+        wrefresh(win);
+
+        int ch = KeyLog::read(win);
+        status.clear();
+        if (ch == 'q' || ch == 27) break;
+        if (groups.empty()) continue;
+        auto& set = groups[group];
+        switch (ch) {
+            case KEY_DOWN: case 'j':
+                if (member + 1 < set.paths.size()) {
+                    member++;
+                } else if (group + 1 < groups.size()) {
+                    group++;
+                    member = 0;
+                }
+                break;
+            case KEY_UP: case 'k':
+                if (member > 0) {
+                    member--;
+                } else if (group > 0) {
+                    group--;
+                    member = groups[group].paths.size() - 1;
+                }
+                break;
+            case KEY_NPAGE: case ' ':
+                group = std::min(group + std::max(1, rows / 4), groups.size() - 1);
+                member = 0;
+                break;
+            case KEY_PPAGE: case 'b':
+                group -= std::min<size_t>(group, std::max(1, rows / 4));
+                member = 0;
+                break;
+            case 'd':
+                if (!confirm(win, "Delete " + set.paths[member] + "?")) break;
+                status = recheck_duplicate(set.paths[member], set.paths[member == 0 ? 1 : 0], set.size);
+                if (!status.empty()) break;
+                if (unlink(set.paths[member].c_str()) != 0) {
+                    status = set.paths[member] + ": " + std::strerror(errno);
+                    break;
+                }
+                set.paths.erase(set.paths.begin() + member);
+                break;
+            case 'l':
+                if (!confirm(win, "Link " + std::to_string(set.paths.size() - 1) + " copies to " + set.paths[member] + "?")) break;
+                status = link_duplicates(set, member);
+                if (status.empty()) set.paths.clear();
+                break;
+            default:
+                break;
+        }
+        // A set with a single file left is no longer a duplicate.
+        if (set.paths.size() < 2) {
+            groups.erase(groups.begin() + group);
+            if (group >= groups.size() && group > 0) group--;
+            member = 0;
+        }
+        if (!groups.empty()) member = std::min(member, groups[group].paths.size() - 1);
+    }
+    delwin(win);
+}
+
+void FileManager::find_duplicates(WINDOW* win, const fs::path& root) {
+    OperationProgress progress(&wakeup);
+    DuplicateFinder finder(worker_pool(), progress);
+    finder.start(root);
+    show_progress(win, "Finding duplicates in " + root.filename().string(), progress, false);
+    finder.wait();
+    if (progress.cancelled) return;
+
+    std::string summary;
+    if (progress.errors) summary = std::to_string(progress.errors) + " unreadable: " + progress.first_error;
+    browse_duplicates(finder.results(), summary);
+    invalidate_menu();
+}
+
+void FileManager::browse_matches(ContentSearch& search) {
+    WINDOW* win = newwin(0, 0, 0, 0);
+    keypad(win, TRUE);
+    std::vector<ContentSearch::Match> matches;
+    int cursor = 0, top = 0;
+    auto started = std::chrono::steady_clock::now();
+    double elapsed = 0;
+    while (true) {
+        bool running = !search.is_finished();
+        search.take(matches);
+        if (running) elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+        int rows, cols;
+        getmaxyx(win, rows, cols);
+        rows--;
+        int count = static_cast<int>(matches.size());
+        cursor = std::max(0, std::min(cursor, count - 1));
+        if (cursor < top) top = cursor;
+        if (cursor >= top + rows) top = cursor - rows + 1;
+
+        werase(win);
+        std::string row;
+        for (int r = 0; r < rows && top + r < count; r++) {
+            const auto& match = matches[top + r];
+            row = match.path + ":" + std::to_string(match.line) + ": ";
+            for (char c : match.text) row.push_back(c == '\t' ? ' ' : (static_cast<unsigned char>(c) < 32 ? '.' : c));
+            if (top + r == cursor) wattron(win, A_REVERSE);
+            mvwaddnstr(win, r, 0, row.c_str(), cols);
+            if (top + r == cursor) wattroff(win, A_REVERSE);
+        }
+        if (matches.empty() && !running) mvwaddnstr(win, 0, 0, "No matches", cols);
+
+        std::string bar = (running ? "Searching... " : "") + std::to_string(search.matches()) + " matches in " +
+                          std::to_string(search.files()) + " files, " + format_bytes(search.bytes()) + " in " +
+                          format_duration(elapsed) + ", " + std::to_string(search.binaries()) + " binary skipped" +
+                          (search.matches() > matches.size() && !running ? " (list truncated)" : "") +
+                          "  Enter:open q:close";
+        wattron(win, A_REVERSE);
+        mvwhline(win, rows, 0, ' ', cols);
+        mvwaddnstr(win, rows, 0, bar.c_str(), cols);
+        wattroff(win, A_REVERSE);
+        wrefresh(win);
+
+        wtimeout(win, running ? 100 : -1);
+        int ch = KeyLog::read(win);
+        if (ch == 'q' || ch == 27) break;
+        switch (ch) {
+            case KEY_DOWN: case 'j':
+                cursor++;
+                break;
+            case KEY_UP: case 'k':
+                cursor--;
+                break;
+            case KEY_NPAGE: case ' ':
+                cursor += rows;
+                break;
+            case KEY_PPAGE: case 'b':
+                cursor -= rows;
+                break;
+            case KEY_HOME: case 'g':
+                cursor = 0;
+                break;
+            case KEY_END: case 'G':
+                cursor = count - 1;
+                break;
+            case '\n': case KEY_ENTER:
+                if (count > 0) {
+                    Pager pager(fs::path(search.directory()) / matches[cursor].path);
+                    if (pager.is_open()) {
+                        pager.show_line(matches[cursor].line);
+                        pager.run();
+                    }
+                    keypad(win, TRUE);
+                    redrawwin(win);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    search.cancel();
+    delwin(win);
+}
+
+void FileManager::search_contents(WINDOW* win, const fs::path& root) {
+    std::string pattern = prompt_input(win, "Search in files (regex)");
+    if (pattern.empty()) return;
+
+    ContentSearch search(worker_pool());
+    std::string error = search.start(root, pattern);
+    if (!error.empty()) {
+        werase(win);
+        box(win, 0, 0);
+        mvwaddnstr(win, 1, 1, ("Bad pattern: " + error).c_str(), xMax - 2);
+        mvwprintw(win, yMax - 2, 1, "%s", "Press any key");
+        wrefresh(win);
+        KeyLog::read(win);
+        return;
+    }
+    browse_matches(search);
+    invalidate_menu();
+}
+
+void FileManager::delete_selected(WINDOW* win, const std::vector<fs::path>& files) {
+    OperationProgress count(&wakeup);
+    {
+        DeleteEngine counter(worker_pool(), count, true);
+        counter.start(files);
+        show_progress(win, "Counting " + describe_targets(files), count, false);
+        counter.wait();
+    }
+    if (count.cancelled) return;
+
+    werase(win);
+    box(win, 0, 0);
+    wattron(win, A_BOLD);
+    mvwprintw(win, 0, 1, "%s", "Delete");
+    wattroff(win, A_BOLD);
+    std::string what = "Delete " + describe_targets(files) + "?";
+    std::string entries = std::to_string(count.files_total) + " entries will be removed";
+    mvwaddnstr(win, 1, 1, what.c_str(), xMax - 2);
+    mvwaddnstr(win, 2, 1, entries.c_str(), xMax - 2);
+    if (count.errors) {
+        std::string errors = "Unreadable: " + std::to_string(count.errors) + " - " + count.first_error;
+        mvwaddnstr(win, 3, 1, errors.c_str(), xMax - 2);
+    }
+    mvwprintw(win, yMax - 2, 1, "%s", "Press y to delete, any other key to cancel");
+    wrefresh(win);
+    int ch = KeyLog::read(win);
+    if (ch != 'y' && ch != 'Y') return;
+
+    OperationProgress progress(&wakeup);
+    progress.files_total = count.files_total.load();
+    DeleteEngine engine(worker_pool(), progress, false);
+    engine.start(files);
+    finish_operation(win, "Deleting " + describe_targets(files), progress);
+    engine.wait();
+}
+
+void FileManager::move_selected(WINDOW* win, const std::vector<fs::path>& files) {
+    std::string destination = prompt_input(win, "Move to", current_dir.string() + "/");
+    if (destination.empty()) return;
+
+    OperationProgress progress(&wakeup);
+    MoveEngine engine(worker_pool(), progress);
+    engine.start(files, destination_path(destination));
+    finish_operation(win, "Moving " + describe_targets(files), progress);
+    engine.wait();
+}
+
+void FileManager::chmod_selected(WINDOW* win, const std::vector<fs::path>& files) {
+    OperationProgress progress(&wakeup);
+    ChmodEngine engine(progress);
+    std::string mode = prompt_input(win, "New mode (octal or u+x,go-w)");
+    if (mode.empty()) return;
+    if (!engine.set_mode(mode)) {
+        werase(win);
+        box(win, 0, 0);
+        mvwaddnstr(win, 1, 1, ("Bad mode: " + mode).c_str(), xMax - 2);
+        mvwprintw(win, yMax - 2, 1, "%s", "Press any key");
+        wrefresh(win);
+        KeyLog::read(win);
+        return;
+    }
+    engine.start(files);
+    finish_operation(win, "Changing mode of " + describe_targets(files), progress);
+    engine.wait();
+    refresh_metadata();
+}
+
+std::string FileManager::get_time(const FileMeta& meta) {
+    time_t cftime = meta.mtime_sec;
+    char timeBuf[26];
+    ctime_r(&cftime, timeBuf);
+    timeBuf[24] = '\0';
+    return std::string(timeBuf);
+}
+
+std::string FileManager::get_permissions(const FileMeta& meta) {
+    mode_t perms = meta.mode;
+    std::string permissions;
+    permissions += (perms & S_IRUSR) ? "r" : "-";
+    permissions += (perms & S_IWUSR) ? "w" : "-";
+    permissions += (perms & S_IXUSR) ? "x" : "-";
+    permissions += (perms & S_IRGRP) ? "r" : "-";
+    permissions += (perms & S_IWGRP) ? "w" : "-";
+    permissions += (perms & S_IXGRP) ? "x" : "-";
+    permissions += (perms & S_IROTH) ? "r" : "-";
+    permissions += (perms & S_IWOTH) ? "w" : "-";
+    permissions += (perms & S_IXOTH) ? "x" : "-";
+    return permissions;
+}
+
+void FileManager::draw_file_info(WINDOW* win) {
+    ScopedTimer timer(Profiler::DRAW_INFO);
+    int scan_errno = archive ? 0 : scanner.error();
+    if (view.empty() && !scan_errno) return;
+    
+    werase(win);
+    box(win, 0, 0);
+    mvwprintw(win, 0, 1, "File info");
+    if (archive) {
+        draw_member_info(win);
+        return;
+    }
+    if (scan_errno) {
+        // The listing lacks some or all of the directory; say why.
+        wipe_preview(win);
+        std::string message = std::string("Cannot read directory: ") + std::strerror(scan_errno);
+        mvwaddnstr(win, 1, 1, message.c_str(), xMax - 2);
+        mvwaddnstr(win, yMax - 2, 1, current_dir.c_str(), xMax - 2);
+        wrefresh(win);
+        return;
+    }
+    
+    const auto& file = selected_path();
+    std::string name = file.filename().string();
+    const FileMeta* meta = metadata.find(name);
+    if (!meta) {
+        // Cache miss: fetch the page around the cursor in one go.
+        int rows = visible_rows();
+        metadata.prefetch(list, view, selected - rows, selected + rows);
+        meta = metadata.find(name);
+    }
+
+    const ImagePreview::Thumbnail* thumbnail = nullptr;
+    std::string fileName = "Name: " + name;
+    std::string fileExt = "Extension: " + file.extension().string();
+    mvwprintw(win, 1, 1, "%s", fileName.c_str());
+    if (meta && meta->valid) {
+        std::string fileSize = "Size: " + std::to_string(meta->size);
+        if (S_ISDIR(meta->mode)) {
+            DirectorySizer::Totals totals = sizer.query(worker_pool(), file, *meta);
+            fileSize = "Size: " + format_bytes(totals.bytes) + " in " + std::to_string(totals.files) +
+                       " files, " + std::to_string(totals.dirs) + " dirs" + (totals.done ? "" : " (counting...)");
+            std::string disk = "On disk: " + format_bytes(totals.disk);
+            mvwprintw(win, 6, 1, "%s", disk.c_str());
+        } else if (S_ISREG(meta->mode)) {
+            // Logical size next to what is allocated; the two differ for sparse files.
+            fileSize += " (" + format_bytes(meta->blocks * 512) + " on disk)";
+        }
+        if (S_ISREG(meta->mode) && !hud && ImagePreview::is_image_name(name)) {
+            thumbnail = draw_preview_status(win, file, *meta);
+        }
+        std::string permissions = "Permissions: " + get_permissions(*meta);
+        std::string lastWriteTime = "Last Update Time: " + get_time(*meta);
+        mvwprintw(win, 2, 1, "%s", fileSize.c_str());
+        mvwprintw(win, 3, 1, "%s", fileExt.c_str());
+        mvwprintw(win, 4, 1, "%s", permissions.c_str());
+        mvwprintw(win, 5, 1, "%s", lastWriteTime.c_str());
+    } else {
+        mvwprintw(win, 2, 1, "%s", "Size: unavailable");
+        mvwprintw(win, 3, 1, "%s", fileExt.c_str());
+    }
+    
+    mvwaddnstr(win, yMax - 2, 1, file.c_str(), xMax - 2);
+    if (hud) draw_hud(win);
+
+    // The thumbnail goes out after ncurses has drawn the (blank) pane,
+    // and only when it changed: a repaint of the pane wipes the old one.
+    uint64_t shown = thumbnail ? thumbnail->id : 0;
+    if (drawn_preview && shown != drawn_preview) redrawwin(win);
+    wrefresh(win);
+    if (thumbnail && shown != drawn_preview) {
+        int top, left;
+        getbegyx(win, top, left);
+        std::string image = ImagePreview::render(*thumbnail, top + PREVIEW_TOP, left + 1 + (xMax - 2 - thumbnail->cols) / 2);
+        for (size_t written = 0; written < image.size(); ) {
+            ssize_t n = write(output_fd, image.data() + written, image.size() - written);
+            if (n < 0 && errno != EINTR && errno != EAGAIN) break;
+            if (n > 0) written += n;
+        }
+    }
+    drawn_preview = shown;
+}
+
+void FileManager::draw_member_info(WINDOW* win) {
+    wipe_preview(win);
+    fs::path file = selected_path();
+    std::string path = member_path(selected_index());
+    std::string fileName = "Name: " + file.filename().string();
+    std::string fileExt = "Extension: " + file.extension().string();
+    mvwprintw(win, 1, 1, "%s", fileName.c_str());
+    mvwprintw(win, 3, 1, "%s", fileExt.c_str());
+    const TarArchive::Member* member = archive->find(path);
+    if (member) {
+        FileMeta meta;
+        meta.valid = true;
+        meta.mode = member->mode;
+        meta.size = archive->resolve(*member).size;
+        meta.mtime_sec = member->mtime;
+        std::string fileSize = "Size: " + std::to_string(meta.size);
+        if (S_ISDIR(member->mode)) {
+            std::vector<uint32_t> below;
+            archive->collect(path, below);
+            uint64_t bytes = 0, files = 0;
+            for (uint32_t id : below) {
+                const TarArchive::Member& inner = archive->member(id);
+                if (S_ISDIR(inner.mode)) continue;
+                bytes += archive->resolve(inner).size;
+                files++;
+            }
+            fileSize = "Size: " + format_bytes(bytes) + " in " + std::to_string(files) + " files, " +
+                       std::to_string(below.size() - files) + " dirs";
+        }
+        std::string permissions = "Permissions: " + get_permissions(meta);
+        std::string lastWriteTime = "Last Update Time: " + get_time(meta);
+        std::string origin = "In " + archive->path().filename().string();
+        if (S_ISLNK(member->mode)) origin = "Link to: " + std::string(archive->link(*member));
+        else if (TarArchive::is_hard_link(*member)) origin = "Hard link to: " + std::string(archive->link(*member));
+        mvwprintw(win, 2, 1, "%s", fileSize.c_str());
+        mvwprintw(win, 4, 1, "%s", permissions.c_str());
+        mvwprintw(win, 5, 1, "%s", lastWriteTime.c_str());
+        mvwaddnstr(win, 6, 1, origin.c_str(), xMax - 2);
+    }
+    mvwaddnstr(win, yMax - 2, 1, file.c_str(), xMax - 2);
+    if (hud) draw_hud(win);
+    wrefresh(win);
+}
+
+const ImagePreview::Thumbnail* FileManager::draw_preview_status(WINDOW* win, const fs::path& file, const FileMeta& meta) {
+    int cols = xMax - 2, rows = yMax - 2 - PREVIEW_TOP;
+    if (ImagePreview::color_support() == ImagePreview::NO_COLORS || cols < 2 || rows < 2) {
+        mvwaddnstr(win, 6, 1, "Preview: needs a 256-colour terminal", xMax - 2);
+        return nullptr;
+    }
+    const ImagePreview::Thumbnail* thumbnail = preview.query(worker_pool(), file, meta, cols, rows);
+    std::string status = "Preview: decoding...";
+    if (thumbnail && !thumbnail->error.empty()) status = "Preview: " + thumbnail->error;
+    else if (thumbnail) status = "Image: " + std::to_string(thumbnail->image_width) + "x" + std::to_string(thumbnail->image_height);
+    mvwaddnstr(win, 6, 1, status.c_str(), xMax - 2);
+    return thumbnail && thumbnail->error.empty() ? thumbnail : nullptr;
+}
+
+std::string FileManager::format_latency(uint64_t ns) {
+    char buf[32];
+    if (ns < 1000) snprintf(buf, sizeof(buf), "%lluns", static_cast<unsigned long long>(ns));
+    else if (ns < 1000000) snprintf(buf, sizeof(buf), "%.1fus", ns / 1e3);
+    else if (ns < 1000000000) snprintf(buf, sizeof(buf), "%.1fms", ns / 1e6);
+    else snprintf(buf, sizeof(buf), "%.2fs", ns / 1e9);
+    return buf;
+}
+
+std::pair<uint64_t, uint64_t> FileManager::io_syscalls() {
+    std::ifstream io("/proc/self/io");
+    std::string key;
+    uint64_t value, reads = 0, writes = 0;
+    while (io >> key >> value) {
+        if (key == "syscr:") reads = value;
+        else if (key == "syscw:") writes = value;
+    }
+    return {reads, writes};
+}
+
+void FileManager::draw_hud(WINDOW* win) const {
+    int row = 8;
+    int last = yMax - 4;
+    char line[128];
+    wattron(win, A_BOLD);
+    snprintf(line, sizeof(line), "%-15s %8s %9s %9s", "Stage", "count", "p50", "p99");
+    mvwaddnstr(win, row++, 1, line, xMax - 2);
+    wattroff(win, A_BOLD);
+    for (int stage = 0; stage < Profiler::STAGE_COUNT && row < last; stage++) {
+        Profiler::Summary summary = Profiler::summarize(static_cast<Profiler::Stage>(stage));
+        if (summary.count == 0) continue;
+        snprintf(line, sizeof(line), "%-15s %8llu %9s %9s", Profiler::stage_name(static_cast<Profiler::Stage>(stage)),
+                 static_cast<unsigned long long>(summary.count), format_latency(summary.p50_ns).c_str(),
+                 format_latency(summary.p99_ns).c_str());
+        mvwaddnstr(win, row++, 1, line, xMax - 2);
+    }
+    std::string syscalls = "Syscalls:";
+    for (int counter = 0; counter < Profiler::COUNTER_COUNT; counter++) {
+        syscalls += std::string(" ") + Profiler::counter_name(static_cast<Profiler::Counter>(counter)) + " " +
+                    std::to_string(Profiler::total(static_cast<Profiler::Counter>(counter)));
+    }
+    auto [reads, writes] = io_syscalls();
+    syscalls += " read " + std::to_string(reads) + " write " + std::to_string(writes);
+    mvwaddnstr(win, std::min(row + 1, yMax - 3), 1, syscalls.c_str(), xMax - 2);
+}
+
+void FileManager::print_selected_path(WINDOW* win) const {
+    if (view.empty()) return;
+    std::string msg = "Selected: " + selected_path().filename().string();
+    if (list.marked_count()) msg = "Marked: " + std::to_string(list.marked_count()) + " entries";
+    mvwaddnstr(win, yMax - 2, 1, msg.c_str(), xMax - 2);
+    wrefresh(win);
+}
+
+void FileManager::handle_operation(WINDOW* optionwin) {
+    if (view.empty()) return;
+    
+    int input = 0;
+    int operation_selected = 0;
+    
+    draw_options(optionwin, operation_selected);
+    print_selected_path(optionwin);
+
+    while(true) {
+        input = KeyLog::read(optionwin);
+        
+        switch(input) {
+            case KEY_UP:
+                operation_selected--;
+                if (operation_selected < 0) operation_selected = 0;
+                break;
+            case KEY_DOWN:
+                operation_selected++;
+                if (operation_selected >= static_cast<int>(operations.size())) {
+                    operation_selected = operations.size() - 1;
+                }
+                break;
+            case 27: // ESC
+                werase(optionwin);
+                draw_options(optionwin, -1);
+                return;
+            case 10: // Enter
+                if (archive) {
+                    archive_operation(optionwin, operation_selected);
+                    return;
+                }
+                if (operation_selected == 0) { // Open
+                    open_selected(selected_path());
+                } else if (operation_selected == 1) { // Rename
+                    rename_file(optionwin, selected_path());
+                } else if (operation_selected == 2) { // Delete
+                    delete_selected(optionwin, operation_targets());
+                } else if (operation_selected == 3) { // Copy
+                    copy_selected(optionwin, operation_targets());
+                } else if (operation_selected == 4) { // Move
+                    move_selected(optionwin, operation_targets());
+                } else if (operation_selected == 5) { // Find duplicates
+                    find_duplicates(optionwin, is_directory(selected_index()) ? selected_path() : current_dir);
+                } else if (operation_selected == 6) { // Search in files
+                    search_contents(optionwin, is_directory(selected_index()) ? selected_path() : current_dir);
+                } else if (operation_selected == 7) { // Chmod
+                    chmod_selected(optionwin, operation_targets());
+                } else if (operation_selected == 8) { // Verified copy
+                    copy_selected(optionwin, operation_targets(), true);
+                }
+                return;
+            case 'q':
+                exit_flag = true;
+                return;
+            default:
+                break;
+        }
+        
+        draw_options(optionwin, operation_selected);
+        print_selected_path(optionwin);
+
+        if (exit_flag) return;
+    }
+}
+
+void run_event_loop(FileManager& fm, WINDOW* menuwin, WINDOW* optionwin, int input_fd,
+                    const std::function<void()>& on_frame) {
+    fm.set_input_descriptor(input_fd);
+    // Handles one key that is not plain cursor movement.
+    auto handle_key = [&](int input) {
+        switch(input) {
+            case 10: // Enter
+                if (fm.enter_selected(optionwin)) break;
+                [[fallthrough]];    // files get the operations menu
+            case KEY_RIGHT:
+                keypad(optionwin, TRUE);
+                fm.handle_operation(optionwin);
+                keypad(optionwin, FALSE);
+                break;
+            case KEY_LEFT:
+            case KEY_BACKSPACE:
+            case 127:
+                fm.leave_directory();
+                break;
+            case '/':
+                fm.edit_filter(menuwin, optionwin);
+                break;
+            case 27: // ESC
+                if (fm.is_scanning()) {
+                    fm.cancel_scan();
+                    fm.poll_scan();
+                } else if (fm.is_filtered()) {
+                    fm.set_filter("");
+                } else {
+                    fm.set_exit(true);
+                }
+                break;
+            case ' ':
+                fm.toggle_mark();
+                break;
+            case '+':
+                fm.prompt_marks(optionwin, true);
+                break;
+            case '-':
+                fm.prompt_marks(optionwin, false);
+                break;
+            case '*':
+                fm.invert_marks();
+                break;
+            case 'r':
+                fm.refresh_metadata();
+                break;
+            case 'n':
+                fm.set_sort(ListingSorter::NAME);
+                break;
+            case 'e':
+                fm.set_sort(ListingSorter::EXTENSION);
+                break;
+            case 's':
+                fm.set_sort(ListingSorter::SIZE);
+                break;
+            case 't':
+                fm.set_sort(ListingSorter::MTIME);
+                break;
+            case 'p':
+                fm.toggle_hud();
+                break;
+            case 'q':
+                fm.set_exit(true);
+                break;
+            default:
+                break;
+        }
+    };
+
+    // Keys that open a prompt or menu of their own; whatever was typed after
+    // them is handed back to ncurses so that prompt reads it.
+    auto is_modal = [](int input) {
+        return input == 10 || input == KEY_RIGHT || input == '/' || input == '+' || input == '-';
+    };
+
+    // The loop sleeps in poll() on the terminal, the workers' wakeup and the
+    // directory watch. Each wakeup drains every pending key first: runs of
+    // the same arrow collapse into one cursor move, and the screen is drawn
+    // at most once per frame, so holding a key never queues up redraws.
+    const auto frame_budget = std::chrono::milliseconds(16);
+    const int tick_ms = 200;          // refresh of counters that are still growing
+    const int hud_tick_ms = 500;
+    auto next_frame = std::chrono::steady_clock::now();
+    bool dirty = true;
+    std::vector<int> keys;
+    wtimeout(menuwin, 0);
+
+    while(!fm.should_exit() && !KeyLog::replay_done()) {
+        auto now = std::chrono::steady_clock::now();
+        if (dirty && now >= next_frame) {
+            ScopedTimer timer(Profiler::FRAME);
+            fm.poll_scan();
+            fm.poll_watcher();
+            fm.draw_menu(menuwin);
+            fm.draw_file_info(optionwin);
+            dirty = false;
+            next_frame = now + frame_budget;
+            if (on_frame) on_frame();
+        }
+
+        // Once a frame is owed, only keys may cut the wait short; the
+        // workers' news is picked up when the frame is drawn.
+        if (!dirty) KeyLog::ready();
+        int timeout = -1;
+        if (dirty) {
+            timeout = std::chrono::ceil<std::chrono::milliseconds>(next_frame - now).count();
+        } else if (fm.is_counting()) {
+            timeout = tick_ms;
+        } else if (fm.hud_visible()) {
+            timeout = hud_tick_ms;
+        }
+        pollfd fds[3] = {{input_fd, POLLIN, 0},
+                         {dirty ? -1 : fm.wakeup_descriptor(), POLLIN, 0},
+                         {dirty ? -1 : fm.watch_descriptor(), POLLIN, 0}};
+        int ready = poll(fds, 3, std::max(timeout, -1));
+        if (ready == 0 || fds[1].revents || fds[2].revents) dirty = true;
+        if (fds[1].revents) fm.clear_wakeup();
+
+        keys.clear();
+        for (int input; (input = KeyLog::read(menuwin, false)) != ERR; ) keys.push_back(input);
+        if (keys.empty()) continue;
+        dirty = true;
+
+        int moves = 0;
+        for (size_t k = 0; k < keys.size() && !fm.should_exit(); k++) {
+            int input = keys[k];
+            if (input == KEY_UP || input == KEY_DOWN) {
+                int step = input == KEY_DOWN ? 1 : -1;
+                if (moves != 0 && (moves > 0) != (step > 0)) {
+                    fm.update_selected(moves);
+                    moves = 0;
+                }
+                moves += step;
+                continue;
+            }
+            if (moves != 0) {
+                fm.update_selected(moves);
+                moves = 0;
+            }
+            if (is_modal(input)) {
+                for (size_t rest = keys.size(); rest-- > k + 1; ) KeyLog::unread(keys[rest]);
+                wtimeout(menuwin, -1);
+                fm.wipe_preview(optionwin);
+                handle_key(input);
+                wtimeout(menuwin, 0);
+                break;
+            }
+            ScopedTimer timer(Profiler::INPUT);
+            handle_key(input);
+        }
+        if (moves != 0) fm.update_selected(moves);
+    }
+}
@@ -0,0 +1,369 @@
+#pragma once
+
+#include "directory.h"
+#include "thread_pool.h"
+#include "file_operations.h"
+#include "directory_sizer.h"
+#include "image_preview.h"
+#include "duplicate_finder.h"
+#include "content_search.h"
+#include "listing.h"
+#include "directory_index.h"
+#include "archive.h"
+
+#include <filesystem>
+#include <ncurses.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <algorithm>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+class FileManager {
+private:
+    // What a menu row currently shows on screen, so unchanged rows are not redrawn.
+    struct MenuRow {
+        std::string text;
+        bool highlighted = false;
+    };
+
+    Wakeup wakeup;                   // background work that changes what is on screen
+    bool exit_flag = false;
+    bool hud = false;                // latency overlay in the info pane
+    int input_fd = STDIN_FILENO;     // what ncurses reads keys from
+    int output_fd = STDOUT_FILENO;   // the terminal ncurses draws on
+    int yMax, xMax;
+    int selected = 0;                // row in `view`
+    DirectoryListing list;           // entries in sort order
+    std::vector<uint32_t> view;      // indices into `list`, in display order
+    FuzzyFilter filter;
+    bool filter_editing = false;
+    ListingSorter sorter;
+    fs::path current_dir;
+    DirectoryScanner scanner;
+    MetadataCache metadata;
+    DirectoryWatcher watcher;
+    std::unique_ptr<WorkStealingPool> pool;
+    DirectorySizer sizer;
+    ImagePreview preview;
+    uint64_t drawn_preview = 0;      // thumbnail painted over the info pane, 0 for none
+    ListingCache listing_cache;
+    DirectoryIndex index;            // listings of earlier runs, when enabled
+    std::unordered_map<std::string, std::string> cursors;  // directory -> entry the cursor was on
+    std::string wanted_entry;        // entry to put the cursor on once the scanner finds it
+    uint64_t dir_dev = 0;
+    uint64_t dir_ino = 0;
+    int64_t scan_mtime = 0;          // directory mtime when the running scan started
+    int64_t listing_mtime = 0;       // directory mtime `list` is known to match
+    bool listing_complete = false;
+    bool revalidating = false;       // `list` came from the cache and is being rescanned
+    DirectoryListing fresh;          // entries of that rescan
+    std::shared_ptr<const TarArchive> archive;   // set while browsing inside a tar archive
+    std::string archive_dir;         // directory shown inside it, "" for the top
+    std::deque<std::shared_ptr<const TarArchive>> archives;   // recently read, most recent first
+    const std::vector<std::string> operations = {"1. Open", "2. Rename", "3. Delete", "4. Copy", "5. Move",
+                                                  "6. Find duplicates", "7. Search in files", "8. Chmod",
+                                                  "9. Verified copy"};
+
+    // Viewport state of the file menu. `list_version` is bumped on every change
+    // to `list`, so draw_menu only re-formats rows when the listing moved.
+    int menu_top = 0;
+    int drawn_top = -1;
+    size_t list_version = 0;
+    size_t drawn_version = 0;
+    bool menu_full_redraw = true;
+    std::vector<MenuRow> menu_rows;
+    std::string drawn_title;
+
+    int64_t directory_mtime() const;
+
+    // Shows `list`, just taken from a cache where it was stored at directory
+    // mtime `mtime`, and rescans the directory in the background if it has
+    // changed since.
+    void show_stored_listing(int64_t mtime);
+
+    // Shows `dir`, straight from the cache when it was visited before, or
+    // from the on-disk index when it was visited in an earlier run. A stored
+    // listing whose directory changed since is shown as it was and
+    // rescanned in the background.
+    void load_directory(const fs::path& dir, bool use_cache);
+
+    // Reads the current directory again from scratch.
+    void update_file_list();
+
+    // Keeps the cursor position and, once it is complete, the listing of
+    // the directory being left.
+    void remember_directory();
+    void change_directory(const fs::path& dir, const std::string& focus);
+
+    static constexpr size_t ARCHIVE_CACHE = 4;               // archive indexes kept for coming back
+    static constexpr uint64_t VIEW_LIMIT = 256 * 1024 * 1024; // of a compressed member shown in the pager
+
+    // Path inside the archive of list[index].
+    std::string member_path(size_t index) const;
+
+    // Shows directory `dir` of the open archive, with the cursor on `focus`
+    // or where it was last time. Member headers carry everything the sorter
+    // and the info pane need, so nothing is stat'ed.
+    void show_archive_directory(const std::string& dir, const std::string& focus);
+
+    // Shows the archive `file` in place of the directory, reading its index
+    // first unless a recent one is still current. Reading runs on its own
+    // thread under the progress view and can be cancelled with ESC.
+    void enter_archive(WINDOW* win, const fs::path& file);
+
+    // Back from an archive to the directory holding it, with the cursor on it.
+    void leave_archive();
+
+    // Directories, and symlinks or entries of unknown type that resolve to one.
+    bool is_directory(size_t index) const;
+
+    // Folds a completed rescan of a stale cached listing into `list`:
+    // entries that are gone are dropped and new ones merged into place.
+    bool poll_revalidation();
+    static constexpr size_t NO_ENTRY = static_cast<size_t>(-1);
+
+    size_t selected_index() const { return view.empty() ? NO_ENTRY : view[selected]; }
+
+    fs::path selected_path() const { return list.path(view[selected]); }
+
+    // What Delete, Copy, Move and Chmod act on: the marked entries, or the
+    // selected one when nothing is marked.
+    std::vector<fs::path> operation_targets() const;
+    static std::string describe_targets(const std::vector<fs::path>& targets);
+
+    // Puts the cursor on list[index] if it is shown, otherwise keeps the row in range.
+    void select_entry(size_t index);
+
+    // Brings `view` up to date after `list` changed. Appends only extend the
+    // view; anything else (`structural`) rebuilds it, with the cursor moved to
+    // list[keep] when given, or left on the same entry for appends.
+    void list_changed(bool structural, size_t keep = NO_ENTRY);
+
+    // Sorts entries appended to `list` into place and rebuilds the view with
+    // the cursor on the entry that was at list[keep].
+    void sort_list(size_t keep);
+
+    // Removes the entries whose `alive` flag is clear, keeping the sort keys
+    // in step. Returns the new position of list[index].
+    size_t retain(const std::vector<char>& alive, size_t index);
+
+    // Folds a batch of watcher events into `list` in one pass, keeping the
+    // cursor on the entry it was on.
+    void apply_changes(DirectoryWatcher::Batch& batch);
+
+    int visible_rows() const { return std::max(1, yMax - 3); }
+
+    WorkStealingPool& worker_pool();
+    void draw_menu_row(WINDOW* win, int row, const MenuRow& content) const;
+    std::string menu_title() const;
+
+public:
+    // `index_file`, if given, keeps listings between runs.
+    explicit FileManager(const std::string& index_file = std::string());
+
+    // Stores the complete listings of this run in the index, if there is one.
+    void save_index();
+
+    bool should_exit() const { return exit_flag; }
+
+    bool is_scanning() const { return scanner.is_running(); }
+
+    size_t entry_count() const { return list.size(); }
+
+    void set_input_descriptor(int fd) { input_fd = fd; }
+
+    // Image previews are written here directly, after ncurses' own output.
+    void set_output_descriptor(int fd) { output_fd = fd; }
+
+    // The main loop sleeps in poll() on these besides the terminal.
+    int wakeup_descriptor() const { return wakeup.descriptor(); }
+
+    int watch_descriptor() const { return watcher.descriptor(); }
+
+    void clear_wakeup() { wakeup.clear(); }
+
+    // Makes the next refresh of `win` repaint it in full, wiping a painted
+    // thumbnail before something else is drawn there. It is painted again
+    // with the next info pane.
+    void wipe_preview(WINDOW* win);
+
+    // True while the info pane shows a total that is still growing and
+    // should be redrawn periodically.
+    bool is_counting() const { return sizer.is_counting(); }
+
+    void toggle_hud() { hud = !hud; }
+
+    bool hud_visible() const { return hud; }
+
+    // Stops the running scan. A stale cached listing being revalidated is
+    // kept as it is.
+    void cancel_scan();
+
+    // Pulls in entries the scanner found since the last call.
+    // Returns true when the list changed and the menu needs a redraw.
+    bool poll_scan();
+
+    // Enters the selected entry if it is a directory, or a tar archive as if
+    // it were one, reporting progress and errors in `win`. Returns false for
+    // anything else, which gets the operations menu instead.
+    bool enter_selected(WINDOW* win);
+
+    // Goes to the parent directory with the cursor on the one just left.
+    // At the top of an archive that is the directory holding it.
+    void leave_directory();
+
+    // Applies changes other processes made to the directory. Events that
+    // arrive while a scan is still running are held until it finishes;
+    // inside an archive they are dropped, and the directory is checked
+    // against its mtime once it is shown again.
+    bool poll_watcher();
+
+    // Drops cached metadata so the info pane re-reads it from disk.
+    void refresh_metadata();
+
+    // Re-sorts the listing; selecting the current mode again reverses it.
+    void set_sort(ListingSorter::Mode mode);
+
+    bool is_filtered() const { return filter.active(); }
+
+    // Narrows the menu to entries matching `text`, best match first.
+    // An empty text shows the whole listing again.
+    void set_filter(const std::string& text);
+
+    // Filter mode: typed characters narrow the list as they are entered.
+    // Enter keeps the filter and returns to normal navigation, ESC drops it.
+    void edit_filter(WINDOW* menuwin, WINDOW* infowin);
+
+    // Flips the mark on the selected entry and moves down, like Insert in mc.
+    void toggle_mark();
+
+    // Marks (or unmarks) the shown entries whose name matches a shell glob.
+    void mark_matching(const std::string& pattern, bool mark);
+    void invert_marks();
+
+    // Asks for a glob in the options pane and marks or unmarks what matches.
+    void prompt_marks(WINDOW* win, bool mark);
+
+    // Forces the next draw_menu to repaint the whole window.
+    void invalidate_menu() { menu_full_redraw = true; }
+
+    void set_exit(bool flag) { exit_flag = flag; }
+
+    void set_window_size(int y, int x);
+
+    // Only the rows inside the viewport are formatted, and only rows whose text
+    // or highlight changed since the last call are written to the window.
+    void draw_menu(WINDOW* win);
+    void draw_options(WINDOW* win, int operation_selected) const;
+    void update_selected(int change);
+
+    // Reads a line of text in the options pane, starting from `initial`.
+    // Returns an empty string if the user pressed ESC.
+    std::string prompt_input(WINDOW* win, const std::string& title, const std::string& initial = "");
+    void rename_file(WINDOW* win, const fs::path& file);
+    static std::string format_bytes(uint64_t bytes);
+    static std::string format_duration(double seconds);
+    void draw_progress(WINDOW* win, const std::string& title, OperationProgress& progress) const;
+
+    // Redraws the progress of a running operation until it finishes.
+    // ESC asks the workers to stop; they check between chunks.
+    void show_progress(WINDOW* win, const std::string& title, OperationProgress& progress, bool wait_key = true);
+
+    // Resolves what the user typed in a destination prompt against the current directory.
+    fs::path destination_path(const std::string& destination) const;
+
+    // Lists every entry an operation failed on, after its progress view.
+    void show_failures(const std::string& title, OperationProgress& progress);
+
+    // Shows an operation's progress and then its failures. Marks are spent
+    // once an operation over them has run.
+    void finish_operation(WINDOW* win, const std::string& title, OperationProgress& progress);
+
+    // A verified copy checksums every file on the way and reads it back,
+    // then offers to save the digests.
+    void copy_selected(WINDOW* win, const std::vector<fs::path>& files, bool verify = false);
+
+    // Writes digests in the format of sha256sum, so `sha256sum -c FILE`
+    // checks the copies again later.
+    void export_digests(WINDOW* win, const std::vector<CopyEngine::FileDigest>& digests);
+
+    // Shows the selected archive member in the pager. In a plain tar its
+    // bytes are mapped where they lie; a compressed member is inflated into
+    // memory first, at most VIEW_LIMIT bytes of it.
+    void view_member();
+
+    // Copy inside an archive: extracts the marked members, or the selected one.
+    void extract_selected(WINDOW* win);
+
+    // Only Open and Copy work on archive members; the rest say so.
+    void archive_operation(WINDOW* win, int operation);
+
+    // Shows a regular file in the full-screen pager.
+    void open_selected(const fs::path& file);
+
+    // Replaces every file of `set` but the kept one with a hard link to it,
+    // each only after it compared equal to the kept file.
+    static std::string link_duplicates(const DuplicateFinder::Group& set, size_t keep);
+
+    // Why `path` may not be replaced by or removed in favour of `kept`, or ""
+    // when the two are still identical.
+    static std::string recheck_duplicate(const std::string& path, const std::string& kept, uint64_t size);
+
+    // Asks a yes/no question on the bottom row of `win`.
+    static bool confirm(WINDOW* win, const std::string& question);
+
+    // Full-screen list of duplicate sets, biggest savings first. d deletes
+    // the file under the cursor, l keeps it and hard-links the rest of its
+    // set to it. Both compare the files again byte for byte first and leave
+    // alone any that no longer match.
+    void browse_duplicates(std::vector<DuplicateFinder::Group>& groups, const std::string& summary);
+
+    // Hashes the tree under `root` and opens the duplicates it found.
+    void find_duplicates(WINDOW* win, const fs::path& root);
+
+    // Full-screen list of search matches, filled in while the search runs.
+    // Enter opens the file in the pager at the matching line.
+    void browse_matches(ContentSearch& search);
+
+    // Asks for a pattern and searches the files under `root` for it.
+    void search_contents(WINDOW* win, const fs::path& root);
+
+    // Counts what would be removed, asks for confirmation, then deletes.
+    void delete_selected(WINDOW* win, const std::vector<fs::path>& files);
+    void move_selected(WINDOW* win, const std::vector<fs::path>& files);
+    void chmod_selected(WINDOW* win, const std::vector<fs::path>& files);
+    static std::string get_time(const FileMeta& meta);
+    static std::string get_permissions(const FileMeta& meta);
+    void draw_file_info(WINDOW* win);
+
+    // The info pane for an entry inside an archive, all from its header.
+    void draw_member_info(WINDOW* win);
+
+    // Rows of the info pane given to image previews.
+    static constexpr int PREVIEW_TOP = 8;
+
+    // Writes the preview state of an image file on row 6 and returns its
+    // thumbnail once one is ready to draw.
+    const ImagePreview::Thumbnail* draw_preview_status(WINDOW* win, const fs::path& file, const FileMeta& meta);
+    static std::string format_latency(uint64_t ns);
+
+    // Read and write syscalls of the whole process, from /proc/self/io.
+    static std::pair<uint64_t, uint64_t> io_syscalls();
+
+    // p50/p99 of every stage that has samples, plus syscall counts, in the
+    // lower part of the info pane.
+    void draw_hud(WINDOW* win) const;
+    void print_selected_path(WINDOW* win) const;
+    void handle_operation(WINDOW* optionwin);
+};
+
+// Runs the UI until the user quits. `input_fd` is the descriptor ncurses
+// reads keys from; `on_frame`, if set, is called after every frame is drawn.
+void run_event_loop(FileManager& fm, WINDOW* menuwin, WINDOW* optionwin, int input_fd,
+                    const std::function<void()>& on_frame = nullptr);
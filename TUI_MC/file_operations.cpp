@@ -0,0 +1,676 @@
+#include "file_operations.h"
+#include "profiler.h"
+#include "directory.h"
+#include "io_ring.h"
+
+#include <cstdlib>
+#include <cerrno>
+#include <memory>
+#include <algorithm>
+#include <cstring>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
+#include <linux/io_uring.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+std::string CopyEngine::describe(const fs::path& path, int err) {
+    return path.string() + ": " + std::strerror(err);
+}
+
+bool CopyEngine::copy_with_reflink(int in, int out) {
+    return ioctl(out, FICLONE, in) == 0;
+}
+
+int CopyEngine::copy_with_copy_file_range(int in, int out, uint64_t size, OperationProgress& progress) {
+    uint64_t copied = 0;
+    while (copied < size) {
+        if (progress.cancelled) return ECANCELED;
+        ssize_t n = copy_file_range(in, nullptr, out, nullptr, std::min<uint64_t>(CHUNK_SIZE, size - copied), 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return copied == 0 || !fallback_errno(errno) ? errno : EIO;
+        }
+        if (n == 0) return EIO;     // the source shrank under us
+        copied += n;
+        progress.bytes_done += n;
+    }
+    return 0;
+}
+
+int CopyEngine::copy_with_sendfile(int in, int out, uint64_t size, OperationProgress& progress) {
+    uint64_t copied = 0;
+    while (copied < size) {
+        if (progress.cancelled) return ECANCELED;
+        ssize_t n = sendfile(out, in, nullptr, std::min<uint64_t>(CHUNK_SIZE, size - copied));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return copied == 0 || !fallback_errno(errno) ? errno : EIO;
+        }
+        if (n == 0) return EIO;     // the source shrank under us
+        copied += n;
+        progress.bytes_done += n;
+    }
+    return 0;
+}
+
+char* CopyEngine::thread_buffer() {
+    static thread_local std::unique_ptr<char, decltype(&free)> buffer(nullptr, &free);
+    if (!buffer) {
+        void* memory = nullptr;
+        if (posix_memalign(&memory, BUFFER_ALIGN, BUFFER_SIZE) != 0) return nullptr;
+        buffer.reset(static_cast<char*>(memory));
+    }
+    return buffer.get();
+}
+
+int CopyEngine::copy_with_buffer(int in, int out, OperationProgress& progress) {
+    char* buffer = thread_buffer();
+    if (!buffer) return ENOMEM;
+    posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+    while (true) {
+        if (progress.cancelled) return ECANCELED;
+        ssize_t n = read(in, buffer, BUFFER_SIZE);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return errno;
+        }
+        if (n == 0) return 0;
+        for (ssize_t written = 0; written < n; ) {
+            ssize_t w = write(out, buffer + written, n - written);
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                return errno;
+            }
+            written += w;
+        }
+        progress.bytes_done += n;
+    }
+}
+
+int CopyEngine::copy_extent(int in, int out, uint64_t offset, uint64_t length, bool& in_kernel,
+                            OperationProgress& progress) {
+    uint64_t end = offset + length;
+    while (offset < end) {
+        if (progress.cancelled) return ECANCELED;
+        size_t chunk = std::min<uint64_t>(end - offset, in_kernel ? CHUNK_SIZE : BUFFER_SIZE);
+        ssize_t n;
+        if (in_kernel) {
+            loff_t from = offset, to = offset;
+            n = copy_file_range(in, &from, out, &to, chunk, 0);
+            if (n < 0 && fallback_errno(errno)) {
+                in_kernel = false;
+                continue;
+            }
+        } else {
+            char* buffer = thread_buffer();
+            if (!buffer) return ENOMEM;
+            n = pread(in, buffer, chunk, offset);
+            for (ssize_t written = 0; n > 0 && written < n; ) {
+                ssize_t w = pwrite(out, buffer + written, n - written, offset + written);
+                if (w < 0 && errno != EINTR) return errno;
+                if (w > 0) written += w;
+            }
+        }
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return errno;
+        }
+        if (n == 0) return EIO;     // the source shrank under us
+        offset += n;
+        progress.bytes_done += n;
+    }
+    return 0;
+}
+
+int CopyEngine::copy_sparse(int in, int out, uint64_t size, OperationProgress& progress) {
+    bool in_kernel = true;
+    uint64_t position = 0;
+    while (position < size) {
+        off_t data = lseek(in, position, SEEK_DATA);
+        if (data < 0 && errno != ENXIO) return position == 0 ? errno : EIO;
+        uint64_t start = data < 0 ? size : std::min<uint64_t>(data, size);   // ENXIO: only a hole is left
+        off_t hole = start < size ? lseek(in, start, SEEK_HOLE) : off_t(size);
+        if (hole < 0) return EIO;
+        uint64_t end = std::min<uint64_t>(hole, size);
+        progress.bytes_done += start - position;
+        int err = copy_extent(in, out, start, end - start, in_kernel, progress);
+        if (err) return fallback_errno(err) ? EIO : err;
+        position = end;
+    }
+    return ftruncate(out, size) == 0 ? 0 : errno;
+}
+
+bool CopyEngine::is_sparse(const struct stat& st) {
+    return S_ISREG(st.st_mode) && uint64_t(st.st_blocks) * 512 < uint64_t(st.st_size);
+}
+
+bool CopyEngine::fallback_errno(int err) {
+    return err == EXDEV || err == EINVAL || err == ENOSYS || err == EOPNOTSUPP ||
+           err == ENOTSUP || err == EBADF;
+}
+
+bool CopyEngine::open_job(const Job& job, OperationProgress& progress, int& in, int& out, struct stat& st) {
+    in = open(job.source.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) {
+        progress.fail(describe(job.source, errno));
+        return false;
+    }
+    if (fstat(in, &st) != 0) {
+        progress.fail(describe(job.source, errno));
+        close(in);
+        return false;
+    }
+    out = open(job.target.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, st.st_mode & 07777);
+    if (out < 0) {
+        progress.fail(describe(job.target, errno));
+        close(in);
+        return false;
+    }
+    return true;
+}
+
+bool CopyEngine::copy_file(const Job& job, OperationProgress& progress) {
+    ScopedTimer timer(Profiler::COPY_FILE);
+    if (progress.cancelled) return false;
+    int in, out;
+    struct stat st;
+    if (!open_job(job, progress, in, out, st)) return false;
+
+    // The fast paths only report a fallback errno before copying anything,
+    // so the next strategy always starts at offset 0.
+    uint64_t size = st.st_size;
+    int err = 0;
+    if (copy_with_reflink(in, out)) {
+        progress.bytes_done += size;
+    } else {
+        err = is_sparse(st) ? copy_sparse(in, out, size, progress) : EINVAL;
+        if (fallback_errno(err)) err = copy_with_copy_file_range(in, out, size, progress);
+        if (fallback_errno(err)) err = copy_with_sendfile(in, out, size, progress);
+        if (fallback_errno(err)) err = copy_with_buffer(in, out, progress);
+    }
+    close(in);
+    if (close(out) != 0 && err == 0) err = errno;
+
+    if (err != 0) {
+        unlink(job.target.c_str());
+        if (err != ECANCELED) progress.fail(describe(job.target, err));
+        return false;
+    }
+    progress.files_done++;
+    return true;
+}
+
+int CopyEngine::read_back(const fs::path& path, uint64_t size, Sha256& digest, OperationProgress& progress) {
+    ChecksumPipeline pipeline(ChecksumPipeline::thread_ring());
+    int in = open(path.c_str(), O_RDONLY | O_CLOEXEC | O_DIRECT);
+    int err = in < 0 ? errno : pipeline.run(in, -1, size, digest, progress);
+    if (in >= 0) close(in);
+    if (err != EINVAL) return err;
+
+    digest.reset();
+    in = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) return errno;
+    posix_fadvise(in, 0, 0, POSIX_FADV_DONTNEED);
+    posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+    err = pipeline.run(in, -1, size, digest, progress);
+    close(in);
+    return err;
+}
+
+bool CopyEngine::copy_verified(const Job& job) {
+    ScopedTimer timer(Profiler::COPY_FILE);
+    if (progress.cancelled) return false;
+    uint8_t* ring = ChecksumPipeline::thread_ring();
+    if (!ring) {
+        progress.fail(describe(job.source, ENOMEM));
+        return false;
+    }
+    int in, out;
+    struct stat st;
+    if (!open_job(job, progress, in, out, st)) return false;
+    posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    Sha256 source;
+    int err = ChecksumPipeline(ring).run(in, out, st.st_size, source, progress, is_sparse(st));
+    close(in);
+    if (!err && fdatasync(out) != 0) err = errno;
+    if (close(out) != 0 && !err) err = errno;
+    Sha256::Digest expected = source.finish();
+    Sha256 copy;
+    if (!err) err = read_back(job.target, st.st_size, copy, progress);
+    if (err) {
+        unlink(job.target.c_str());
+        if (err != ECANCELED) progress.fail(describe(job.target, err));
+        return false;
+    }
+    if (copy.finish() != expected) {
+        unlink(job.target.c_str());
+        progress.fail(job.target.string() + ": copy does not match the source");
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(digest_mtx);
+        digests.push_back({job.target, expected});
+    }
+    progress.files_done++;
+    return true;
+}
+
+void CopyEngine::plan(const fs::path& source, const fs::path& target, std::vector<Job>& jobs) {
+    std::error_code ec;
+    auto status = fs::symlink_status(source, ec);
+    if (ec) {
+        progress.fail(source.string() + ": " + ec.message());
+        return;
+    }
+    if (fs::is_symlink(status)) {
+        fs::copy_symlink(source, target, ec);
+        if (ec) {
+            progress.fail(target.string() + ": " + ec.message());
+        } else if (on_copied) {
+            on_copied(source);
+        }
+        return;
+    }
+    if (fs::is_regular_file(status)) {
+        uint64_t size = fs::file_size(source, ec);
+        jobs.push_back({source, target, size});
+        progress.files_total++;
+        progress.bytes_total += verify ? 2 * size : size;   // a verified copy reads it back
+        return;
+    }
+    if (!fs::is_directory(status)) return;
+
+    if (!fs::create_directory(target, source, ec)) {
+        progress.fail(target.string() + ": " + (ec ? ec.message() : std::strerror(EEXIST)));
+        return;
+    }
+    directories.push_back(source);
+    for (fs::directory_iterator it(source, ec), end; !ec && it != end; it.increment(ec)) {
+        if (progress.cancelled) return;
+        plan(it->path(), target / it->path().filename(), jobs);
+    }
+    if (ec) progress.fail(source.string() + ": " + ec.message());
+}
+
+bool CopyEngine::inside(const fs::path& path, const fs::path& dir) {
+    auto mismatch = std::mismatch(dir.begin(), dir.end(), path.begin(), path.end());
+    return mismatch.first == dir.end();
+}
+
+void CopyEngine::run(std::vector<fs::path> sources, fs::path destination) {
+    ScopedTimer timer(Profiler::COPY);
+    copy_tree(sources, destination);
+    progress.finish();
+}
+
+CopyEngine::~CopyEngine() {
+    if (coordinator.joinable()) cancel();
+    wait();
+}
+
+void CopyEngine::start(std::vector<fs::path> sources, fs::path destination) {
+    coordinator = std::thread(&CopyEngine::run, this, std::move(sources), std::move(destination));
+}
+
+void CopyEngine::copy_tree(const std::vector<fs::path>& sources, const fs::path& destination) {
+    std::error_code ec;
+    bool into_directory = fs::is_directory(destination, ec);
+    std::vector<Job> jobs;
+    for (const auto& source : sources) {
+        fs::path target = into_directory ? destination / source.filename() : destination;
+        // Like a single file, a directory is never merged into an existing one.
+        if (fs::exists(fs::symlink_status(target, ec))) {
+            progress.fail(target.string() + ": " + std::strerror(EEXIST));
+            continue;
+        }
+        if (inside(fs::weakly_canonical(target, ec), fs::weakly_canonical(source, ec))) {
+            progress.fail(target.string() + ": cannot copy a directory into itself");
+            continue;
+        }
+        plan(source, target, jobs);
+    }
+    progress.planning = false;
+
+    // Large files first, so a big file does not start last and stretch the tail.
+    std::sort(jobs.begin(), jobs.end(), [](const Job& a, const Job& b) { return a.size > b.size; });
+    for (const auto& job : jobs) {
+        pool.submit(group, [this, job] {
+            bool copied = verify ? copy_verified(job) : copy_file(job, progress);
+            if (copied && on_copied) on_copied(job.source);
+        });
+    }
+    group.wait();
+}
+
+void CopyEngine::wait() {
+    if (coordinator.joinable()) coordinator.join();
+}
+
+void MoveEngine::sync_and_unlink(int dest_fd) {
+    while (true) {
+        std::vector<fs::path> batch;
+        bool done;
+        {
+            std::unique_lock<std::mutex> lock(copied_mtx);
+            copied_cv.wait_for(lock, SYNC_INTERVAL, [this] { return copy_done || copied.size() >= SYNC_BATCH; });
+            batch.swap(copied);
+            done = copy_done;
+        }
+        if (!batch.empty()) {
+            if (syncfs(dest_fd) != 0) {
+                progress.fail(std::string("syncfs: ") + std::strerror(errno) + ", sources kept");
+            } else {
+                for (const auto& source : batch) {
+                    if (unlink(source.c_str()) != 0) progress.fail(source.string() + ": " + std::strerror(errno));
+                }
+            }
+        }
+        if (done && batch.empty()) return;
+    }
+}
+
+void MoveEngine::move_across_devices(const std::vector<fs::path>& sources, const fs::path& destination) {
+    std::error_code ec;
+    fs::path sync_dir = fs::is_directory(destination, ec) ? destination : destination.parent_path();
+    int dest_fd = open(sync_dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dest_fd < 0) {
+        progress.fail(sync_dir.string() + ": " + std::strerror(errno));
+        return;
+    }
+
+    CopyEngine copier(pool, progress);
+    copier.set_on_copied([this](const fs::path& source) {
+        std::lock_guard<std::mutex> lock(copied_mtx);
+        copied.push_back(source);
+        if (copied.size() >= SYNC_BATCH) copied_cv.notify_one();
+    });
+    copy_done = false;
+    std::thread syncer(&MoveEngine::sync_and_unlink, this, dest_fd);
+    copier.copy_tree(sources, destination);
+    {
+        std::lock_guard<std::mutex> lock(copied_mtx);
+        copy_done = true;
+    }
+    copied_cv.notify_one();
+    syncer.join();
+    close(dest_fd);
+
+    // Directories go last, deepest first; any that still hold a failed or
+    // skipped entry stay behind.
+    const auto& directories = copier.source_directories();
+    for (auto it = directories.rbegin(); it != directories.rend(); ++it) {
+        rmdir(it->c_str());
+    }
+}
+
+void MoveEngine::run(std::vector<fs::path> sources, fs::path destination) {
+    ScopedTimer timer(Profiler::MOVE);
+    std::error_code ec;
+    bool into_directory = fs::is_directory(destination, ec);
+    std::vector<fs::path> targets;
+    targets.reserve(sources.size());
+    for (const auto& source : sources) {
+        targets.push_back(into_directory ? destination / source.filename() : destination);
+    }
+
+    std::vector<fs::path> cross_device;
+    IoRing ring;
+    ring.run(sources.size(), IORING_OP_RENAMEAT, progress.cancelled,
+        [&](io_uring_sqe* sqe, size_t i) {
+            sqe->fd = AT_FDCWD;
+            sqe->addr = reinterpret_cast<uintptr_t>(sources[i].c_str());
+            sqe->len = AT_FDCWD;
+            sqe->addr2 = reinterpret_cast<uintptr_t>(targets[i].c_str());
+            sqe->rename_flags = RENAME_NOREPLACE;
+        },
+        [&](size_t i) {
+            return renameat2(AT_FDCWD, sources[i].c_str(), AT_FDCWD, targets[i].c_str(), RENAME_NOREPLACE) == 0 ? 0 : -errno;
+        },
+        [&](size_t i, int result) {
+            if (result == 0) {
+                progress.files_total++;
+                progress.files_done++;
+            } else if (result == -EXDEV) {
+                cross_device.push_back(sources[i]);
+            } else {
+                progress.fail(targets[i].string() + ": " + std::strerror(-result));
+            }
+        });
+    if (!cross_device.empty() && !progress.cancelled) {
+        move_across_devices(cross_device, destination);
+    }
+    progress.planning = false;
+    progress.finish();
+}
+
+MoveEngine::~MoveEngine() {
+    if (coordinator.joinable()) progress.cancelled = true;
+    wait();
+}
+
+void MoveEngine::start(std::vector<fs::path> sources, fs::path destination) {
+    coordinator = std::thread(&MoveEngine::run, this, std::move(sources), std::move(destination));
+}
+
+void MoveEngine::wait() {
+    if (coordinator.joinable()) coordinator.join();
+}
+
+void DeleteEngine::count_removed() {
+    if (dry_run) {
+        progress.files_total++;
+    } else {
+        progress.files_done++;
+    }
+}
+
+void DeleteEngine::finish(DirNode* node) {
+    while (node && --node->pending == 0) {
+        if (node->fd >= 0) close(node->fd);
+        if (dry_run) {
+            count_removed();
+        } else if (!progress.cancelled) {
+            if (unlinkat(node->parent_fd(), node->name.c_str(), AT_REMOVEDIR) == 0) {
+                count_removed();
+            } else {
+                progress.fail(node->path + ": " + std::strerror(errno));
+            }
+        }
+        DirNode* parent = node->parent;
+        delete node;
+        node = parent;
+    }
+}
+
+void DeleteEngine::scan(DirNode* node) {
+    int fd = progress.cancelled
+        ? -1 : openat(node->parent_fd(), node->name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        if (!progress.cancelled) progress.fail(node->path + ": " + std::strerror(errno));
+        finish(node);
+        return;
+    }
+    node->fd = fd;   // before any subdirectory task can open relative to it
+    int err = DirectoryReader::read(fd, [&] { return progress.cancelled.load(); },
+        [&](const char* name, unsigned char type) {
+            bool is_dir = type == DT_DIR;
+            if (type == DT_UNKNOWN) {
+                struct stat st;
+                Profiler::count(Profiler::STAT);
+                is_dir = fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+            }
+            if (is_dir) {
+                DirNode* child = new DirNode{node->path + "/" + name, name, node};
+                node->pending++;
+                pool.submit(group, [this, child] { scan(child); });
+            } else if (dry_run) {
+                count_removed();
+            } else if (unlinkat(fd, name, 0) == 0) {
+                count_removed();
+            } else {
+                progress.fail(node->path + "/" + name + ": " + std::strerror(errno));
+            }
+        });
+    if (err) progress.fail(node->path + ": " + std::strerror(err));
+    finish(node);
+}
+
+void DeleteEngine::run(std::vector<fs::path> roots) {
+    ScopedTimer timer(Profiler::DELETE);
+    IoRing ring;
+    std::vector<struct statx> stats(roots.size());
+    std::vector<fs::path> files;
+    ring.run(roots.size(), IORING_OP_STATX, progress.cancelled,
+        [&](io_uring_sqe* sqe, size_t i) {
+            sqe->fd = AT_FDCWD;
+            sqe->addr = reinterpret_cast<uintptr_t>(roots[i].c_str());
+            sqe->len = STATX_TYPE;
+            sqe->off = reinterpret_cast<uintptr_t>(&stats[i]);
+            sqe->statx_flags = AT_SYMLINK_NOFOLLOW;
+        },
+        [&](size_t i) {
+            return statx(AT_FDCWD, roots[i].c_str(), AT_SYMLINK_NOFOLLOW, STATX_TYPE, &stats[i]) == 0 ? 0 : -errno;
+        },
+        [&](size_t i, int result) {
+            if (result != 0) {
+                progress.fail(roots[i].string() + ": " + std::strerror(-result));
+            } else if (!S_ISDIR(stats[i].stx_mode)) {
+                files.push_back(roots[i]);
+            } else {
+                DirNode* node = new DirNode{roots[i].string(), roots[i].string(), nullptr};
+                pool.submit(group, [this, node] { scan(node); });
+            }
+        });
+
+    if (dry_run) {
+        for (size_t i = 0; i < files.size(); i++) count_removed();
+    } else {
+        ring.run(files.size(), IORING_OP_UNLINKAT, progress.cancelled,
+            [&](io_uring_sqe* sqe, size_t i) {
+                sqe->fd = AT_FDCWD;
+                sqe->addr = reinterpret_cast<uintptr_t>(files[i].c_str());
+            },
+            [&](size_t i) { return unlinkat(AT_FDCWD, files[i].c_str(), 0) == 0 ? 0 : -errno; },
+            [&](size_t i, int result) {
+                if (result == 0) {
+                    count_removed();
+                } else {
+                    progress.fail(files[i].string() + ": " + std::strerror(-result));
+                }
+            });
+    }
+    group.wait();
+    progress.planning = false;
+    progress.finish();
+}
+
+DeleteEngine::DeleteEngine(WorkStealingPool& pool, OperationProgress& progress, bool dry_run)
+    : pool(pool), progress(progress), dry_run(dry_run) {}
+
+DeleteEngine::~DeleteEngine() {
+    if (coordinator.joinable()) progress.cancelled = true;
+    wait();
+}
+
+void DeleteEngine::start(std::vector<fs::path> roots) {
+    coordinator = std::thread(&DeleteEngine::run, this, std::move(roots));
+}
+
+void DeleteEngine::wait() {
+    if (coordinator.joinable()) coordinator.join();
+}
+
+void ChmodEngine::run(std::vector<fs::path> paths) {
+    ScopedTimer timer(Profiler::CHMOD);
+    IoRing ring;
+    std::vector<struct statx> stats(paths.size());
+    progress.files_total = paths.size();
+    progress.planning = false;
+    ring.run(paths.size(), IORING_OP_STATX, progress.cancelled,
+        [&](io_uring_sqe* sqe, size_t i) {
+            sqe->fd = AT_FDCWD;
+            sqe->addr = reinterpret_cast<uintptr_t>(paths[i].c_str());
+            sqe->len = STATX_MODE;
+            sqe->off = reinterpret_cast<uintptr_t>(&stats[i]);
+        },
+        [&](size_t i) {
+            return statx(AT_FDCWD, paths[i].c_str(), 0, STATX_MODE, &stats[i]) == 0 ? 0 : -errno;
+        },
+        [&](size_t i, int result) {
+            if (result == 0 && fchmodat(AT_FDCWD, paths[i].c_str(), apply(stats[i].stx_mode & 07777), 0) != 0) {
+                result = -errno;
+            }
+            if (result == 0) {
+                progress.files_done++;
+            } else {
+                progress.fail(paths[i].string() + ": " + std::strerror(-result));
+            }
+        });
+    progress.finish();
+}
+
+ChmodEngine::~ChmodEngine() {
+    if (coordinator.joinable()) progress.cancelled = true;
+    wait();
+}
+
+bool ChmodEngine::set_mode(const std::string& spec) {
+    clauses.clear();
+    if (spec.empty()) return false;
+    if (spec.find_first_not_of("01234567") == std::string::npos) {
+        if (spec.size() > 4) return false;
+        clauses.push_back({07777, '=', static_cast<mode_t>(std::stoul(spec, nullptr, 8))});
+        return true;
+    }
+    size_t pos = 0;
+    while (pos <= spec.size()) {
+        mode_t who = 0;
+        for (; pos < spec.size() && strchr("ugoa", spec[pos]); pos++) {
+            switch (spec[pos]) {
+                case 'u': who |= S_ISUID | S_IRWXU; break;
+                case 'g': who |= S_ISGID | S_IRWXG; break;
+                case 'o': who |= S_IRWXO; break;
+                default: who |= 07777; break;
+            }
+        }
+        if (who == 0) who = 07777;
+        if (pos >= spec.size() || !strchr("+-=", spec[pos])) return false;
+        char op = spec[pos++];
+        mode_t bits = 0;
+        for (; pos < spec.size() && strchr("rwxst", spec[pos]); pos++) {
+            switch (spec[pos]) {
+                case 'r': bits |= S_IRUSR | S_IRGRP | S_IROTH; break;
+                case 'w': bits |= S_IWUSR | S_IWGRP | S_IWOTH; break;
+                case 'x': bits |= S_IXUSR | S_IXGRP | S_IXOTH; break;
+                case 's': bits |= S_ISUID | S_ISGID; break;
+                default: bits |= S_ISVTX; break;
+            }
+        }
+        clauses.push_back({who, op, bits});
+        if (pos == spec.size()) return true;
+        if (spec[pos++] != ',') return false;
+    }
+    return false;
+}
+
+mode_t ChmodEngine::apply(mode_t mode) const {
+    for (const Clause& clause : clauses) {
+        mode_t bits = clause.bits & clause.who;
+        if (clause.op == '+') mode |= bits;
+        else if (clause.op == '-') mode &= ~bits;
+        else mode = (mode & ~clause.who) | bits;
+    }
+    return mode;
+}
+
+void ChmodEngine::start(std::vector<fs::path> paths) {
+    coordinator = std::thread(&ChmodEngine::run, this, std::move(paths));
+}
+
+void ChmodEngine::wait() {
+    if (coordinator.joinable()) coordinator.join();
+}
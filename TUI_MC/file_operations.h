@@ -0,0 +1,236 @@
+#pragma once
+
+#include "thread_pool.h"
+#include "checksum.h"
+
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <condition_variable>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+namespace fs = std::filesystem;
+
+// Copies files and directory trees. The tree is walked once up front on a
+// coordinator thread to create directories and total up the work, then each
+// regular file is copied as one pool task. A file copy tries, in order:
+// a reflink (FICLONE), for a file with holes an extent-by-extent copy that
+// keeps them, copy_file_range, sendfile, and finally a plain read/write loop
+// over a large aligned buffer. A verified copy instead goes
+// through a ChecksumPipeline, is flushed to disk and read back past the
+// page cache, and only counts as copied when both SHA-256 digests agree.
+class CopyEngine {
+public:
+    struct Job {
+        fs::path source;
+        fs::path target;
+        uint64_t size;
+    };
+
+    struct FileDigest {
+        fs::path target;
+        Sha256::Digest digest;
+    };
+
+private:
+    static constexpr size_t CHUNK_SIZE = 16 * 1024 * 1024;   // bytes per syscall between cancel checks
+    static constexpr size_t BUFFER_SIZE = 1024 * 1024;
+    static constexpr size_t BUFFER_ALIGN = 4096;
+
+    WorkStealingPool& pool;
+    OperationProgress& progress;
+    std::thread coordinator;
+    std::function<void(const fs::path&)> on_copied;
+    std::vector<fs::path> directories;
+    TaskGroup group;
+    bool verify = false;
+    std::mutex digest_mtx;
+    std::vector<FileDigest> digests;    // of verified copies
+
+    static std::string describe(const fs::path& path, int err);
+    static bool copy_with_reflink(int in, int out);
+
+    // Each copy_* helper returns 0 when done, or the errno that made it give up.
+    // EXDEV, EINVAL, ENOSYS and friends mean "try the next strategy"; once
+    // part of the file is copied they are turned into EIO, since the next
+    // strategy would start over at offset 0. Any other errno is passed on.
+    static int copy_with_copy_file_range(int in, int out, uint64_t size, OperationProgress& progress);
+    static int copy_with_sendfile(int in, int out, uint64_t size, OperationProgress& progress);
+
+    // The calling thread's copy buffer, allocated on first use.
+    static char* thread_buffer();
+    static int copy_with_buffer(int in, int out, OperationProgress& progress);
+
+    // Copies `length` bytes at `offset` to the same offset in `out`, in the
+    // kernel while copy_file_range allows it and through the buffer after.
+    static int copy_extent(int in, int out, uint64_t offset, uint64_t length, bool& in_kernel,
+                           OperationProgress& progress);
+
+    // Copies only the data extents of a file with holes, as found with
+    // SEEK_DATA/SEEK_HOLE, and leaves the holes unallocated in the target;
+    // the final ftruncate() restores a trailing hole. Holes count as done as
+    // they are skipped. Only a filesystem that cannot report holes at all
+    // gets a fallback errno, and then nothing has been read or written yet.
+    static int copy_sparse(int in, int out, uint64_t size, OperationProgress& progress);
+
+    // A file has holes when fewer blocks are allocated than its size needs.
+    static bool is_sparse(const struct stat& st);
+    static bool fallback_errno(int err);
+
+    // Opens the source of `job` and creates its target with the same permissions.
+    static bool open_job(const Job& job, OperationProgress& progress, int& in, int& out, struct stat& st);
+    static bool copy_file(const Job& job, OperationProgress& progress);
+
+    // Digest of what is on disk at `path`. The read bypasses the page cache
+    // with O_DIRECT; where the filesystem refuses that, the file's (already
+    // flushed) pages are dropped first so they are read from the disk anyway.
+    static int read_back(const fs::path& path, uint64_t size, Sha256& digest, OperationProgress& progress);
+
+    // Copies through the checksum pipeline, then makes the copy durable and
+    // compares the digest of the data read with that of the copy read back.
+    bool copy_verified(const Job& job);
+
+    // Creates directories and symlinks as they are found and returns the regular files to copy.
+    void plan(const fs::path& source, const fs::path& target, std::vector<Job>& jobs);
+    static bool inside(const fs::path& path, const fs::path& dir);
+    void run(std::vector<fs::path> sources, fs::path destination);
+
+public:
+    CopyEngine(WorkStealingPool& pool, OperationProgress& progress) : pool(pool), progress(progress) {}
+
+    // Stops a copy that is still running when the engine goes away.
+    ~CopyEngine();
+
+    // Called from worker threads with the source of every entry whose copy is complete.
+    void set_on_copied(std::function<void(const fs::path&)> callback) { on_copied = std::move(callback); }
+
+    // Source directories in the order they were created at the destination.
+    const std::vector<fs::path>& source_directories() const { return directories; }
+
+    // Copies through user space with every file checksummed and read back.
+    void set_verify(bool enabled) { verify = enabled; }
+
+    // Targets and SHA-256 of the files a verified copy completed. Read it
+    // once the copy has finished.
+    const std::vector<FileDigest>& file_digests() const { return digests; }
+
+    void start(std::vector<fs::path> sources, fs::path destination);
+
+    // Copies synchronously on the calling thread plus the pool.
+    void copy_tree(const std::vector<fs::path>& sources, const fs::path& destination);
+
+    void cancel() { progress.cancelled = true; }
+
+    void wait();
+};
+
+// Moves files and directory trees. Within one filesystem each source is a
+// single renameat2(RENAME_NOREPLACE), all of them submitted as one io_uring
+// batch. Across filesystems the sources are
+// copied with CopyEngine while a syncer thread makes finished copies durable
+// in batches with one syncfs on the destination, and only then unlinks the
+// batch's sources. A source is therefore never removed before its copy is on
+// disk, without paying one fsync per small file.
+class MoveEngine {
+private:
+    static constexpr size_t SYNC_BATCH = 1024;
+    static constexpr auto SYNC_INTERVAL = std::chrono::milliseconds(500);
+
+    WorkStealingPool& pool;
+    OperationProgress& progress;
+    std::thread coordinator;
+
+    std::mutex copied_mtx;
+    std::condition_variable copied_cv;
+    std::vector<fs::path> copied;   // written at the destination, not yet durable
+    bool copy_done = false;
+
+    void sync_and_unlink(int dest_fd);
+    void move_across_devices(const std::vector<fs::path>& sources, const fs::path& destination);
+    void run(std::vector<fs::path> sources, fs::path destination);
+
+public:
+    MoveEngine(WorkStealingPool& pool, OperationProgress& progress) : pool(pool), progress(progress) {}
+
+    ~MoveEngine();
+    void start(std::vector<fs::path> sources, fs::path destination);
+    void wait();
+};
+
+// Removes files and whole trees. The roots are classified with one batch of
+// statx and the plain files among them unlinked with another, both through
+// io_uring. Each directory is one pool task that reads
+// it with getdents64 on its own fd and unlinks files relative to that fd, so
+// paths are never resolved per file. Subdirectories become new tasks that
+// idle workers steal; they are opened and finally removed relative to the
+// parent's fd, which stays open until they are done, so a directory swapped
+// for a symlink during the walk is never followed. A directory is removed
+// once its scan and all of its subdirectory tasks are done. In dry-run mode
+// the same walk only counts the entries into files_total.
+class DeleteEngine {
+private:
+    struct DirNode {
+        std::string path;              // for messages only
+        std::string name;              // relative to the parent's fd; the full path for a root
+        DirNode* parent;
+        int fd = -1;                   // open from its scan until it is removed
+        std::atomic<int> pending{1};   // its own scan plus unfinished subdirectories
+
+        int parent_fd() const { return parent ? parent->fd : AT_FDCWD; }
+    };
+
+    WorkStealingPool& pool;
+    OperationProgress& progress;
+    bool dry_run;
+    std::thread coordinator;
+    TaskGroup group;
+
+    void count_removed();
+
+    // Removes finished directories bottom-up as their last child completes.
+    void finish(DirNode* node);
+    void scan(DirNode* node);
+    void run(std::vector<fs::path> roots);
+
+public:
+    DeleteEngine(WorkStealingPool& pool, OperationProgress& progress, bool dry_run);
+    ~DeleteEngine();
+    void start(std::vector<fs::path> roots);
+    void wait();
+};
+
+// Changes permission bits of a set of entries. The current modes come from
+// one io_uring batch of statx; there is no io_uring chmod, so each new mode
+// is applied with a synchronous fchmodat as its statx completes. A mode is either octal
+// ("644") or symbolic clauses like chmod(1) takes ("u+x,go-w", "a=r").
+class ChmodEngine {
+private:
+    struct Clause {
+        mode_t who;     // bits the clause may touch
+        char op;        // '+', '-' or '='
+        mode_t bits;
+    };
+
+    OperationProgress& progress;
+    std::vector<Clause> clauses;
+    std::thread coordinator;
+
+    void run(std::vector<fs::path> paths);
+
+public:
+    explicit ChmodEngine(OperationProgress& progress) : progress(progress) {}
+
+    ~ChmodEngine();
+
+    // Parses `spec`; returns false if it is neither octal nor symbolic.
+    bool set_mode(const std::string& spec);
+    mode_t apply(mode_t mode) const;
+    void start(std::vector<fs::path> paths);
+    void wait();
+};
@@ -0,0 +1,681 @@
+#include "image_preview.h"
+#include "profiler.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <ncurses.h>
+#include <algorithm>
+#include <cstring>
+#include <climits>
+#include <sys/mman.h>
+#include <langinfo.h>
+#include <array>
+#include <cmath>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+std::pair<int, int> fit_within(int width, int height, int box_width, int box_height) {
+    double scale = std::min(static_cast<double>(box_width) / width, static_cast<double>(box_height) / height);
+    return {std::max(1, static_cast<int>(width * scale)), std::max(1, static_cast<int>(height * scale))};
+}
+
+bool JpegDecoder::fail(const std::string& message) {
+    if (error.empty()) error = message;
+    return false;
+}
+
+uint16_t JpegDecoder::read16() {
+    uint16_t value = (data[pos] << 8) | data[pos + 1];
+    pos += 2;
+    return value;
+}
+
+void JpegDecoder::fill_bits() {
+    while (bit_count <= 24) {
+        uint32_t byte = 0;
+        if (!hit_marker && pos < size) {
+            byte = data[pos++];
+            if (byte == 0xFF) {
+                if (pos < size && data[pos] == 0) {
+                    pos++;
+                } else {
+                    // A marker ends the entropy-coded data: pad with zeros.
+                    hit_marker = true;
+                    pos--;
+                    byte = 0;
+                }
+            }
+        } else {
+            hit_marker = true;
+        }
+        bits |= byte << (24 - bit_count);
+        bit_count += 8;
+    }
+}
+
+uint32_t JpegDecoder::take_bits(int n) {
+    fill_bits();
+    uint32_t value = bits >> (32 - n);
+    bits <<= n;
+    bit_count -= n;
+    return value;
+}
+
+int JpegDecoder::decode_symbol(const Huffman& table) {
+    fill_bits();
+    uint32_t peek = bits >> (32 - FAST_BITS);
+    int length = table.fast_length[peek];
+    if (length) {
+        bits <<= length;
+        bit_count -= length;
+        return table.fast_value[peek];
+    }
+    for (length = FAST_BITS + 1; length <= 16; length++) {
+        int32_t code = bits >> (32 - length);
+        if (code <= table.maxcode[length]) {
+            bits <<= length;
+            bit_count -= length;
+            return table.values[table.offset[length] + code];
+        }
+    }
+    return -1;
+}
+
+int JpegDecoder::receive_extend(int n) {
+    if (n == 0) return 0;
+    int value = take_bits(n);
+    return value < (1 << (n - 1)) ? value - (1 << n) + 1 : value;
+}
+
+bool JpegDecoder::read_quant_tables(size_t end) {
+    while (pos < end) {
+        int precision = data[pos] >> 4, id = data[pos] & 15;
+        pos++;
+        if (id > 3 || !has(precision ? 128 : 64)) return fail("bad quantisation table");
+        for (int i = 0; i < 64; i++) quant[id][i] = precision ? read16() : data[pos++];
+    }
+    return true;
+}
+
+bool JpegDecoder::read_huffman_tables(size_t end) {
+    while (pos < end) {
+        if (!has(17)) return fail("bad Huffman table");
+        int table_class = data[pos] >> 4, id = data[pos] & 15;
+        pos++;
+        if (table_class > 1 || id > 3) return fail("bad Huffman table");
+        int counts[17] = {0}, total = 0;
+        for (int length = 1; length <= 16; length++) total += counts[length] = data[pos++];
+        if (total > 256 || !has(total)) return fail("bad Huffman table");
+
+        Huffman& table = table_class ? ac_tables[id] : dc_tables[id];
+        memcpy(table.values, data + pos, total);
+        pos += total;
+        memset(table.fast_length, 0, sizeof(table.fast_length));
+        int32_t code = 0;
+        int index = 0;
+        for (int length = 1; length <= 16; length++) {
+            table.offset[length] = index - code;
+            for (int i = 0; i < counts[length]; i++, code++, index++) {
+                if (length <= FAST_BITS) {
+                    int shift = FAST_BITS - length;
+                    for (int fill = 0; fill < (1 << shift); fill++) {
+                        table.fast_length[(code << shift) | fill] = length;
+                        table.fast_value[(code << shift) | fill] = table.values[index];
+                    }
+                }
+            }
+            if (code > (1 << length)) return fail("bad Huffman table");
+            table.maxcode[length] = counts[length] ? code - 1 : -1;
+            code <<= 1;
+        }
+        table.maxcode[17] = INT32_MAX;
+        table.defined = true;
+    }
+    return true;
+}
+
+bool JpegDecoder::read_frame(size_t end, int target_width, int target_height) {
+    if (frame_seen) return fail("more than one frame");
+    if (end - pos < 6 || data[pos] != 8) return fail("only 8-bit JPEG is supported");
+    pos++;
+    height = read16();
+    width = read16();
+    component_count = data[pos++];
+    if (width == 0 || height == 0) return fail("no image size");
+    if (component_count != 1 && component_count != 3) return fail("only greyscale and YCbCr JPEG are supported");
+    if (end - pos < 3u * component_count) return fail("truncated frame header");
+    for (int i = 0; i < component_count; i++) {
+        Component& component = components[i];
+        component.id = data[pos];
+        component.h = data[pos + 1] >> 4;
+        component.v = data[pos + 1] & 15;
+        component.quant = data[pos + 2] & 3;
+        pos += 3;
+        if (component.h < 1 || component.h > 4 || component.v < 1 || component.v > 4) {
+            return fail("bad sampling factors");
+        }
+        hmax = std::max(hmax, component.h);
+        vmax = std::max(vmax, component.v);
+    }
+    if (component_count == 1) {
+        // A single component is coded without interleaving, one block per MCU.
+        components[0].h = components[0].v = hmax = vmax = 1;
+    }
+
+    auto [fit_width, fit_height] = fit_within(width, height, target_width, target_height);
+    dc_only = (width + 7) / 8 >= fit_width && (height + 7) / 8 >= fit_height;
+    int scale = dc_only ? 1 : 8;
+    int mcus_x = (width + 8 * hmax - 1) / (8 * hmax), mcus_y = (height + 8 * vmax - 1) / (8 * vmax);
+    if (static_cast<int64_t>(mcus_x * hmax) * scale * mcus_y * vmax * scale > MAX_PIXELS) {
+        return fail("image too large to preview");
+    }
+    for (int i = 0; i < component_count; i++) {
+        Component& component = components[i];
+        component.stride = mcus_x * component.h * scale;
+        component.plane.assign(static_cast<size_t>(component.stride) * mcus_y * component.v * scale, 0);
+    }
+    frame_seen = true;
+    return true;
+}
+
+void JpegDecoder::idct(const float* in, uint8_t* out, int stride) {
+    static const auto table = [] {
+        std::array<float, 64> cosines;
+        for (int x = 0; x < 8; x++) {
+            for (int u = 0; u < 8; u++) {
+                cosines[x * 8 + u] = (u == 0 ? M_SQRT1_2 : 1.0) * std::cos((2 * x + 1) * u * M_PI / 16) / 2;
+            }
+        }
+        return cosines;
+    }();
+    float rows[64];
+    for (int y = 0; y < 8; y++) {
+        for (int x = 0; x < 8; x++) {
+            float sum = 0;
+            for (int u = 0; u < 8; u++) sum += table[x * 8 + u] * in[y * 8 + u];
+            rows[y * 8 + x] = sum;
+        }
+    }
+    for (int x = 0; x < 8; x++) {
+        for (int y = 0; y < 8; y++) {
+            float sum = 128;
+            for (int v = 0; v < 8; v++) sum += table[y * 8 + v] * rows[v * 8 + x];
+            out[y * stride + x] = static_cast<uint8_t>(std::clamp(std::lround(sum), 0l, 255l));
+        }
+    }
+}
+
+bool JpegDecoder::decode_block(Component& component, int block_x, int block_y) {
+    const Huffman& dc = dc_tables[component.dc_table];
+    const Huffman& ac = ac_tables[component.ac_table];
+    const uint16_t* q = quant[component.quant];
+
+    int category = decode_symbol(dc);
+    if (category < 0 || category > 11) return fail("corrupt JPEG data");
+    component.dc_pred += receive_extend(category);
+
+    float coefficients[64] = {0};
+    bool flat = true;
+    for (int k = 1; k < 64; ) {
+        int symbol = decode_symbol(ac);
+        if (symbol < 0) return fail("corrupt JPEG data");
+        int run = symbol >> 4, magnitude = symbol & 15;
+        if (magnitude == 0) {
+            if (run != 15) break;          // end of block
+            k += 16;
+            continue;
+        }
+        k += run;
+        if (k > 63) return fail("corrupt JPEG data");
+        int value = receive_extend(magnitude);
+        if (!dc_only) {
+            coefficients[ZIGZAG[k]] = static_cast<float>(value) * q[k];
+            flat = false;
+        }
+        k++;
+    }
+
+    int dc_value = component.dc_pred * q[0];
+    if (dc_only) {
+        component.plane[static_cast<size_t>(block_y) * component.stride + block_x] =
+            static_cast<uint8_t>(std::clamp(128 + dc_value / 8, 0, 255));
+        return true;
+    }
+    uint8_t* out = component.plane.data() + static_cast<size_t>(block_y) * 8 * component.stride + block_x * 8;
+    if (flat) {
+        uint8_t value = static_cast<uint8_t>(std::clamp(128 + dc_value / 8, 0, 255));
+        for (int y = 0; y < 8; y++) memset(out + y * component.stride, value, 8);
+        return true;
+    }
+    coefficients[0] = static_cast<float>(dc_value);
+    idct(coefficients, out, component.stride);
+    return true;
+}
+
+bool JpegDecoder::restart() {
+    bits = 0;
+    bit_count = 0;
+    hit_marker = false;
+    while (pos + 1 < size && !(data[pos] == 0xFF && data[pos + 1] >= 0xD0 && data[pos + 1] <= 0xD7)) pos++;
+    if (pos + 1 >= size) return fail("missing restart marker");
+    pos += 2;
+    for (int i = 0; i < component_count; i++) components[i].dc_pred = 0;
+    return true;
+}
+
+bool JpegDecoder::read_scan(size_t end) {
+    if (!frame_seen) return fail("scan before frame header");
+    if (pos >= end) return fail("truncated scan header");
+    int count = data[pos++];
+    if (count != component_count || end - pos < 2u * count + 3) {
+        return fail("multi-scan JPEG is not supported");
+    }
+    for (int i = 0; i < count; i++) {
+        int id = data[pos], tables = data[pos + 1];
+        pos += 2;
+        Component* component = nullptr;
+        for (int c = 0; c < component_count; c++) {
+            if (components[c].id == id) component = &components[c];
+        }
+        if (!component) return fail("scan names an unknown component");
+        component->dc_table = (tables >> 4) & 3;
+        component->ac_table = tables & 3;
+        if (!dc_tables[component->dc_table].defined || !ac_tables[component->ac_table].defined) {
+            return fail("missing Huffman table");
+        }
+    }
+    pos = end;
+
+    int mcus_x = (width + 8 * hmax - 1) / (8 * hmax), mcus_y = (height + 8 * vmax - 1) / (8 * vmax);
+    int until_restart = restart_interval;
+    for (int mcu_y = 0; mcu_y < mcus_y; mcu_y++) {
+        if (cancelled) return fail("cancelled");
+        for (int mcu_x = 0; mcu_x < mcus_x; mcu_x++) {
+            if (restart_interval && until_restart-- == 0) {
+                if (!restart()) return false;
+                until_restart = restart_interval - 1;
+            }
+            for (int c = 0; c < component_count; c++) {
+                Component& component = components[c];
+                for (int v = 0; v < component.v; v++) {
+                    for (int h = 0; h < component.h; h++) {
+                        if (!decode_block(component, mcu_x * component.h + h, mcu_y * component.v + v)) return false;
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+void JpegDecoder::convert(Image& image) const {
+    int scale = dc_only ? 8 : 1;
+    image.width = (width + scale - 1) / scale;
+    image.height = (height + scale - 1) / scale;
+    image.rgb.resize(static_cast<size_t>(image.width) * image.height * 3);
+    uint8_t* out = image.rgb.data();
+    for (int y = 0; y < image.height; y++) {
+        const uint8_t* luma = components[0].plane.data() + static_cast<size_t>(y * components[0].v / vmax) * components[0].stride;
+        if (component_count == 1) {
+            for (int x = 0; x < image.width; x++, out += 3) out[0] = out[1] = out[2] = luma[x];
+            continue;
+        }
+        const Component& cb = components[1];
+        const Component& cr = components[2];
+        const uint8_t* cb_row = cb.plane.data() + static_cast<size_t>(y * cb.v / vmax) * cb.stride;
+        const uint8_t* cr_row = cr.plane.data() + static_cast<size_t>(y * cr.v / vmax) * cr.stride;
+        for (int x = 0; x < image.width; x++, out += 3) {
+            int luma_value = luma[x * components[0].h / hmax] << 16;
+            int blue = cb_row[x * cb.h / hmax] - 128, red = cr_row[x * cr.h / hmax] - 128;
+            // ITU-R BT.601 in 16.16 fixed point.
+            out[0] = std::clamp((luma_value + 91881 * red + 32768) >> 16, 0, 255);
+            out[1] = std::clamp((luma_value - 22554 * blue - 46802 * red + 32768) >> 16, 0, 255);
+            out[2] = std::clamp((luma_value + 116130 * blue + 32768) >> 16, 0, 255);
+        }
+    }
+}
+
+JpegDecoder::JpegDecoder(const uint8_t* data, size_t size, const std::atomic<bool>& cancelled)
+    : data(data), size(size), cancelled(cancelled) {}
+
+bool JpegDecoder::decode(Image& image, int target_width, int target_height) {
+    if (size < 4 || data[0] != 0xFF || data[1] != 0xD8) return fail("not a JPEG file");
+    pos = 2;
+    while (true) {
+        while (pos < size && data[pos] != 0xFF) pos++;
+        while (pos < size && data[pos] == 0xFF) pos++;
+        if (pos >= size) return fail("truncated JPEG file");
+        int marker = data[pos++];
+        if (marker == 0xD9) break;                                     // EOI
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) continue;
+        if (!has(2)) return fail("truncated JPEG file");
+        size_t end = pos + read16();
+        if (end < pos || end > size) return fail("truncated JPEG file");
+        bool ok = true;
+        switch (marker) {
+            case 0xDB: ok = read_quant_tables(end); break;
+            case 0xC4: ok = read_huffman_tables(end); break;
+            case 0xC0: case 0xC1: ok = read_frame(end, target_width, target_height); break;
+            case 0xDD: restart_interval = end - pos >= 2 ? read16() : 0; break;
+            case 0xDA:
+                if (!read_scan(end)) return false;
+                convert(image);
+                return true;
+            default:
+                if (marker >= 0xC2 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+                    return fail(marker == 0xC2 ? "progressive JPEG is not supported" : "unsupported JPEG coding");
+                }
+                break;
+        }
+        if (!ok) return false;
+        pos = std::max(pos, end);
+    }
+    return fail("no image data");
+}
+
+bool ImageDecoder::decode_bmp(const uint8_t* data, size_t size, Image& image, std::string& error) {
+    if (size < 26) return error = "truncated BMP file", false;
+    uint32_t pixels_at = le32(data + 10), header = le32(data + 14);
+    int64_t width, height;
+    int bpp, compression = 0;
+    uint32_t palette_size = 0;
+    int palette_entry = 4;
+    if (header == 12) {
+        width = le16(data + 18);
+        height = static_cast<int16_t>(le16(data + 20));
+        bpp = le16(data + 24);
+        palette_entry = 3;
+    } else if (header >= 40 && size >= 54) {
+        width = static_cast<int32_t>(le32(data + 18));
+        height = static_cast<int32_t>(le32(data + 22));
+        bpp = le16(data + 28);
+        compression = le32(data + 30);
+        palette_size = le32(data + 46);
+    } else {
+        return error = "unsupported BMP header", false;
+    }
+    bool top_down = height < 0;
+    height = std::abs(height);
+    if (width <= 0 || height == 0 || width * height > MAX_PIXELS) return error = "unsupported BMP size", false;
+
+    uint32_t masks[3] = {0x00FF0000, 0x0000FF00, 0x000000FF};
+    if (bpp == 16 && compression == 0) {
+        masks[0] = 0x7C00, masks[1] = 0x03E0, masks[2] = 0x001F;
+    } else if (compression == 3 && (bpp == 16 || bpp == 32)) {
+        size_t at = 14 + 40;
+        if (size < at + 12) return error = "truncated BMP file", false;
+        for (int i = 0; i < 3; i++) masks[i] = le32(data + at + 4 * i);
+    } else if (compression != 0) {
+        return error = "compressed BMP is not supported", false;
+    }
+    if (bpp != 1 && bpp != 4 && bpp != 8 && bpp != 16 && bpp != 24 && bpp != 32) {
+        return error = "unsupported BMP bit depth", false;
+    }
+
+    const uint8_t* palette = data + 14 + header;
+    if (bpp <= 8) {
+        if (palette_size == 0 || palette_size > (1u << bpp)) palette_size = 1u << bpp;
+        if (14 + header + static_cast<size_t>(palette_size) * palette_entry > size) {
+            return error = "truncated BMP palette", false;
+        }
+    }
+    size_t stride = (static_cast<size_t>(width) * bpp + 31) / 32 * 4;
+    if (pixels_at > size || stride * height > size - pixels_at) return error = "truncated BMP file", false;
+
+    Channel red(masks[0]), green(masks[1]), blue(masks[2]);
+    image.width = width;
+    image.height = height;
+    image.rgb.resize(static_cast<size_t>(width) * height * 3);
+    for (int64_t y = 0; y < height; y++) {
+        const uint8_t* row = data + pixels_at + stride * (top_down ? y : height - 1 - y);
+        uint8_t* out = image.rgb.data() + static_cast<size_t>(y) * width * 3;
+        for (int64_t x = 0; x < width; x++, out += 3) {
+            if (bpp <= 8) {
+                int per_byte = 8 / bpp;
+                int shift = (per_byte - 1 - x % per_byte) * bpp;
+                uint32_t index = (row[x / per_byte] >> shift) & ((1 << bpp) - 1);
+                if (index >= palette_size) index = 0;
+                const uint8_t* entry = palette + index * palette_entry;
+                out[0] = entry[2], out[1] = entry[1], out[2] = entry[0];
+            } else if (bpp == 24) {
+                out[0] = row[x * 3 + 2], out[1] = row[x * 3 + 1], out[2] = row[x * 3];
+            } else {
+                uint32_t pixel = bpp == 16 ? le16(row + x * 2) : le32(row + x * 4);
+                out[0] = red.extract(pixel), out[1] = green.extract(pixel), out[2] = blue.extract(pixel);
+            }
+        }
+    }
+    return true;
+}
+
+void ImageDecoder::accumulate_row(uint32_t* sums, const uint8_t* row, size_t n) {
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i));
+        __m128i low = _mm_unpacklo_epi8(bytes, zero), high = _mm_unpackhi_epi8(bytes, zero);
+        __m128i* out = reinterpret_cast<__m128i*>(sums + i);
+        _mm_storeu_si128(out, _mm_add_epi32(_mm_loadu_si128(out), _mm_unpacklo_epi16(low, zero)));
+        _mm_storeu_si128(out + 1, _mm_add_epi32(_mm_loadu_si128(out + 1), _mm_unpackhi_epi16(low, zero)));
+        _mm_storeu_si128(out + 2, _mm_add_epi32(_mm_loadu_si128(out + 2), _mm_unpacklo_epi16(high, zero)));
+        _mm_storeu_si128(out + 3, _mm_add_epi32(_mm_loadu_si128(out + 3), _mm_unpackhi_epi16(high, zero)));
+    }
+#endif
+    for (; i < n; i++) sums[i] += row[i];
+}
+
+Image ImageDecoder::downscale(const Image& source, int width, int height) {
+    Image out;
+    out.width = width;
+    out.height = height;
+    out.rgb.resize(static_cast<size_t>(width) * height * 3);
+    std::vector<int> x_begin(width + 1);
+    for (int x = 0; x <= width; x++) x_begin[x] = static_cast<int64_t>(x) * source.width / width;
+    size_t row_bytes = static_cast<size_t>(source.width) * 3;
+    std::vector<uint32_t> sums(row_bytes);
+    uint8_t* pixel = out.rgb.data();
+    for (int y = 0; y < height; y++) {
+        int y0 = static_cast<int64_t>(y) * source.height / height;
+        int y1 = std::max(y0 + 1, static_cast<int>(static_cast<int64_t>(y + 1) * source.height / height));
+        std::fill(sums.begin(), sums.end(), 0);
+        for (int row = y0; row < y1; row++) accumulate_row(sums.data(), source.rgb.data() + row * row_bytes, row_bytes);
+        for (int x = 0; x < width; x++, pixel += 3) {
+            int x0 = x_begin[x], x1 = std::max(x0 + 1, x_begin[x + 1]);
+            uint32_t red = 0, green = 0, blue = 0;
+            for (int column = x0; column < x1; column++) {
+                red += sums[column * 3];
+                green += sums[column * 3 + 1];
+                blue += sums[column * 3 + 2];
+            }
+            uint32_t area = (x1 - x0) * (y1 - y0);
+            pixel[0] = (red + area / 2) / area;
+            pixel[1] = (green + area / 2) / area;
+            pixel[2] = (blue + area / 2) / area;
+        }
+    }
+    return out;
+}
+
+bool ImageDecoder::thumbnail(const uint8_t* data, size_t size, int box_width, int box_height,
+                             const std::atomic<bool>& cancelled, Image& out, int& full_width, int& full_height,
+                             std::string& error) {
+    Image image;
+    if (size >= 2 && data[0] == 'B' && data[1] == 'M') {
+        if (!decode_bmp(data, size, image, error)) return false;
+        full_width = image.width;
+        full_height = image.height;
+    } else if (size >= 3 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF) {
+        JpegDecoder decoder(data, size, cancelled);
+        if (!decoder.decode(image, box_width, box_height)) {
+            error = decoder.error_message();
+            return false;
+        }
+        full_width = decoder.frame_width();
+        full_height = decoder.frame_height();
+    } else {
+        error = "not a BMP or JPEG image";
+        return false;
+    }
+    if (cancelled) return error = "cancelled", false;
+    auto [width, height] = fit_within(full_width, full_height, box_width, box_height);
+    out = downscale(image, width, height);
+    return true;
+}
+
+void ImagePreview::decode(std::shared_ptr<Job> job, std::string path, int cols, int rows) {
+    ScopedTimer timer(Profiler::PREVIEW);
+    Thumbnail& result = job->result;
+    int fd = job->cancelled ? -1 : open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (job->cancelled) {
+        result.error = "cancelled";
+    } else if (fd < 0 || fstat(fd, &st) != 0) {
+        result.error = std::strerror(errno);
+    } else if (st.st_size > MAX_FILE_SIZE) {
+        result.error = "too large to preview";
+    } else if (st.st_size == 0) {
+        result.error = "empty file";
+    } else {
+        void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            result.error = std::strerror(errno);
+        } else {
+            ImageDecoder::thumbnail(static_cast<const uint8_t*>(map), st.st_size, cols, rows * 2, job->cancelled,
+                                    result.pixels, result.image_width, result.image_height, result.error);
+            munmap(map, st.st_size);
+        }
+    }
+    if (fd >= 0) close(fd);
+    result.cols = result.pixels.width;
+    result.rows = (result.pixels.height + 1) / 2;
+    job->done = true;
+    if (job->wakeup && !job->cancelled) job->wakeup->notify();
+}
+
+int ImagePreview::palette_index(const uint8_t* rgb) {
+    auto level = [](int value) { return value < 48 ? 0 : value < 115 ? 1 : (value - 35) / 40; };
+    static const int steps[6] = {0, 95, 135, 175, 215, 255};
+    int r = level(rgb[0]), g = level(rgb[1]), b = level(rgb[2]);
+    int grey = std::clamp(((rgb[0] + rgb[1] + rgb[2]) / 3 - 3) / 10, 0, 23);
+    auto distance = [rgb](int red, int green, int blue) {
+        return (rgb[0] - red) * (rgb[0] - red) + (rgb[1] - green) * (rgb[1] - green) + (rgb[2] - blue) * (rgb[2] - blue);
+    };
+    int grey_value = 8 + grey * 10;
+    if (distance(grey_value, grey_value, grey_value) < distance(steps[r], steps[g], steps[b])) return 232 + grey;
+    return 16 + 36 * r + 6 * g + b;
+}
+
+void ImagePreview::append_color(std::string& out, int layer, const uint8_t* rgb, Colors colors) {
+    char buf[32];
+    if (colors == TRUECOLOR) snprintf(buf, sizeof(buf), "%d;2;%d;%d;%d", layer, rgb[0], rgb[1], rgb[2]);
+    else snprintf(buf, sizeof(buf), "%d;5;%d", layer, palette_index(rgb));
+    out += buf;
+}
+
+ImagePreview::~ImagePreview() {
+    if (current) current->cancelled = true;
+}
+
+ImagePreview::Colors ImagePreview::color_support() {
+    static const Colors colors = [] {
+        const char* colorterm = getenv("COLORTERM");
+        if (colorterm && (!strcmp(colorterm, "truecolor") || !strcmp(colorterm, "24bit"))) return TRUECOLOR;
+        int count = tigetnum("colors");
+        return count >= (1 << 24) ? TRUECOLOR : count >= 256 ? PALETTE : NO_COLORS;
+    }();
+    return colors;
+}
+
+bool ImagePreview::is_image_name(const std::string& name) {
+    size_t dot = name.rfind('.');
+    if (dot == std::string::npos) return false;
+    std::string extension = name.substr(dot + 1);
+    for (char& c : extension) c = tolower(static_cast<unsigned char>(c));
+    return extension == "bmp" || extension == "dib" || extension == "jpg" || extension == "jpeg" ||
+           extension == "jpe" || extension == "jfif";
+}
+
+void ImagePreview::clear() {
+    if (current) current->cancelled = true;
+    current.reset();
+    entries.clear();
+    index.clear();
+}
+
+const ImagePreview::Thumbnail* ImagePreview::query(WorkStealingPool& pool, const fs::path& file, const FileMeta& meta, int cols, int rows) {
+    Key key{meta.dev, meta.ino, meta.mtime_sec, meta.mtime_nsec, cols, rows};
+    auto cached = index.find(key);
+    if (cached != index.end()) {
+        entries.splice(entries.begin(), entries, cached->second);
+        return &entries.front().second;
+    }
+
+    if (current && current->key == key) {
+        if (!current->done) return nullptr;
+        Thumbnail thumbnail = std::move(current->result);
+        current.reset();
+        thumbnail.id = next_id++;
+        entries.emplace_front(key, std::move(thumbnail));
+        index[key] = entries.begin();
+        if (entries.size() > CAPACITY) {
+            index.erase(entries.back().first);
+            entries.pop_back();
+        }
+        return &entries.front().second;
+    }
+
+    if (current) current->cancelled = true;
+    current = std::make_shared<Job>();
+    current->key = key;
+    current->wakeup = wakeup;
+    pool.submit([job = current, path = file.string(), cols, rows] { decode(job, path, cols, rows); });
+    return nullptr;
+}
+
+std::string ImagePreview::render(const Thumbnail& thumbnail, int y, int x) {
+    Colors colors = color_support();
+    static const bool half_blocks = strcmp(nl_langinfo(CODESET), "UTF-8") == 0;
+    const Image& image = thumbnail.pixels;
+    std::string out = "\0337";
+    std::string sgr, last_sgr;
+    char buf[32];
+    for (int row = 0; row < thumbnail.rows; row++) {
+        snprintf(buf, sizeof(buf), "\033[%d;%dH", y + row + 1, x + 1);
+        out += buf;
+        const uint8_t* upper = image.rgb.data() + static_cast<size_t>(2 * row) * image.width * 3;
+        const uint8_t* lower = 2 * row + 1 < image.height ? upper + image.width * 3 : nullptr;
+        for (int col = 0; col < thumbnail.cols; col++) {
+            const uint8_t* top = upper + col * 3;
+            const uint8_t* bottom = lower ? lower + col * 3 : nullptr;
+            sgr = "\033[";
+            if (!half_blocks) {
+                // One colour per cell: the mean of its two pixels.
+                uint8_t mean[3];
+                for (int c = 0; c < 3; c++) mean[c] = bottom ? (top[c] + bottom[c] + 1) / 2 : top[c];
+                append_color(sgr, 48, mean, colors);
+            } else {
+                append_color(sgr, 38, top, colors);
+                if (bottom) {
+                    sgr += ';';
+                    append_color(sgr, 48, bottom, colors);
+                } else {
+                    sgr += ";49";
+                }
+            }
+            sgr += 'm';
+            if (sgr != last_sgr) {
+                out += sgr;
+                last_sgr.swap(sgr);
+            }
+            out += half_blocks ? "\xe2\x96\x80" : " ";
+        }
+    }
+    out += "\033[0m\0338";
+    return out;
+}
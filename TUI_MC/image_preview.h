@@ -0,0 +1,236 @@
+#pragma once
+
+#include "directory.h"
+#include "thread_pool.h"
+
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <list>
+#include <map>
+#include <memory>
+#include <tuple>
+
+namespace fs = std::filesystem;
+
+// Decoded pixels: 8-bit RGB, rows top to bottom.
+struct Image {
+    int width = 0;
+    int height = 0;
+    std::vector<uint8_t> rgb;
+};
+
+// The size of a `width` x `height` picture scaled to fit a `box_width` x
+// `box_height` box with its aspect ratio kept.
+std::pair<int, int> fit_within(int width, int height, int box_width, int box_height);
+
+// Baseline (sequential, Huffman-coded) JPEG decoder for previews:
+// greyscale or YCbCr with any sampling factors up to 4x4, restart markers
+// and 8/16-bit quantisation tables. Progressive and arithmetic-coded files
+// are refused. When the picture is at least 8 times the size it will be
+// shown at, only the DC coefficient of each block is kept, which gives a
+// 1/8 scale image without any IDCT work.
+class JpegDecoder {
+private:
+    static constexpr int FAST_BITS = 9;
+    static constexpr int MAX_PIXELS = 1 << 25;
+
+    struct Huffman {
+        bool defined = false;
+        uint8_t fast_length[1 << FAST_BITS];   // 0: code longer than FAST_BITS
+        uint8_t fast_value[1 << FAST_BITS];
+        int32_t maxcode[18];
+        int32_t offset[17];
+        uint8_t values[256];
+    };
+
+    struct Component {
+        int id = 0;
+        int h = 1, v = 1;
+        int quant = 0;
+        int dc_table = 0, ac_table = 0;
+        int dc_pred = 0;
+        int stride = 0;                        // plane width in samples
+        std::vector<uint8_t> plane;
+    };
+
+    static constexpr uint8_t ZIGZAG[64] = {
+        0,  1,  8,  16, 9,  2,  3,  10, 17, 24, 32, 25, 18, 11, 4,  5,  12, 19, 26, 33, 40, 48,
+        41, 34, 27, 20, 13, 6,  7,  14, 21, 28, 35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23,
+        30, 37, 44, 51, 58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63};
+
+    const uint8_t* data;
+    size_t size;
+    size_t pos = 0;
+    const std::atomic<bool>& cancelled;
+
+    uint16_t quant[4][64] = {};
+    Huffman dc_tables[4], ac_tables[4];
+    Component components[3];
+    int component_count = 0;
+    int width = 0, height = 0;
+    int hmax = 1, vmax = 1;
+    int restart_interval = 0;
+    bool frame_seen = false;
+    bool dc_only = false;
+
+    uint32_t bits = 0;                         // next bits of the scan, MSB first
+    int bit_count = 0;
+    bool hit_marker = false;
+
+    std::string error;
+
+    bool fail(const std::string& message);
+
+    bool has(size_t n) const { return pos + n <= size; }
+
+    uint16_t read16();
+    void fill_bits();
+    uint32_t take_bits(int n);
+    int decode_symbol(const Huffman& table);
+
+    // The signed value of an `n`-bit magnitude category.
+    int receive_extend(int n);
+    bool read_quant_tables(size_t end);
+    bool read_huffman_tables(size_t end);
+    bool read_frame(size_t end, int target_width, int target_height);
+
+    // Inverse DCT of one dequantised block, in natural order, into `out`.
+    static void idct(const float* in, uint8_t* out, int stride);
+    bool decode_block(Component& component, int block_x, int block_y);
+
+    // Skips to just after the RSTn marker ending a restart interval.
+    bool restart();
+    bool read_scan(size_t end);
+    void convert(Image& image) const;
+
+public:
+    JpegDecoder(const uint8_t* data, size_t size, const std::atomic<bool>& cancelled);
+
+    // Decodes into `image`, at full or 1/8 scale depending on how large it
+    // will be shown. Returns false with error() set on failure.
+    bool decode(Image& image, int target_width, int target_height);
+
+    const std::string& error_message() const { return error; }
+
+    int frame_width() const { return width; }
+
+    int frame_height() const { return height; }
+};
+
+// Turns BMP and JPEG files into thumbnails. BMP is read directly from the
+// mapped file; JPEG goes through JpegDecoder. Either way the pixels are
+// box-filtered down to the requested size.
+class ImageDecoder {
+private:
+    static constexpr int MAX_PIXELS = 1 << 25;
+
+    static uint32_t le32(const uint8_t* p) { return p[0] | p[1] << 8 | p[2] << 16 | static_cast<uint32_t>(p[3]) << 24; }
+
+    static uint16_t le16(const uint8_t* p) { return p[0] | p[1] << 8; }
+
+    // Position and width of the bits a BITFIELDS mask selects.
+    struct Channel {
+        int shift = 0;
+        uint32_t max = 0;
+
+        explicit Channel(uint32_t mask) {
+            if (!mask) return;
+            shift = __builtin_ctz(mask);
+            max = mask >> shift;
+        }
+
+        uint8_t extract(uint32_t pixel) const {
+            return max ? static_cast<uint8_t>(((pixel >> shift) & max) * 255 / max) : 0;
+        }
+    };
+
+    static bool decode_bmp(const uint8_t* data, size_t size, Image& image, std::string& error);
+
+    // Adds one row of bytes into 32-bit column sums.
+    static void accumulate_row(uint32_t* sums, const uint8_t* row, size_t n);
+
+public:
+    // Box filter to `width` x `height`: every output pixel is the mean of
+    // the source pixels it covers (or a copy of one when scaling up). Source
+    // rows are summed column-wise first, then runs of those sums are added
+    // up across, so each source byte is read once.
+    static Image downscale(const Image& source, int width, int height);
+
+    // Decodes the image in `data` and scales it to fit a `box_width` x
+    // `box_height` pixel box. Returns false with `error` set on failure.
+    static bool thumbnail(const uint8_t* data, size_t size, int box_width, int box_height,
+                          const std::atomic<bool>& cancelled, Image& out, int& full_width, int& full_height,
+                          std::string& error);
+};
+
+// Image thumbnails for the info pane. Decoding runs on the worker pool, one
+// file at a time: moving the cursor on cancels the job for the file it left,
+// so scrolling through a folder of images never waits for a decoder.
+// Finished thumbnails are kept by (inode, mtime, pane size). They are drawn
+// with half-block characters, two pixels per cell, as 24-bit or 256-colour
+// escape sequences written past ncurses, which keeps the cells blank.
+class ImagePreview {
+public:
+    struct Thumbnail {
+        uint64_t id = 0;                  // tells apart what is on screen
+        int cols = 0, rows = 0;           // size in cells
+        Image pixels;                     // cols x (2 * rows - 1 or 2 * rows)
+        int image_width = 0, image_height = 0;
+        std::string error;                // set instead of pixels when decoding failed
+    };
+
+    enum Colors { NO_COLORS, PALETTE, TRUECOLOR };
+
+private:
+    using Key = std::tuple<uint64_t, uint64_t, int64_t, uint32_t, int, int>;
+
+    struct Job {
+        Key key;
+        std::atomic<bool> cancelled{false};
+        std::atomic<bool> done{false};
+        Wakeup* wakeup = nullptr;
+        Thumbnail result;
+    };
+
+    static constexpr size_t CAPACITY = 64;
+    static constexpr off_t MAX_FILE_SIZE = 64 << 20;
+
+    std::list<std::pair<Key, Thumbnail>> entries;    // most recently used first
+    std::map<Key, std::list<std::pair<Key, Thumbnail>>::iterator> index;
+    std::shared_ptr<Job> current;
+    Wakeup* wakeup = nullptr;
+    uint64_t next_id = 1;
+
+    static void decode(std::shared_ptr<Job> job, std::string path, int cols, int rows);
+    static int palette_index(const uint8_t* rgb);
+
+    // Appends the SGR parameters selecting `rgb` as foreground (38) or background (48).
+    static void append_color(std::string& out, int layer, const uint8_t* rgb, Colors colors);
+
+public:
+    ~ImagePreview();
+
+    // Notified when a thumbnail is ready to be drawn.
+    void set_wakeup(Wakeup* target) { wakeup = target; }
+
+    // What the terminal can show: 24-bit colour when COLORTERM or terminfo
+    // says so, else the 256-colour palette. Checked once, after initscr.
+    static Colors color_support();
+
+    // Names that get a preview; the content decides how it is decoded.
+    static bool is_image_name(const std::string& name);
+    void clear();
+
+    // The thumbnail of `file` for a pane of `cols` x `rows` cells, or null
+    // while it is being decoded. Asking for another file abandons the job
+    // for the previous one.
+    const Thumbnail* query(WorkStealingPool& pool, const fs::path& file, const FileMeta& meta, int cols, int rows);
+
+    // Escape sequences painting `thumbnail` with its top left corner at
+    // screen cell (`y`, `x`). Cursor position and attributes are saved and
+    // restored around them, so ncurses' idea of the terminal stays right.
+    // Runs of cells in the same colours share one SGR sequence.
+    static std::string render(const Thumbnail& thumbnail, int y, int x);
+};
@@ -0,0 +1,82 @@
+#include "io_ring.h"
+#include "profiler.h"
+
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+void IoRing::probe() {
+    constexpr unsigned OPS = 256;
+    std::vector<uint8_t> buffer(sizeof(io_uring_probe) + OPS * sizeof(io_uring_probe_op));
+    auto* result = reinterpret_cast<io_uring_probe*>(buffer.data());
+    if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, result, OPS) < 0) return;
+    for (unsigned op = 0; op < result->ops_len && op < OPS; op++) {
+        if (result->ops[op].flags & IO_URING_OP_SUPPORTED) supported.set(result->ops[op].op);
+    }
+}
+
+void IoRing::close_ring() {
+    if (sqes != MAP_FAILED) munmap(sqes, entries * sizeof(io_uring_sqe));
+    if (cq_ring != MAP_FAILED && cq_ring != sq_ring) munmap(cq_ring, cq_ring_size);
+    if (sq_ring != MAP_FAILED) munmap(sq_ring, sq_ring_size);
+    if (fd >= 0) close(fd);
+    sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    sq_ring = cq_ring = MAP_FAILED;
+    fd = -1;
+}
+
+io_uring_sqe* IoRing::next_sqe() {
+    unsigned index = tail++ & *sq_mask;
+    sq_array[index] = index;
+    queued++;
+    io_uring_sqe* sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int IoRing::enter(unsigned wait) {
+    __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+    while (true) {
+        int ret = syscall(__NR_io_uring_enter, fd, queued, wait, wait ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+        Profiler::count(Profiler::RING_ENTER);
+        if (ret >= 0) {
+            in_flight += ret;
+            queued -= ret;
+            return 0;
+        }
+        if (errno != EINTR) return errno;
+    }
+}
+
+IoRing::IoRing(unsigned depth) {
+    io_uring_params params{};
+    fd = syscall(__NR_io_uring_setup, depth, &params);
+    if (fd < 0) return;
+    entries = params.sq_entries;
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+
+    sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    cq_ring = single_mmap ? sq_ring
+                          : mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    void* sqe_memory = mmap(nullptr, entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    sqes = static_cast<io_uring_sqe*>(sqe_memory);
+    if (sq_ring == MAP_FAILED || cq_ring == MAP_FAILED || sqe_memory == MAP_FAILED) {
+        close_ring();
+        return;
+    }
+    sq_tail = at<unsigned>(sq_ring, params.sq_off.tail);
+    sq_mask = at<unsigned>(sq_ring, params.sq_off.ring_mask);
+    sq_array = at<unsigned>(sq_ring, params.sq_off.array);
+    cq_head = at<unsigned>(cq_ring, params.cq_off.head);
+    cq_tail = at<unsigned>(cq_ring, params.cq_off.tail);
+    cq_mask = at<unsigned>(cq_ring, params.cq_off.ring_mask);
+    cqes = at<io_uring_cqe>(cq_ring, params.cq_off.cqes);
+    tail = *sq_tail;
+    probe();
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cerrno>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <bitset>
+
+// A minimal io_uring on the raw syscalls, used to batch metadata requests
+// (statx, unlinkat, renameat) that would otherwise cost one blocking syscall
+// per file. When the kernel refuses io_uring, or its probe does not list the
+// opcode (renameat and unlinkat need 5.11, statx 5.6), run() falls back to
+// issuing each request as a plain syscall.
+class IoRing {
+private:
+    int fd = -1;
+    unsigned entries = 0;
+    void* sq_ring = MAP_FAILED;
+    void* cq_ring = MAP_FAILED;
+    size_t sq_ring_size = 0;
+    size_t cq_ring_size = 0;
+    io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    unsigned* sq_tail = nullptr;
+    unsigned* sq_mask = nullptr;
+    unsigned* sq_array = nullptr;
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned* cq_mask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+    unsigned tail = 0;        // next submission slot; published to the kernel by enter()
+    unsigned queued = 0;      // filled in, not yet handed to the kernel
+    unsigned in_flight = 0;   // submitted, completion not yet reaped
+    std::bitset<256> supported;   // opcodes the kernel's probe reported
+
+    template <typename T>
+    static T* at(void* ring, unsigned offset) {
+        return reinterpret_cast<T*>(static_cast<char*>(ring) + offset);
+    }
+
+    // Asks the kernel which opcodes it implements. Kernels before 5.6 have
+    // no probe, and none of the opcodes used here either.
+    void probe();
+    void close_ring();
+    io_uring_sqe* next_sqe();
+
+    // Hands the queued entries to the kernel and waits for `wait` completions.
+    int enter(unsigned wait);
+
+    template <typename Complete>
+    void reap(Complete complete) {
+        unsigned head = *cq_head;
+        unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            const io_uring_cqe& cqe = cqes[head & *cq_mask];
+            complete(cqe.user_data, cqe.res);
+            in_flight--;
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    }
+
+public:
+    explicit IoRing(unsigned depth = 256);
+
+    ~IoRing() { close_ring(); }
+
+    IoRing(const IoRing&) = delete;
+    IoRing& operator=(const IoRing&) = delete;
+
+    bool is_open() const { return fd >= 0; }
+
+    bool supports(uint8_t opcode) const { return is_open() && supported.test(opcode); }
+
+    // Runs requests 0..count-1, all of them `opcode`, with the ring kept full:
+    // prepare(sqe, i) fills in the rest of request i and complete(i, result)
+    // gets its result as 0 or -errno. Completions arrive in any order. Without
+    // a ring that supports `opcode`, fallback(i) performs request i
+    // synchronously and returns its result the same way. Once `cancelled` is
+    // set no new requests start; those in flight still complete.
+    template <typename Prepare, typename Fallback, typename Complete>
+    void run(size_t count, uint8_t opcode, const std::atomic<bool>& cancelled, Prepare prepare, Fallback fallback,
+             Complete complete) {
+        size_t next = 0;
+        if (supports(opcode)) {
+            while ((next < count && !cancelled) || in_flight > 0) {
+                while (next < count && !cancelled && in_flight + queued < entries) {
+                    io_uring_sqe* sqe = next_sqe();
+                    sqe->opcode = opcode;
+                    prepare(sqe, next);
+                    sqe->user_data = next++;
+                }
+                int err = enter(in_flight + queued > 0 ? 1 : 0);
+                reap([&](uint64_t i, int result) { complete(i, result); });
+                if (err != 0 && err != EAGAIN && err != EBUSY) {
+                    // The ring is unusable: requests it never took run synchronously,
+                    // and those it did still post their completions on their own.
+                    for (size_t i = next - queued; i < next; i++) complete(i, fallback(i));
+                    while (in_flight > 0) {
+                        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                        reap([&](uint64_t i, int result) { complete(i, result); });
+                    }
+                    close_ring();
+                    queued = 0;
+                    break;
+                }
+            }
+        }
+        for (; next < count && !cancelled; next++) complete(next, fallback(next));
+    }
+};
@@ -0,0 +1,142 @@
+#include "key_log.h"
+#include "profiler.h"
+
+#include <cstdlib>
+#include <cerrno>
+#include <fstream>
+#include <chrono>
+#include <algorithm>
+
+std::string KeyLog::key_bytes(int key) {
+    if (key >= 0 && key < 256) return std::string(1, static_cast<char>(key));
+    char* sequence = keybound(key, 0);
+    if (!sequence) return std::string();
+    std::string bytes(sequence);
+    free(sequence);
+    return bytes;
+}
+
+void KeyLog::write_all(int fd, const std::string& bytes) {
+    for (size_t written = 0; written < bytes.size(); ) {
+        ssize_t n = write(fd, bytes.data() + written, bytes.size() - written);
+        if (n < 0 && errno != EINTR) return;
+        if (n > 0) written += n;
+    }
+}
+
+void KeyLog::feed(int fd, bool fast) {
+    int64_t due = Profiler::now_ns();
+    for (size_t i = 0; i < events.size(); i++) {
+        if (fast) {
+            std::unique_lock<std::mutex> lock(replay_mtx);
+            replay_cv.wait(lock, [i] { return handled >= i; });
+        } else {
+            due += events[i].delay_ms * 1000000;
+            std::this_thread::sleep_for(std::chrono::nanoseconds(std::max<int64_t>(0, due - Profiler::now_ns())));
+        }
+        std::string bytes = key_bytes(events[i].key);
+        {
+            std::lock_guard<std::mutex> lock(replay_mtx);
+            written_ns[i] = Profiler::now_ns();
+        }
+        write_all(fd, bytes);
+    }
+    {
+        std::unique_lock<std::mutex> lock(replay_mtx);
+        replay_cv.wait_for(lock, std::chrono::seconds(60), [] { return handled >= events.size(); });
+    }
+    // Close whatever prompt the log ended in, so the main loop can stop.
+    exhausted = true;
+    write_all(fd, "\033");
+    close(fd);
+}
+
+bool KeyLog::start_recording(const std::string& path) {
+    record_file = fopen(path.c_str(), "w");
+    if (!record_file) return false;
+    fputs("# fm key log v1: <ms since previous key> <key code>\n", record_file);
+    last_key_ns = Profiler::now_ns();
+    return true;
+}
+
+bool KeyLog::load(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) return false;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        long long delay;
+        int key;
+        if (sscanf(line.c_str(), "%lld %d", &delay, &key) != 2) return false;
+        events.push_back({delay, key});
+    }
+    return true;
+}
+
+void KeyLog::start_replay(int fd, bool fast) {
+    // Keys this terminal has no sequence for (KEY_RESIZE, say) are
+    // dropped, their delay carried over to the next key.
+    std::vector<Event> kept;
+    int64_t carried = 0;
+    for (Event& event : events) {
+        if (key_bytes(event.key).empty()) {
+            carried += event.delay_ms;
+            continue;
+        }
+        const char* name = keyname(event.key);
+        event.name = event.key == ' ' ? "SPACE" : name ? name : std::to_string(event.key);
+        event.delay_ms += carried;
+        carried = 0;
+        kept.push_back(std::move(event));
+    }
+    events.swap(kept);
+    written_ns.assign(events.size(), 0);
+    replaying = true;
+    feeder = std::thread(feed, fd, fast);
+}
+
+const std::vector<KeyLog::Event>& KeyLog::finish_replay() {
+    ready();    // a key that quit the program was handled by quitting
+    if (feeder.joinable()) feeder.join();
+    return events;
+}
+
+void KeyLog::stop_recording() {
+    if (record_file) fclose(record_file);
+    record_file = nullptr;
+}
+
+void KeyLog::ready() {
+    if (!replaying) return;
+    std::lock_guard<std::mutex> lock(replay_mtx);
+    if (handled == consumed) return;
+    int64_t now = Profiler::now_ns();
+    for (; handled < consumed; handled++) events[handled].latency_ms = (now - written_ns[handled]) / 1e6;
+    replay_cv.notify_all();
+}
+
+int KeyLog::read(WINDOW* win, bool waiting) {
+    if (waiting) ready();
+    int key = wgetch(win);
+    if (key == ERR) return key;
+    if (pushed_back > 0) {
+        pushed_back--;
+        return key;
+    }
+    if (record_file) {
+        // Advancing by the rounded delay keeps rounding errors from adding up.
+        int64_t delay_ms = (Profiler::now_ns() - last_key_ns) / 1000000;
+        fprintf(record_file, "%lld %d\n", static_cast<long long>(delay_ms), key);
+        last_key_ns += delay_ms * 1000000;
+    }
+    if (replaying) {
+        std::lock_guard<std::mutex> lock(replay_mtx);
+        if (consumed < events.size()) consumed++;
+    }
+    return key;
+}
+
+void KeyLog::unread(int key) {
+    ungetch(key);
+    pushed_back++;
+}
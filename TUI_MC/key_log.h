@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdio>
+#include <ncurses.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <unistd.h>
+
+// Records the keys the UI reads, with their timing, and replays such a log.
+// Every key goes through KeyLog::read. A log is one line per key: the
+// milliseconds since the previous key, then the ncurses key code. Replay
+// writes the keys into a pipe that ncurses reads as its terminal, either on
+// the recorded schedule or each one as soon as the previous one has been
+// handled. A key counts as handled once the UI waits for input again, and
+// the time that took is its latency.
+class KeyLog {
+public:
+    struct Event {
+        int64_t delay_ms = 0;      // since the previous key
+        int key = 0;
+        std::string name = {};     // filled in when the log is replayed
+        double latency_ms = -1;    // from being written to being handled
+    };
+
+private:
+    static inline FILE* record_file = nullptr;
+    static inline int64_t last_key_ns = 0;
+    static inline int pushed_back = 0;     // keys returned by ungetch, already seen once
+
+    static inline std::mutex replay_mtx;
+    static inline std::condition_variable replay_cv;
+    static inline std::vector<Event> events;
+    static inline std::vector<int64_t> written_ns;
+    static inline size_t consumed = 0;     // logged keys the UI has read
+    static inline size_t handled = 0;      // ... and finished handling
+    static inline bool replaying = false;
+    static inline std::atomic<bool> exhausted{false};
+    static inline std::thread feeder;
+
+    // The bytes a terminal sends for `key`, empty if it has none.
+    static std::string key_bytes(int key);
+    static void write_all(int fd, const std::string& bytes);
+    static void feed(int fd, bool fast);
+
+public:
+    static bool start_recording(const std::string& path);
+
+    // Loads a recorded log; returns false if it cannot be read.
+    static bool load(const std::string& path);
+
+    // Starts writing the loaded keys into `fd`, the write end of the pipe
+    // ncurses reads from. Must be called after the terminal is set up.
+    static void start_replay(int fd, bool fast);
+
+    // True once every logged key has been handled.
+    static bool replay_done() { return exhausted; }
+
+    // Waits for the feeder and returns the replayed events with their latencies.
+    static const std::vector<Event>& finish_replay();
+    static void stop_recording();
+
+    // The UI is about to wait for input: every key it has read so far is handled.
+    static void ready();
+
+    // wgetch that logs what it returns. `waiting` is false for the main
+    // loop's non-blocking drain, which handles the keys only afterwards.
+    static int read(WINDOW* win, bool waiting = true);
+
+    // ungetch for a key that was already read (and logged) once.
+    static void unread(int key);
+};
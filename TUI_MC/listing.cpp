@@ -0,0 +1,375 @@
+#include "listing.h"
+
+#include <string_view>
+#include <locale.h>
+#include <cstring>
+#include <cwchar>
+#include <cwctype>
+#include <climits>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+long FuzzyFilter::find(const char* hay, size_t len, const char* needle, size_t n) {
+    if (n == 0) return 0;
+    if (n > len) return -1;
+#ifdef __SSE2__
+    if (n <= MAX_SIMD_QUERY) {
+        const __m128i first = _mm_set1_epi8(needle[0]);
+        const __m128i last = _mm_set1_epi8(needle[n - 1]);
+        for (size_t i = 0; i + n <= len; i += 16) {
+            __m128i block_first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hay + i));
+            __m128i block_last = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hay + i + n - 1));
+            unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(block_first, first),
+                                                            _mm_cmpeq_epi8(block_last, last)));
+            size_t valid = len - n - i + 1;
+            if (valid < 16) mask &= (1u << valid) - 1;
+            while (mask) {
+                size_t at = i + __builtin_ctz(mask);
+                if (n <= 2 || memcmp(hay + at + 1, needle + 1, n - 2) == 0) return at;
+                mask &= mask - 1;
+            }
+        }
+        return -1;
+    }
+#endif
+    const void* hit = memmem(hay, len, needle, n);
+    return hit ? static_cast<const char*>(hit) - hay : -1;
+}
+
+long FuzzyFilter::subsequence_span(const char* hay, size_t len, const char* needle, size_t n) {
+    size_t pos = 0;
+    long start = -1;
+    for (size_t k = 0; k < n; k++) {
+        const void* hit = memchr(hay + pos, needle[k], len - pos);
+        if (!hit) return -1;
+        size_t at = static_cast<const char*>(hit) - hay;
+        if (k == 0) start = at;
+        pos = at + 1;
+    }
+    return static_cast<long>(pos) - start;
+}
+
+bool FuzzyFilter::matches(uint32_t index, size_t n) const {
+    return subsequence_span(names.data() + offsets[index], lengths[index], query.data(), n) >= 0;
+}
+
+int FuzzyFilter::score(uint32_t index) const {
+    const char* name = names.data() + offsets[index];
+    size_t len = lengths[index];
+    size_t n = query.size();
+    int value;
+    long at = find(name, len, query.data(), n);
+    if (at >= 0) {
+        bool boundary = at == 0 || strchr("._- ", name[at - 1]) != nullptr;
+        value = 700 - static_cast<int>(std::min<long>(at, 100)) * 2 + (at == 0 ? 200 : boundary ? 100 : 0);
+    } else {
+        long gaps = subsequence_span(name, len, query.data(), n) - static_cast<long>(n);
+        value = 450 - static_cast<int>(std::min<long>(gaps, 100)) * 4;
+    }
+    value -= static_cast<int>(std::min<size_t>(len - std::min(len, n), 100));
+    return std::max(0, std::min(SCORE_BUCKETS - 1, value));
+}
+
+void FuzzyFilter::rank() {
+    ranking.clear();
+    if (query.empty()) return;
+    const auto& found = levels.back();
+    std::vector<uint16_t> scores(found.size());
+    std::vector<uint32_t> start(SCORE_BUCKETS, 0);
+    for (size_t i = 0; i < found.size(); i++) {
+        scores[i] = score(found[i]);
+        start[SCORE_BUCKETS - 1 - scores[i]]++;
+    }
+    uint32_t sum = 0;
+    for (auto& bucket : start) {
+        uint32_t count = bucket;
+        bucket = sum;
+        sum += count;
+    }
+    ranking.resize(found.size());
+    for (size_t i = 0; i < found.size(); i++) {
+        ranking[start[SCORE_BUCKETS - 1 - scores[i]]++] = found[i];
+    }
+}
+
+void FuzzyFilter::clear() {
+    names.clear();
+    offsets.clear();
+    lengths.clear();
+    levels.assign(query.size(), {});
+    ranking.clear();
+}
+
+void FuzzyFilter::add_names(const DirectoryListing& list) {
+    size_t first = offsets.size();
+    if (first >= list.size()) return;
+    if (names.size() >= PADDING) names.resize(names.size() - PADDING);
+    for (size_t i = first; i < list.size(); i++) {
+        std::string_view name = list.name(i);
+        offsets.push_back(names.size());
+        lengths.push_back(name.size());
+        for (char c : name) names.push_back(static_cast<char>(tolower(static_cast<unsigned char>(c))));
+        names.push_back('\0');
+    }
+    names.append(PADDING, '\0');
+
+    for (uint32_t i = first; i < offsets.size(); i++) {
+        for (size_t k = 0; k < levels.size() && matches(i, k + 1); k++) levels[k].push_back(i);
+    }
+    rank();
+}
+
+void FuzzyFilter::set_query(const std::string& text) {
+    std::string lowered;
+    for (char c : text) lowered.push_back(static_cast<char>(tolower(static_cast<unsigned char>(c))));
+    size_t common = 0;
+    while (common < query.size() && common < lowered.size() && query[common] == lowered[common]) common++;
+    levels.resize(std::min(levels.size(), common));
+    query = lowered;
+    for (size_t k = levels.size(); k < query.size(); k++) {
+        std::vector<uint32_t> next;
+        if (k == 0) {
+            for (uint32_t i = 0; i < offsets.size(); i++) {
+                if (matches(i, 1)) next.push_back(i);
+            }
+        } else {
+            for (uint32_t i : levels[k - 1]) {
+                if (matches(i, k + 1)) next.push_back(i);
+            }
+        }
+        levels.push_back(std::move(next));
+    }
+    rank();
+}
+
+void ListingSorter::append_collated(std::string& out, const std::string& text) {
+    if (collation().empty()) {
+        out += text;
+        return;
+    }
+    size_t at = out.size();
+    size_t room = 4 * text.size() + 16;
+    while (true) {
+        out.resize(at + room);
+        size_t n = strxfrm(&out[at], text.c_str(), room);
+        if (n < room) {
+            out.resize(at + n);
+            return;
+        }
+        room = n + 1;
+    }
+}
+
+void ListingSorter::append_natural(std::string& out, const char* name, size_t len) {
+    mbstate_t state{};
+    static thread_local std::string run;    // folded characters since the last digit run
+    run.clear();
+    size_t i = 0;
+    while (i < len) {
+        if (name[i] >= '0' && name[i] <= '9') {
+            append_collated(out, run);
+            run.clear();
+            size_t end = i;
+            while (end < len && name[end] >= '0' && name[end] <= '9') end++;
+            while (i + 1 < end && name[i] == '0') i++;
+            if (end - i <= UCHAR_MAX) {
+                out.push_back('0');
+                out.push_back(static_cast<char>(end - i));
+            }
+            out.append(name + i, end - i);
+            i = end;
+            continue;
+        }
+        wchar_t wc;
+        size_t n = mbrtowc(&wc, name + i, len - i, &state);
+        if (n == 0 || n > len - i) {
+            // Not valid in this locale: keep the byte as it is.
+            run.push_back(name[i++]);
+            state = mbstate_t{};
+            continue;
+        }
+        char folded[MB_LEN_MAX];
+        mbstate_t fold_state{};
+        size_t m = wcrtomb(folded, towlower(wc), &fold_state);
+        if (m == static_cast<size_t>(-1)) run.append(name + i, n);
+        else run.append(folded, m);
+        i += n;
+    }
+    append_collated(out, run);
+}
+
+void ListingSorter::make_keys(DirectoryListing& list, size_t first, size_t last, int dir_fd,
+                              std::vector<Key>& out, std::string& text) const {
+    for (size_t i = first; i < last; i++) {
+        std::string_view name = list.name(i);
+
+        Key key{};
+        key.index = i;
+        key.text = text.size();
+        if (sort_mode == EXTENSION) {
+            size_t dot = name.rfind('.');
+            if (dot != std::string::npos && dot > 0) {
+                append_natural(text, name.data() + dot + 1, name.size() - dot - 1);
+            }
+            text.push_back('\0');
+        }
+        append_natural(text, name.data(), name.size());
+        text.push_back('\0');
+        text.append(name.data(), name.size());   // names equal after folding fall back to bytes
+        key.length = text.size() - key.text;
+        for (size_t k = 0; k < 8; k++) {
+            unsigned char c = k < key.length ? text[key.text + k] : 0;
+            key.prefix = key.prefix << 8 | c;
+        }
+
+        if (sort_mode == SIZE || sort_mode == MTIME) {
+            if (!list.has_stat(i)) {
+                FileMeta meta = MetadataCache::fetch(dir_fd, list.c_name(i));
+                if (meta.valid) {
+                    list.set_stat(i, meta.mode, meta.size, meta.mtime_sec * 1000000000ll + meta.mtime_nsec);
+                }
+            }
+            // Largest and newest first.
+            key.primary = sort_mode == SIZE ? ~list.file_size(i) : ~static_cast<uint64_t>(list.mtime(i));
+        }
+        out.push_back(key);
+    }
+}
+
+std::vector<ListingSorter::Key> ListingSorter::extract(DirectoryListing& list, size_t first, size_t last, int dir_fd, WorkStealingPool* pool) {
+    size_t count = last - first;
+    size_t chunks = (count + KEY_CHUNK - 1) / KEY_CHUNK;
+    std::vector<std::vector<Key>> chunk_keys(chunks);
+    std::vector<std::string> chunk_text(chunks);
+    auto build = [&](size_t c) {
+        size_t begin = first + c * KEY_CHUNK;
+        chunk_keys[c].reserve(KEY_CHUNK);
+        make_keys(list, begin, std::min(last, begin + KEY_CHUNK), dir_fd, chunk_keys[c], chunk_text[c]);
+    };
+    if (pool && chunks > 1) {
+        TaskGroup group;
+        for (size_t c = 0; c < chunks; c++) pool->submit(group, [&build, c] { build(c); });
+        group.wait();
+    } else {
+        for (size_t c = 0; c < chunks; c++) build(c);
+    }
+
+    std::vector<Key> out;
+    out.reserve(count);
+    for (size_t c = 0; c < chunks; c++) {
+        uint32_t base = arena.size();
+        arena += chunk_text[c];
+        for (Key key : chunk_keys[c]) {
+            key.text += base;
+            out.push_back(key);
+        }
+    }
+    return out;
+}
+
+bool ListingSorter::less(const Key& a, const Key& b) const {
+    if (a.primary != b.primary) return a.primary < b.primary;
+    if (a.prefix != b.prefix) return a.prefix < b.prefix;
+    int order = memcmp(arena.data() + a.text, arena.data() + b.text, std::min(a.length, b.length));
+    if (order != 0) return order < 0;
+    if (a.length != b.length) return a.length < b.length;
+    return a.index < b.index;
+}
+
+const std::string& ListingSorter::collation() {
+    static const std::string name = [] {
+        const char* current = setlocale(LC_COLLATE, nullptr);
+        std::string locale = current ? current : "C";
+        return locale == "C" || locale == "POSIX" || locale.rfind("C.", 0) == 0 ? std::string() : locale;
+    }();
+    return name;
+}
+
+const char* ListingSorter::mode_name() const {
+    static const char* names[] = {"name", "extension", "size", "time"};
+    return names[sort_mode];
+}
+
+void ListingSorter::set_mode(Mode mode) {
+    reversed = mode == sort_mode ? !reversed : false;
+    sort_mode = mode;
+    clear();
+}
+
+void ListingSorter::clear() {
+    keys.clear();
+    arena.clear();
+    presorted = 0;
+}
+
+void ListingSorter::assume_sorted(size_t count) {
+    clear();
+    presorted = count;
+}
+
+void ListingSorter::retain(const std::vector<char>& alive) {
+    if (presorted) presorted = std::count(alive.begin(), alive.begin() + presorted, 1);
+    size_t out = 0;
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (!alive[i]) continue;
+        keys[out] = keys[i];
+        keys[out].index = out;
+        out++;
+    }
+    keys.resize(out);
+    if (keys.empty()) arena.clear();
+}
+
+void ListingSorter::merge(DirectoryListing& list, int dir_fd, WorkStealingPool* pool, std::vector<uint32_t>& moved) {
+    moved.resize(list.size());
+    size_t middle = size();
+    if (middle == list.size()) {
+        for (size_t i = 0; i < moved.size(); i++) moved[i] = i;
+        return;
+    }
+    if (keys.size() < presorted) {
+        std::vector<Key> prefix = extract(list, keys.size(), presorted, dir_fd, pool);
+        keys.insert(keys.end(), prefix.begin(), prefix.end());
+        presorted = 0;
+    }
+
+    auto compare = [this](const Key& a, const Key& b) { return reversed ? less(b, a) : less(a, b); };
+    std::vector<Key> added = extract(list, middle, list.size(), dir_fd, pool);
+    sort_keys(added, pool, compare);
+    keys.insert(keys.end(), added.begin(), added.end());
+    std::inplace_merge(keys.begin(), keys.begin() + middle, keys.end(), compare);
+
+    std::vector<uint32_t> order(keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        order[i] = keys[i].index;
+        moved[keys[i].index] = i;
+        keys[i].index = i;
+    }
+    list.permute(order);
+}
+
+void ListingCache::erase(std::list<Entry>::iterator it) {
+    used -= it->bytes;
+    index.erase(Key(it->dev, it->ino));
+    entries.erase(it);
+}
+
+void ListingCache::put(Entry entry) {
+    auto found = index.find(Key(entry.dev, entry.ino));
+    if (found != index.end()) erase(found->second);
+    entry.bytes = entry.listing.memory_usage() + entry.sorter.memory_usage();
+    if (entry.bytes > budget) return;
+    used += entry.bytes;
+    entries.push_front(std::move(entry));
+    index[Key(entries.front().dev, entries.front().ino)] = entries.begin();
+    while (used > budget) erase(std::prev(entries.end()));
+}
+
+bool ListingCache::take(uint64_t dev, uint64_t ino, Entry& out) {
+    auto found = index.find(Key(dev, ino));
+    if (found == index.end()) return false;
+    out = std::move(*found->second);
+    erase(found->second);
+    return true;
+}
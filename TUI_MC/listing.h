@@ -0,0 +1,217 @@
+#pragma once
+
+#include "directory.h"
+#include "thread_pool.h"
+
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <algorithm>
+
+// Incremental fuzzy filter over the names of a listing. Names are packed
+// lower-cased into one contiguous buffer. A name matches if the query occurs
+// in it as a subsequence; an exact substring ranks higher, and earlier,
+// word-boundary and tighter matches rank higher still. Matches for every
+// prefix of the query are kept, so typing a character only re-tests the
+// previous matches and backspace is free.
+class FuzzyFilter {
+private:
+    static constexpr size_t PADDING = 64;          // lets SIMD loads run past the last name
+    static constexpr size_t MAX_SIMD_QUERY = 48;
+    static constexpr int SCORE_BUCKETS = 1024;
+
+    std::string names;                   // lower-cased names, '\0'-separated, plus PADDING
+    std::vector<uint32_t> offsets;       // start of each name in `names`
+    std::vector<uint16_t> lengths;
+    std::string query;
+    std::vector<std::vector<uint32_t>> levels;   // levels[k]: matches of query[0..k]
+    std::vector<uint32_t> ranking;
+
+    // Position of `needle` in `hay`, or -1. Compares the first and last needle
+    // byte against 16 candidate positions at once and verifies the hits.
+    static long find(const char* hay, size_t len, const char* needle, size_t n);
+
+    // Span covered by the leftmost subsequence match, or -1.
+    static long subsequence_span(const char* hay, size_t len, const char* needle, size_t n);
+    bool matches(uint32_t index, size_t n) const;
+    int score(uint32_t index) const;
+
+    // Orders the final level by score with a counting sort, so ranking a
+    // million matches stays linear; ties keep listing order.
+    void rank();
+
+public:
+    bool active() const { return !query.empty(); }
+
+    const std::string& text() const { return query; }
+
+    size_t size() const { return offsets.size(); }
+
+    const std::vector<uint32_t>& results() const { return ranking; }
+
+    // Drops the packed names but keeps the query, so names added afterwards
+    // are filtered against it.
+    void clear();
+
+    // Packs list[size()..] and runs the new names through every query level.
+    void add_names(const DirectoryListing& list);
+
+    // Re-filters only from the longest prefix shared with the previous query.
+    void set_query(const std::string& text);
+};
+
+// Orders the listing by name, extension, size or modification time. Keys are
+// extracted once per entry into a compact array (a numeric primary key, the
+// first 8 bytes of the name key and its offset in a shared arena), so the
+// comparator never touches fs::path. Entries appended later are sorted on
+// their own and merged into the already sorted prefix.
+class ListingSorter {
+public:
+    enum Mode { NAME, EXTENSION, SIZE, MTIME };
+
+    static constexpr size_t PARALLEL_MIN = 65536;
+
+private:
+    static constexpr size_t KEY_CHUNK = 16384;
+
+    struct Key {
+        uint64_t primary;
+        uint64_t prefix;        // first 8 bytes of the text key, big-endian
+        uint32_t text;          // text key in `arena`
+        uint32_t length;
+        uint32_t index;         // list position the key was made for
+    };
+
+    Mode sort_mode = NAME;
+    bool reversed = false;
+    std::vector<Key> keys;      // keys[i] describes list[i] for the sorted prefix
+    std::string arena;
+    size_t presorted = 0;       // list[0, presorted) is known to be in order but has no keys yet
+
+    // Appends the collation key of `text`, a run without digits, for the
+    // LC_COLLATE locale: byte order of its strxfrm output is strcoll order.
+    static void append_collated(std::string& out, const std::string& text);
+
+    // Case-insensitive natural key in the collation order of the current
+    // locale: characters are folded with towlower, each run of them is
+    // collated on its own, and every digit run becomes its significant-digit
+    // count followed by the digits, so "file9" sorts before "file10".
+    static void append_natural(std::string& out, const char* name, size_t len);
+
+    // Keys for list[first, last), with their text in a chunk-local arena.
+    void make_keys(DirectoryListing& list, size_t first, size_t last, int dir_fd,
+                   std::vector<Key>& out, std::string& text) const;
+
+    // Keys for list[first, last), built in chunks on the pool when there are
+    // many (for size and time this is also where every entry gets its statx).
+    std::vector<Key> extract(DirectoryListing& list, size_t first, size_t last, int dir_fd, WorkStealingPool* pool);
+    bool less(const Key& a, const Key& b) const;
+
+    // Sorts big arrays as one slice per worker followed by rounds of
+    // pairwise merges, each round running its merges in parallel.
+    template <typename Compare>
+    void sort_keys(std::vector<Key>& items, WorkStealingPool* pool, Compare compare) {
+        if (!pool || items.size() < PARALLEL_MIN) {
+            std::sort(items.begin(), items.end(), compare);
+            return;
+        }
+        size_t parts = pool->size();
+        std::vector<size_t> bounds;
+        for (size_t p = 0; p <= parts; p++) bounds.push_back(items.size() * p / parts);
+
+        TaskGroup group;
+        for (size_t p = 0; p < parts; p++) {
+            pool->submit(group, [&, p] {
+                std::sort(items.begin() + bounds[p], items.begin() + bounds[p + 1], compare);
+            });
+        }
+        group.wait();
+
+        for (size_t width = 1; width < parts; width *= 2) {
+            TaskGroup round;
+            for (size_t p = 0; p + width < parts; p += 2 * width) {
+                size_t lo = bounds[p], mid = bounds[p + width], hi = bounds[std::min(parts, p + 2 * width)];
+                pool->submit(round, [&items, lo, mid, hi, &compare] {
+                    std::inplace_merge(items.begin() + lo, items.begin() + mid, items.begin() + hi, compare);
+                });
+            }
+            round.wait();
+        }
+    }
+
+public:
+    // The LC_COLLATE locale names are collated in, or "" where that is code
+    // point order anyway (C, POSIX, C.UTF-8) and keys skip strxfrm. Read
+    // once, after main() has called setlocale.
+    static const std::string& collation();
+
+    Mode mode() const { return sort_mode; }
+
+    bool is_reversed() const { return reversed; }
+
+    const char* mode_name() const;
+
+    // Number of entries at the front of the list that are in sorted order.
+    size_t size() const { return std::max(keys.size(), presorted); }
+
+    size_t memory_usage() const { return keys.capacity() * sizeof(Key) + arena.capacity(); }
+
+    // Switches to `mode`; choosing the current mode again flips the order.
+    // The next merge re-sorts the whole list.
+    void set_mode(Mode mode);
+    void clear();
+
+    // Takes the first `count` entries of the list as already in order for
+    // the current mode, as a listing read back from the index is. Their keys
+    // are only made once new entries have to be merged in.
+    void assume_sorted(size_t count);
+
+    // Drops the keys of entries removed from the list; `alive` is indexed by
+    // list position and the list is compacted the same way by the caller.
+    void retain(const std::vector<char>& alive);
+
+    // Sorts list[size()..] and merges it into the sorted prefix, reordering
+    // `list`. moved[i] receives the new position of the entry at list[i].
+    void merge(DirectoryListing& list, int dir_fd, WorkStealingPool* pool, std::vector<uint32_t>& moved);
+};
+
+// Recently visited directories, so going back to a parent or sibling shows
+// its listing at once. Entries are keyed by the directory's (dev, ino) and
+// remember the mtime they were read at; when the estimated size of all
+// entries exceeds the budget the least recently used ones are dropped.
+class ListingCache {
+public:
+    struct Entry {
+        uint64_t dev = 0;
+        uint64_t ino = 0;
+        int64_t mtime = 0;
+        DirectoryListing listing;
+        ListingSorter sorter;
+        size_t bytes = 0;
+    };
+
+private:
+    using Key = std::pair<uint64_t, uint64_t>;
+
+    size_t budget;
+    size_t used = 0;
+    std::list<Entry> entries;           // most recently used first
+    std::map<Key, std::list<Entry>::iterator> index;
+
+    void erase(std::list<Entry>::iterator it);
+
+public:
+    explicit ListingCache(size_t budget_bytes = 256 << 20) : budget(budget_bytes) {}
+
+    void put(Entry entry);
+
+    template <typename Visit>
+    void for_each(Visit visit) const {
+        for (const Entry& entry : entries) visit(entry);
+    }
+
+    // Moves the entry for (dev, ino) out of the cache into `out`.
+    bool take(uint64_t dev, uint64_t ino, Entry& out);
+};
@@ -0,0 +1,310 @@
+#include "pager.h"
+#include "key_log.h"
+
+#include <cstdio>
+#include <algorithm>
+#include <cstring>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+void Pager::build_index() {
+    uint64_t line = 0;
+    std::vector<uint64_t> local;
+    for (uint64_t begin = 0; begin < size && !stop_indexing; begin += INDEX_CHUNK) {
+        uint64_t end = std::min(size, begin + INDEX_CHUNK);
+        scan_newlines(begin, end, [&](uint64_t pos) {
+            if (++line % LINE_STRIDE == 0 && pos + 1 < size) local.push_back(pos + 1);
+        });
+        {
+            std::lock_guard<std::mutex> lock(index_mtx);
+            checkpoints.insert(checkpoints.end(), local.begin(), local.end());
+        }
+        local.clear();
+        indexed_lines = line;
+        indexed_bytes = end;
+    }
+    index_done = !stop_indexing;
+}
+
+uint64_t Pager::next_line(uint64_t pos) const {
+    const void* hit = memchr(data + pos, '\n', size - pos);
+    return hit ? static_cast<const char*>(hit) - data + 1 : size;
+}
+
+uint64_t Pager::line_start(uint64_t pos) const {
+    if (pos == 0) return 0;
+    const void* hit = memrchr(data, '\n', pos);
+    return hit ? static_cast<const char*>(hit) - data + 1 : 0;
+}
+
+uint64_t Pager::prev_line(uint64_t pos) const {
+    return pos == 0 ? 0 : line_start(pos - 1);
+}
+
+uint64_t Pager::step(uint64_t pos, long lines) const {
+    if (hex) {
+        long long target = static_cast<long long>(pos) + lines * HEX_WIDTH;
+        uint64_t last = size ? (size - 1) / HEX_WIDTH * HEX_WIDTH : 0;
+        return std::min<uint64_t>(std::max(0LL, target), last);
+    }
+    for (; lines > 0 && pos < size; lines--) {
+        uint64_t next = next_line(pos);
+        if (next >= size) break;
+        pos = next;
+    }
+    for (; lines < 0 && pos > 0; lines++) pos = prev_line(pos);
+    return pos;
+}
+
+uint64_t Pager::last_page(int rows) const {
+    if (hex) return step(size ? (size - 1) / HEX_WIDTH * HEX_WIDTH : 0, -(rows - 1));
+    uint64_t end = size;
+    if (end > 0 && data[end - 1] == '\n') end--;
+    return step(line_start(end), -(rows - 1));
+}
+
+bool Pager::line_number(uint64_t pos, uint64_t& number) const {
+    if (pos > indexed_bytes) return false;
+    std::lock_guard<std::mutex> lock(index_mtx);
+    auto it = std::upper_bound(checkpoints.begin(), checkpoints.end(), pos);
+    uint64_t base = it == checkpoints.begin() ? 0 : *(it - 1);
+    number = static_cast<uint64_t>(it - checkpoints.begin()) * LINE_STRIDE;
+    scan_newlines(base, pos, [&](uint64_t) { number++; });
+    return true;
+}
+
+bool Pager::find_line(uint64_t number, uint64_t& pos) const {
+    if (number > indexed_lines && !index_done) return false;
+    uint64_t slot = number / LINE_STRIDE;
+    {
+        std::lock_guard<std::mutex> lock(index_mtx);
+        if (slot > checkpoints.size()) return false;
+        pos = slot == 0 ? 0 : checkpoints[slot - 1];
+    }
+    for (uint64_t n = slot * LINE_STRIDE; n < number && pos < size; n++) pos = next_line(pos);
+    pos = std::min(pos, size ? line_start(size - 1) : 0);
+    return true;
+}
+
+void Pager::draw_text(WINDOW* win, int rows, int cols) const {
+    std::string row;
+    uint64_t pos = top;
+    for (int r = 0; r < rows && pos < size; r++) {
+        uint64_t end = next_line(pos);
+        uint64_t stop = end > pos && data[end - 1] == '\n' ? end - 1 : end;
+        row.clear();
+        uint64_t visual = 0;
+        for (uint64_t i = pos; i < stop && row.size() < static_cast<size_t>(cols); i++) {
+            unsigned char c = data[i];
+            int width = c == '\t' ? 8 - visual % 8 : 1;
+            for (int k = 0; k < width; k++, visual++) {
+                if (visual < column) continue;
+                if (row.size() >= static_cast<size_t>(cols)) break;
+                row.push_back(c == '\t' ? ' ' : (c < 32 || c == 127 ? '.' : c));
+            }
+        }
+        if (pos == marked) {
+            wattron(win, A_REVERSE);
+            mvwhline(win, r, 0, ' ', cols);
+        }
+        mvwaddnstr(win, r, 0, row.c_str(), cols);
+        if (pos == marked) wattroff(win, A_REVERSE);
+        pos = end;
+    }
+}
+
+void Pager::draw_hex(WINDOW* win, int rows, int cols) const {
+    char line[128];
+    for (int r = 0; r < rows; r++) {
+        uint64_t pos = top + static_cast<uint64_t>(r) * HEX_WIDTH;
+        if (pos >= size) break;
+        int len = snprintf(line, sizeof(line), "%010llx  ", static_cast<unsigned long long>(pos));
+        for (int i = 0; i < HEX_WIDTH; i++) {
+            if (pos + i < size) {
+                len += snprintf(line + len, sizeof(line) - len, "%02x ", static_cast<unsigned char>(data[pos + i]));
+            } else {
+                len += snprintf(line + len, sizeof(line) - len, "   ");
+            }
+            if (i == 7) line[len++] = ' ';
+        }
+        line[len++] = '|';
+        for (int i = 0; i < HEX_WIDTH && pos + i < size; i++) {
+            unsigned char c = data[pos + i];
+            line[len++] = c >= 32 && c < 127 ? c : '.';
+        }
+        line[len++] = '|';
+        line[len] = '\0';
+        mvwaddnstr(win, r, 0, line, cols);
+    }
+}
+
+void Pager::draw(WINDOW* win) {
+    int rows, cols;
+    getmaxyx(win, rows, cols);
+    rows--;
+    werase(win);
+    if (hex) {
+        draw_hex(win, rows, cols);
+    } else {
+        draw_text(win, rows, cols);
+    }
+
+    std::string bar = name + "  ";
+    uint64_t number;
+    if (!hex && line_number(top, number)) {
+        bar += "line " + std::to_string(number + 1);
+    } else {
+        bar += "offset " + std::to_string(top);
+    }
+    bar += "  " + std::to_string(size ? top * 100 / size : 100) + "%";
+    if (!index_done) {
+        bar += "  indexing " + std::to_string(size ? indexed_bytes * 100 / size : 100) + "%";
+    } else {
+        bar += "  " + std::to_string(indexed_lines) + " lines";
+    }
+    bar += hex ? "  [hex]" : "";
+    bar += status.empty() ? "  q:close :N line G:end x:hex" : "  " + status;
+    wattron(win, A_REVERSE);
+    mvwhline(win, rows, 0, ' ', cols);
+    mvwaddnstr(win, rows, 0, bar.c_str(), cols);
+    wattroff(win, A_REVERSE);
+    wrefresh(win);
+}
+
+void Pager::jump_to_line(WINDOW* win) {
+    int rows, cols;
+    getmaxyx(win, rows, cols);
+    std::string digits;
+    wtimeout(win, -1);
+    while (true) {
+        std::string prompt = "Go to line: " + digits;
+        wattron(win, A_REVERSE);
+        mvwhline(win, rows - 1, 0, ' ', cols);
+        mvwaddnstr(win, rows - 1, 0, prompt.c_str(), cols);
+        wattroff(win, A_REVERSE);
+        wrefresh(win);
+        int ch = KeyLog::read(win);
+        if (ch == 27) return;
+        if (ch == '\n' || ch == KEY_ENTER) break;
+        if ((ch == KEY_BACKSPACE || ch == 127 || ch == 8) && !digits.empty()) digits.pop_back();
+        if (ch >= '0' && ch <= '9' && digits.size() < 18) digits.push_back(static_cast<char>(ch));
+    }
+    if (digits.empty()) return;
+    seek_line(win, std::max<uint64_t>(1, std::stoull(digits)) - 1);
+}
+
+bool Pager::seek_line(WINDOW* win, uint64_t number) {
+    wtimeout(win, 100);
+    uint64_t pos;
+    while (!find_line(number, pos)) {
+        status = "waiting for index...";
+        draw(win);
+        if (KeyLog::read(win) == 27) {
+            status.clear();
+            return false;
+        }
+    }
+    status.clear();
+    hex = false;
+    top = pos;
+    return true;
+}
+
+Pager::Pager(const fs::path& file)
+    : Pager(open(file.c_str(), O_RDONLY | O_CLOEXEC), 0, UINT64_MAX, file.filename().string()) {}
+
+Pager::Pager(int descriptor, uint64_t offset, uint64_t length, std::string title) : fd(descriptor), name(std::move(title)) {
+    if (fd < 0) {
+        index_done = true;
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        fd = -1;
+        index_done = true;
+        return;
+    }
+    uint64_t available = static_cast<uint64_t>(st.st_size) > offset ? st.st_size - offset : 0;
+    length = std::min(length, available);
+    if (length > 0) {
+        // mmap wants a page-aligned offset; the bytes before `offset` are mapped but never shown.
+        uint64_t lead = offset % sysconf(_SC_PAGESIZE);
+        void* mapping = mmap(nullptr, length + lead, PROT_READ, MAP_PRIVATE, fd, offset - lead);
+        if (mapping != MAP_FAILED) {
+            mapped = mapping;
+            mapped_size = length + lead;
+            data = static_cast<const char*>(mapping) + lead;
+            size = length;
+        }
+    }
+    if (data) {
+        indexer = std::thread(&Pager::build_index, this);
+    } else {
+        index_done = true;
+    }
+}
+
+Pager::~Pager() {
+    stop_indexing = true;
+    if (indexer.joinable()) indexer.join();
+    if (mapped) munmap(mapped, mapped_size);
+    if (fd >= 0) close(fd);
+}
+
+void Pager::run() {
+    WINDOW* win = newwin(0, 0, 0, 0);
+    keypad(win, TRUE);
+    if (start_line > 0 && seek_line(win, start_line - 1)) {
+        marked = top;
+        top = step(top, -std::min(3, getmaxy(win) / 3));
+    }
+    while (true) {
+        int rows = getmaxy(win) - 1;
+        draw(win);
+        // Keep the indexing percentage moving while idle.
+        wtimeout(win, index_done ? -1 : 250);
+        int ch = KeyLog::read(win);
+        switch (ch) {
+            case KEY_DOWN: case 'j':
+                top = step(top, 1);
+                break;
+            case KEY_UP: case 'k':
+                top = step(top, -1);
+                break;
+            case KEY_NPAGE: case ' ':
+                top = std::min(step(top, rows), std::max(top, last_page(rows)));
+                break;
+            case KEY_PPAGE: case 'b':
+                top = step(top, -rows);
+                break;
+            case KEY_RIGHT:
+                column += 8;
+                break;
+            case KEY_LEFT:
+                column = column >= 8 ? column - 8 : 0;
+                break;
+            case KEY_HOME: case 'g':
+                top = 0;
+                column = 0;
+                break;
+            case KEY_END: case 'G':
+                top = last_page(rows);
+                break;
+            case 'x':
+                hex = !hex;
+                top = hex ? top / HEX_WIDTH * HEX_WIDTH : line_start(top);
+                break;
+            case ':':
+                jump_to_line(win);
+                break;
+            case 'q': case 27:
+                delwin(win);
+                return;
+            default:
+                break;
+        }
+    }
+}
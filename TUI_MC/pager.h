@@ -0,0 +1,109 @@
+#pragma once
+
+#include <filesystem>
+#include <ncurses.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <climits>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace fs = std::filesystem;
+
+// Full-screen viewer over a memory-mapped file. Nothing is read up front:
+// the first page is drawn straight from the mapping, and moving by lines or
+// jumping to the end searches for newlines around the current position only.
+// A background thread builds a sparse line index (every LINE_STRIDE-th line
+// start) with a vectorized newline scan, which is what jump-to-line uses.
+class Pager {
+private:
+    static constexpr uint64_t LINE_STRIDE = 128;
+    static constexpr size_t INDEX_CHUNK = 4 * 1024 * 1024;
+    static constexpr int HEX_WIDTH = 16;
+
+    int fd = -1;
+    void* mapped = nullptr;
+    size_t mapped_size = 0;
+    const char* data = nullptr;     // the part of the mapping on show
+    uint64_t size = 0;
+    std::string name;
+
+    std::thread indexer;
+    std::atomic<bool> stop_indexing{false};
+    std::atomic<bool> index_done{false};
+    std::atomic<uint64_t> indexed_bytes{0};
+    std::atomic<uint64_t> indexed_lines{0};
+    mutable std::mutex index_mtx;
+    std::vector<uint64_t> checkpoints;   // checkpoints[k] = start of line k * LINE_STRIDE
+
+    uint64_t top = 0;        // byte offset of the first visible row
+    uint64_t column = 0;     // horizontal scroll in text mode
+    bool hex = false;
+    std::string status;
+    uint64_t start_line = 0;           // 1-based line to open at, 0 for the top
+    uint64_t marked = UINT64_MAX;      // start of a highlighted line
+
+    // Calls `found(offset)` for every '\n' in data[begin, end).
+    template <typename Callback>
+    void scan_newlines(uint64_t begin, uint64_t end, Callback found) const {
+        uint64_t pos = begin;
+#ifdef __SSE2__
+        const __m128i newline = _mm_set1_epi8('\n');
+        for (; pos + 16 <= end; pos += 16) {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+            unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, newline));
+            while (mask) {
+                found(pos + __builtin_ctz(mask));
+                mask &= mask - 1;
+            }
+        }
+#endif
+        for (; pos < end; pos++) {
+            if (data[pos] == '\n') found(pos);
+        }
+    }
+
+    void build_index();
+    uint64_t next_line(uint64_t pos) const;
+    uint64_t line_start(uint64_t pos) const;
+    uint64_t prev_line(uint64_t pos) const;
+    uint64_t step(uint64_t pos, long lines) const;
+
+    // Offset of the first row that still fills the last page.
+    uint64_t last_page(int rows) const;
+
+    // Line number (0-based) of the line starting at `pos`, if the index already covers it.
+    bool line_number(uint64_t pos, uint64_t& number) const;
+
+    // Start of 0-based line `number`, if the index already reaches it.
+    bool find_line(uint64_t number, uint64_t& pos) const;
+    void draw_text(WINDOW* win, int rows, int cols) const;
+    void draw_hex(WINDOW* win, int rows, int cols) const;
+    void draw(WINDOW* win);
+
+    // Reads a line number on the status bar and jumps to it once the index
+    // reaches it; ESC gives up waiting.
+    void jump_to_line(WINDOW* win);
+
+    // Moves to 0-based line `number` once the index reaches it; ESC gives up.
+    bool seek_line(WINDOW* win, uint64_t number);
+
+public:
+    explicit Pager(const fs::path& file);
+
+    // Shows up to `length` bytes from `offset` on of the regular file open on
+    // `descriptor`, which the pager takes over, under the name `title`.
+    Pager(int descriptor, uint64_t offset, uint64_t length, std::string title);
+    ~Pager();
+
+    bool is_open() const { return fd >= 0; }
+
+    // Opens at 1-based `line`, highlighted, with a few lines of context above.
+    void show_line(uint64_t line) { start_line = line; }
+
+    void run();
+};
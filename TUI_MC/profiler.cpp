@@ -0,0 +1,109 @@
+#include "profiler.h"
+
+#include <cstdio>
+#include <algorithm>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+const char* Profiler::stage_name(Stage stage) {
+    static const char* const names[STAGE_COUNT] = {
+        "scan", "load_directory", "sort", "metadata", "frame", "input", "draw_menu", "draw_options",
+        "draw_info", "copy_file", "copy", "move", "delete", "chmod", "duplicates", "search", "preview", "index",
+        "archive"};
+    return names[stage];
+}
+
+const char* Profiler::counter_name(Counter counter) {
+    static const char* const names[COUNTER_COUNT] = {"getdents", "stat", "uring"};
+    return names[counter];
+}
+
+Profiler::ThreadStats& Profiler::local() {
+    thread_local ThreadStats* stats = [] {
+        auto created = std::make_unique<ThreadStats>();
+        created->tid = static_cast<int>(syscall(SYS_gettid));
+        if (tracing) created->spans.reset(new Span[TRACE_CAPACITY]);
+        std::lock_guard<std::mutex> lock(registry_mtx);
+        threads.push_back(std::move(created));
+        return threads.back().get();
+    }();
+    return *stats;
+}
+
+void Profiler::bump(std::atomic<uint64_t>& value, uint64_t amount) {
+    value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+int Profiler::bucket(uint64_t ns) {
+    if (ns < 4) return static_cast<int>(ns);
+    int exponent = 63 - __builtin_clzll(ns);
+    return (exponent - 1) * 4 + static_cast<int>((ns >> (exponent - 2)) & 3);
+}
+
+uint64_t Profiler::bucket_floor(int b) {
+    if (b < 4) return b;
+    int exponent = b / 4 + 1;
+    return static_cast<uint64_t>(4 | (b % 4)) << (exponent - 2);
+}
+
+int64_t Profiler::now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+void Profiler::record(Stage stage, int64_t start_ns, int64_t duration_ns) {
+    ThreadStats& stats = local();
+    bump(stats.buckets[stage][bucket(std::max<int64_t>(duration_ns, 0))]);
+    if (stats.spans) {
+        size_t count = stats.span_count.load(std::memory_order_relaxed);
+        if (count < TRACE_CAPACITY) {
+            stats.spans[count] = {static_cast<uint8_t>(stage), start_ns, duration_ns};
+            stats.span_count.store(count + 1, std::memory_order_release);
+        }
+    }
+}
+
+Profiler::Summary Profiler::summarize(Stage stage) {
+    uint64_t merged[BUCKETS] = {};
+    {
+        std::lock_guard<std::mutex> lock(registry_mtx);
+        for (const auto& stats : threads) {
+            for (int b = 0; b < BUCKETS; b++) merged[b] += stats->buckets[stage][b].load(std::memory_order_relaxed);
+        }
+    }
+    Summary summary;
+    for (uint64_t n : merged) summary.count += n;
+    uint64_t p50_rank = (summary.count + 1) / 2, p99_rank = (summary.count * 99 + 99) / 100, seen = 0;
+    for (int b = 0; b < BUCKETS && summary.count; b++) {
+        if (seen < p50_rank && seen + merged[b] >= p50_rank) summary.p50_ns = bucket_floor(b);
+        if (seen < p99_rank && seen + merged[b] >= p99_rank) summary.p99_ns = bucket_floor(b);
+        seen += merged[b];
+    }
+    return summary;
+}
+
+uint64_t Profiler::total(Counter counter) {
+    std::lock_guard<std::mutex> lock(registry_mtx);
+    uint64_t sum = 0;
+    for (const auto& stats : threads) sum += stats->counters[counter].load(std::memory_order_relaxed);
+    return sum;
+}
+
+bool Profiler::write_trace(const std::string& path) {
+    FILE* out = fopen(path.c_str(), "w");
+    if (!out) return false;
+    fputs("{\"traceEvents\":[\n", out);
+    bool first = true;
+    std::lock_guard<std::mutex> lock(registry_mtx);
+    for (const auto& stats : threads) {
+        size_t count = stats->span_count.load(std::memory_order_acquire);
+        for (size_t i = 0; i < count; i++) {
+            const Span& span = stats->spans[i];
+            fprintf(out, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                    first ? "" : ",\n", stage_name(static_cast<Stage>(span.stage)), static_cast<int>(getpid()),
+                    stats->tid, span.start_ns / 1000.0, span.duration_ns / 1000.0);
+            first = false;
+        }
+    }
+    fputs("\n]}\n", out);
+    return fclose(out) == 0;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <mutex>
+#include <atomic>
+#include <memory>
+
+// Latency instrumentation. Every thread records into its own histograms,
+// registered once on first use and written with relaxed loads and stores
+// only, so recording a sample takes no lock and no locked instruction. The
+// HUD merges them on demand. With tracing on, each thread also appends its
+// timed spans to a fixed-size buffer that is written out as a Chrome trace.
+class Profiler {
+public:
+    enum Stage {
+        SCAN, LOAD_DIRECTORY, SORT, METADATA, FRAME, INPUT, DRAW_MENU, DRAW_OPTIONS, DRAW_INFO,
+        COPY_FILE, COPY, MOVE, DELETE, CHMOD, DUPLICATES, SEARCH, PREVIEW, INDEX, ARCHIVE, STAGE_COUNT
+    };
+    enum Counter { GETDENTS, STAT, RING_ENTER, COUNTER_COUNT };
+
+    struct Summary {
+        uint64_t count = 0;
+        uint64_t p50_ns = 0;
+        uint64_t p99_ns = 0;
+    };
+
+    static const char* stage_name(Stage stage);
+    static const char* counter_name(Counter counter);
+
+private:
+    // Log-linear buckets: four per power of two, so a quantile is off by
+    // at most a quarter of its value.
+    static constexpr int BUCKETS = 256;
+    static constexpr size_t TRACE_CAPACITY = 1 << 18;   // spans kept per thread
+
+    struct Span {
+        uint8_t stage;
+        int64_t start_ns;
+        int64_t duration_ns;
+    };
+
+    struct ThreadStats {
+        int tid = 0;
+        std::atomic<uint64_t> buckets[STAGE_COUNT][BUCKETS] = {};
+        std::atomic<uint64_t> counters[COUNTER_COUNT] = {};
+        std::unique_ptr<Span[]> spans;
+        std::atomic<size_t> span_count{0};
+    };
+
+    static inline std::mutex registry_mtx;
+    static inline std::vector<std::unique_ptr<ThreadStats>> threads;
+    static inline std::atomic<bool> tracing{false};
+    static inline const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+    static ThreadStats& local();
+    static void bump(std::atomic<uint64_t>& value, uint64_t amount = 1);
+    static int bucket(uint64_t ns);
+
+    // Smallest value that falls into bucket `b`.
+    static uint64_t bucket_floor(int b);
+
+public:
+    // Must be called before any other thread records, if at all.
+    static void enable_tracing() { tracing = true; }
+
+    static int64_t now_ns();
+    static void record(Stage stage, int64_t start_ns, int64_t duration_ns);
+
+    static void count(Counter counter, uint64_t amount = 1) { bump(local().counters[counter], amount); }
+
+    static Summary summarize(Stage stage);
+    static uint64_t total(Counter counter);
+
+    // Writes every recorded span in the Chrome trace event format, which
+    // chrome://tracing and Perfetto load directly.
+    static bool write_trace(const std::string& path);
+};
+
+// Times the enclosing scope as one sample of `stage`.
+class ScopedTimer {
+private:
+    Profiler::Stage stage;
+    int64_t start = Profiler::now_ns();
+
+public:
+    explicit ScopedTimer(Profiler::Stage stage) : stage(stage) {}
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+    ~ScopedTimer() { Profiler::record(stage, start, Profiler::now_ns() - start); }
+};
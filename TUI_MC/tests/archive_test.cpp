@@ -0,0 +1,301 @@
+#include "archive.h"
+#include "check.h"
+
+#include <algorithm>
+#include <cstring>
+#include <set>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+// Builds a tar stream in memory: ustar headers, with a pax header in front
+// of any member whose name does not fit.
+class TarWriter {
+private:
+    std::string data;
+
+    // `size - 1` octal digits and a NUL, as tar writes numeric fields.
+    static void put(char* field, size_t size, uint64_t value) {
+        field[size - 1] = '\0';
+        for (size_t i = size - 1; i-- > 0; value >>= 3) field[i] = static_cast<char>('0' + (value & 7));
+    }
+
+    void pad() { data.append((512 - data.size() % 512) % 512, '\0'); }
+
+    void header(const std::string& name, char type, uint64_t size, uint32_t mode, const std::string& link) {
+        char block[512] = {};
+        memcpy(block, name.data(), std::min<size_t>(name.size(), 100));
+        put(block + 100, 8, mode);
+        put(block + 108, 8, 1000);
+        put(block + 116, 8, 1000);
+        put(block + 124, 12, size);
+        put(block + 136, 12, 1600000000);
+        block[156] = type;
+        memcpy(block + 157, link.data(), std::min<size_t>(link.size(), 100));
+        memcpy(block + 257, "ustar", 6);
+        memcpy(block + 263, "00", 2);
+        memset(block + 148, ' ', 8);
+        unsigned sum = 0;
+        for (unsigned char byte : block) sum += byte;
+        put(block + 148, 7, sum);   // six digits, a NUL and the space already there
+        data.append(block, sizeof(block));
+    }
+
+    void entry(const std::string& name, char type, const std::string& contents, uint32_t mode,
+               const std::string& link = "") {
+        if (name.size() > 100) {
+            // "<length> path=<name>\n", where the length counts its own digits.
+            std::string record = " path=" + name + "\n";
+            size_t length = record.size() + 1;
+            while (std::to_string(length).size() + record.size() != length) length++;
+            record = std::to_string(length) + record;
+            header("PaxHeaders/long", 'x', record.size(), 0644, "");
+            data += record;
+            pad();
+        }
+        header(name.substr(0, 100), type, contents.size(), mode, link);
+        data += contents;
+        pad();
+    }
+
+public:
+    void file(const std::string& name, const std::string& contents) { entry(name, '0', contents, 0644); }
+
+    void directory(const std::string& name) { entry(name, '5', "", 0755); }
+
+    void symlink(const std::string& name, const std::string& target) { entry(name, '2', "", 0777, target); }
+
+    void hard_link(const std::string& name, const std::string& target) { entry(name, '1', "", 0644, target); }
+
+    std::string finish() {
+        data.append(1024, '\0');
+        return data;
+    }
+};
+
+static std::string gzip(const std::string& data) {
+    z_stream strm{};
+    deflateInit2(&strm, 6, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+    std::string out(deflateBound(&strm, data.size()), '\0');
+    strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    strm.avail_in = data.size();
+    strm.next_out = reinterpret_cast<Bytef*>(out.data());
+    strm.avail_out = out.size();
+    deflate(&strm, Z_FINISH);
+    out.resize(strm.total_out);
+    deflateEnd(&strm);
+    return out;
+}
+
+static std::string contents_of(const TarArchive& archive, const std::string& path) {
+    const TarArchive::Member* member = archive.find(path);
+    CHECK(member != nullptr);
+    if (!member) return std::string();
+    TarArchive::Reader reader(archive);
+    std::string out;
+    int err = reader.read(*member, [&](const uint8_t* data, size_t length) {
+        out.append(reinterpret_cast<const char*>(data), length);
+        return true;
+    });
+    CHECK_EQ(err, 0);
+    return out;
+}
+
+static std::set<std::string> entries_of(const TarArchive& archive, const std::string& dir) {
+    std::set<std::string> names;
+    for (uint32_t id : archive.entries(dir)) names.insert(std::string(archive.name(archive.member(id))));
+    return names;
+}
+
+static const std::string long_name = "deep/" + std::string(120, 'n') + "/leaf.txt";
+
+// Names with "./" in front, long names, links, and members that would land
+// outside the archive's own tree.
+static std::string sample_tar(const std::string& big = "") {
+    TarWriter tar;
+    tar.directory("docs/");
+    tar.file("docs/readme.txt", "read me\n");
+    tar.symlink("docs/link", "readme.txt");
+    tar.file("./top.txt", "top level\n");
+    tar.hard_link("copy.txt", "top.txt");
+    tar.file(long_name, "at the bottom\n");
+    tar.file("../evil.txt", "outside\n");
+    tar.file("/etc/absolute.txt", "absolute\n");
+    if (!big.empty()) tar.file("big.log", big);
+    return tar.finish();
+}
+
+static std::shared_ptr<TarArchive> open_archive(const fs::path& path) {
+    OperationProgress progress;
+    std::string error;
+    auto archive = TarArchive::open(path, progress, error);
+    CHECK(archive != nullptr);
+    CHECK(error.empty());
+    return archive;
+}
+
+static void check_sample(const TarArchive& archive) {
+    std::set<std::string> top = entries_of(archive, "");
+    top.erase("big.log");
+    CHECK(top == (std::set<std::string>{"docs", "top.txt", "copy.txt", "deep", "etc"}));
+    CHECK(entries_of(archive, "docs") == (std::set<std::string>{"docs/readme.txt", "docs/link"}));
+    CHECK(archive.find("evil.txt") == nullptr);
+    CHECK(archive.find("../evil.txt") == nullptr);
+    CHECK_EQ(contents_of(archive, "docs/readme.txt"), "read me\n");
+    CHECK_EQ(contents_of(archive, "top.txt"), "top level\n");
+    CHECK_EQ(contents_of(archive, "copy.txt"), "top level\n");
+    CHECK_EQ(contents_of(archive, long_name), "at the bottom\n");
+    CHECK_EQ(contents_of(archive, "etc/absolute.txt"), "absolute\n");
+
+    const TarArchive::Member* link = archive.find("docs/link");
+    CHECK(link && S_ISLNK(link->mode) && archive.link(*link) == "readme.txt");
+    const TarArchive::Member* readme = archive.find("docs/readme.txt");
+    CHECK(readme && S_ISREG(readme->mode) && (readme->mode & 07777) == 0644);
+    CHECK(readme && readme->size == 8 && readme->mtime == 1600000000);
+    const TarArchive::Member* docs = archive.find("docs");
+    CHECK(docs && S_ISDIR(docs->mode));
+}
+
+static void test_plain() {
+    ScratchDirectory scratch;
+    write_file(scratch / "sample.tar", sample_tar());
+    auto archive = open_archive(scratch / "sample.tar");
+    if (!archive) return;
+    CHECK(!archive->is_compressed());
+    check_sample(*archive);
+}
+
+// A .tar.gz keeps an access point every few MiB of output, so a member far
+// into the stream is read without inflating from the start, in any order.
+static void test_compressed() {
+    std::string big;
+    for (size_t line = 0; big.size() < 20 * 1024 * 1024; line++) big += "line " + std::to_string(line) + "\n";
+    ScratchDirectory scratch;
+    write_file(scratch / "sample.tar.gz", gzip(sample_tar(big)));
+    auto archive = open_archive(scratch / "sample.tar.gz");
+    if (!archive) return;
+    CHECK(archive->is_compressed());
+    CHECK(archive->access_points() >= 2);
+    check_sample(*archive);
+    CHECK(contents_of(*archive, "big.log") == big);
+
+    // Backwards and forwards through one reader.
+    TarArchive::Reader reader(*archive);
+    std::vector<std::string> order = {"big.log", "docs/readme.txt", "big.log", long_name, "top.txt"};
+    for (const auto& path : order) {
+        std::string out;
+        int err = reader.read(*archive->find(path), [&](const uint8_t* data, size_t length) {
+            out.append(reinterpret_cast<const char*>(data), length);
+            return true;
+        });
+        CHECK_EQ(err, 0);
+        CHECK(out == contents_of(*archive, path));
+    }
+}
+
+// A stream of several gzip members, split inside a header and inside
+// member data, reads the same as one member.
+static void test_concatenated() {
+    std::string big;
+    for (size_t line = 0; big.size() < 12 * 1024 * 1024; line++) big += "row " + std::to_string(line) + "\n";
+    std::string tar = sample_tar(big);
+    size_t first = 600, second = tar.size() / 2;
+    ScratchDirectory scratch;
+    write_file(scratch / "parts.tar.gz", gzip(tar.substr(0, first)) + gzip(tar.substr(first, second - first)) +
+                                         gzip(tar.substr(second)));
+    auto archive = open_archive(scratch / "parts.tar.gz");
+    if (!archive) return;
+    check_sample(*archive);
+    CHECK(contents_of(*archive, "big.log") == big);
+
+    TarArchive::Reader reader(*archive);
+    for (const auto& path : {"big.log", "top.txt", "big.log"}) {
+        std::string out;
+        CHECK_EQ(reader.read(*archive->find(path), [&](const uint8_t* data, size_t length) {
+            out.append(reinterpret_cast<const char*>(data), length);
+            return true;
+        }), 0);
+        CHECK(out == contents_of(*archive, path));
+    }
+}
+
+static void test_not_an_archive() {
+    ScratchDirectory scratch;
+    write_file(scratch / "notes.tar", std::string(4096, 'x'));
+    write_file(scratch / "notes.tar.gz", gzip(std::string(4096, 'x')));
+    for (const char* name : {"notes.tar", "notes.tar.gz"}) {
+        OperationProgress progress;
+        std::string error;
+        CHECK(TarArchive::open(scratch / name, progress, error) == nullptr);
+        CHECK(!error.empty());
+    }
+    CHECK(TarArchive::is_archive_name("backup.TAR.GZ"));
+    CHECK(TarArchive::is_archive_name("backup.tgz"));
+    CHECK(!TarArchive::is_archive_name("backup.tar.xz"));
+}
+
+static void test_contained() {
+    CHECK(TarArchive::contained("readme.txt"));
+    CHECK(TarArchive::contained("sub/dir/file"));
+    CHECK(TarArchive::contained("..hidden"));
+    CHECK(!TarArchive::contained("/etc/passwd"));
+    CHECK(!TarArchive::contained(".."));
+    CHECK(!TarArchive::contained("../outside"));
+    CHECK(!TarArchive::contained("sub/../../outside"));
+}
+
+// Extraction writes only below the destination: links that point out of it
+// are refused, and nothing is written through a symlink.
+static void test_extract() {
+    ScratchDirectory scratch;
+    TarWriter tar;
+    tar.directory("d");
+    tar.file("d/a.txt", "alpha\n");
+    tar.symlink("d/a.link", "a.txt");
+    tar.symlink("d/escape", "../../outside");
+    tar.symlink("d/absolute", scratch.path().string());
+    tar.symlink("d/inner", "sub");
+    tar.file("d/inner/through.txt", "through a link\n");
+    tar.hard_link("d/passwd", "/etc/passwd");
+    write_file(scratch / "attack.tar", tar.finish());
+    fs::create_directory(scratch / "out");
+
+    auto archive = open_archive(scratch / "attack.tar");
+    if (!archive) return;
+    OperationProgress progress;
+    ArchiveExtractor extractor(archive, progress);
+    extractor.start({"d"}, scratch / "out");
+    extractor.wait();
+
+    fs::path out = scratch / "out" / "d";
+    CHECK_EQ(read_file(out / "a.txt"), "alpha\n");
+    CHECK(fs::is_symlink(out / "a.link") && fs::read_symlink(out / "a.link") == "a.txt");
+    CHECK(!fs::exists(fs::symlink_status(out / "escape")));
+    CHECK(!fs::exists(fs::symlink_status(out / "absolute")));
+    CHECK(!fs::exists(fs::symlink_status(out / "passwd")));
+    CHECK(fs::is_symlink(out / "inner"));
+    CHECK(!fs::exists(out / "sub"));
+    CHECK(!fs::exists(scratch / "through.txt"));
+    CHECK(!fs::exists(fs::symlink_status(out / "inner" / "through.txt")));
+    CHECK_EQ(progress.failures.size(), 3u);
+    CHECK(progress.finished);
+
+    // An existing entry is never merged into.
+    OperationProgress again;
+    ArchiveExtractor second(archive, again);
+    second.start({"d/a.txt"}, out);
+    second.wait();
+    CHECK_EQ(again.failures.size(), 1u);
+}
+
+int main() {
+    test_plain();
+    test_compressed();
+    test_concatenated();
+    test_not_an_archive();
+    test_contained();
+    test_extract();
+    return check_status();
+}
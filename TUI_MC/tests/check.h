@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <system_error>
+
+namespace fs = std::filesystem;
+
+// Minimal checks for the behaviour tests: a failed check is reported with
+// its location and the test keeps going, so one run shows every failure.
+// main() returns check_status().
+inline int& check_failures() {
+    static int failures = 0;
+    return failures;
+}
+
+inline void check_report(bool ok, const char* expression, const char* file, int line) {
+    if (ok) return;
+    fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expression);
+    check_failures()++;
+}
+
+#define CHECK(condition) check_report(static_cast<bool>(condition), #condition, __FILE__, __LINE__)
+#define CHECK_EQ(actual, expected) check_report((actual) == (expected), #actual " == " #expected, __FILE__, __LINE__)
+
+inline int check_status() {
+    if (check_failures()) fprintf(stderr, "%d check(s) failed\n", check_failures());
+    return check_failures() ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// A fresh directory under the system temporary directory, removed with
+// everything in it when the test ends.
+class ScratchDirectory {
+private:
+    fs::path dir;
+
+public:
+    ScratchDirectory() {
+        std::string pattern = (fs::temp_directory_path() / "fm_test.XXXXXX").string();
+        if (!mkdtemp(pattern.data())) {
+            perror("mkdtemp");
+            exit(EXIT_FAILURE);
+        }
+        dir = pattern;
+    }
+
+    ~ScratchDirectory() {
+        std::error_code ec;
+        fs::remove_all(dir, ec);
+    }
+
+    ScratchDirectory(const ScratchDirectory&) = delete;
+    ScratchDirectory& operator=(const ScratchDirectory&) = delete;
+
+    const fs::path& path() const { return dir; }
+
+    fs::path operator/(const std::string& name) const { return dir / name; }
+};
+
+inline void write_file(const fs::path& path, const std::string& data) {
+    std::ofstream(path, std::ios::binary) << data;
+}
+
+inline std::string read_file(const fs::path& path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
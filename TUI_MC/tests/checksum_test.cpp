@@ -0,0 +1,77 @@
+#include "checksum.h"
+#include "thread_pool.h"
+#include "check.h"
+
+#include <algorithm>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Digest of `data` fed to update() in pieces of `piece` bytes.
+static std::string sha256(const std::string& data, size_t piece) {
+    Sha256 hash;
+    for (size_t at = 0; at < data.size(); at += piece) hash.update(data.data() + at, std::min(piece, data.size() - at));
+    return Sha256::hex(hash.finish());
+}
+
+// The FIPS 180-4 example vectors, whole and in pieces that straddle the
+// 64-byte blocks and the length padding.
+static void test_vectors() {
+    const struct {
+        std::string message;
+        const char* digest;
+    } vectors[] = {
+        {"", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+        {"abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+        {"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+         "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"},
+        {"abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrst"
+         "nopqrstu",
+         "cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1"},
+        {std::string(1000000, 'a'), "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"},
+    };
+    for (const auto& vector : vectors) {
+        for (size_t piece : {size_t(1), size_t(63), size_t(64), size_t(65), size_t(4096)}) {
+            if (piece == 1 && vector.message.size() > 4096) continue;
+            CHECK_EQ(sha256(vector.message, piece), vector.digest);
+        }
+    }
+
+    Sha256 reused;
+    reused.update("abc", 3);
+    reused.reset();
+    CHECK_EQ(Sha256::hex(reused.finish()), vectors[0].digest);
+}
+
+// The pipeline copies a file while hashing it, and a sparse target reads
+// back the same as the source.
+static void test_pipeline() {
+    ScratchDirectory scratch;
+    std::string data;
+    for (size_t i = 0; data.size() < 3 * 1024 * 1024 + 17; i++) data += std::to_string(i * 2654435761u) + "\n";
+    data.append(1024 * 1024, '\0');
+    data += "tail";
+    write_file(scratch / "source", data);
+
+    for (bool sparse : {false, true}) {
+        fs::path target = scratch / (sparse ? "sparse" : "dense");
+        int in = open((scratch / "source").c_str(), O_RDONLY | O_CLOEXEC);
+        int out = open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        CHECK(in >= 0 && out >= 0);
+        OperationProgress progress;
+        Sha256 digest;
+        int err = ChecksumPipeline(ChecksumPipeline::thread_ring()).run(in, out, data.size(), digest, progress, sparse);
+        close(in);
+        close(out);
+        CHECK_EQ(err, 0);
+        CHECK_EQ(Sha256::hex(digest.finish()), sha256(data, data.size()));
+        CHECK(read_file(target) == data);
+        CHECK_EQ(progress.bytes_done.load(), data.size());
+    }
+}
+
+int main() {
+    test_vectors();
+    test_pipeline();
+    return check_status();
+}
@@ -0,0 +1,161 @@
+#include "directory_index.h"
+#include "check.h"
+
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static DirectoryListing make_listing(const fs::path& dir, const std::vector<std::string>& names) {
+    DirectoryListing list;
+    list.reset(dir);
+    for (size_t i = 0; i < names.size(); i++) {
+        list.push_back(names[i], i % 2 ? DT_DIR : DT_REG);
+        if (i % 3 == 0) list.set_stat(i, (i % 2 ? S_IFDIR : S_IFREG) | 0644, 1000 + i, 1700000000123456789ll + i);
+    }
+    return list;
+}
+
+static DirectoryIndex::Source make_source(uint64_t ino, const DirectoryListing& list) {
+    DirectoryIndex::Source source;
+    source.dev = 42;
+    source.ino = ino;
+    source.mtime = 1700000000000000000ll + ino;
+    source.path = list.directory().string();
+    source.listing = &list;
+    source.mode = ListingSorter::SIZE;
+    source.reversed = true;
+    source.sorted = true;
+    return source;
+}
+
+static void check_same(const DirectoryListing& loaded, const DirectoryListing& original) {
+    CHECK_EQ(loaded.size(), original.size());
+    CHECK(loaded.directory() == original.directory());
+    for (size_t i = 0; i < loaded.size() && i < original.size(); i++) {
+        CHECK(loaded.name(i) == original.name(i));
+        CHECK_EQ(loaded.type(i), original.type(i));
+        CHECK_EQ(loaded.mode(i), original.mode(i));
+        CHECK_EQ(loaded.file_size(i), original.file_size(i));
+        CHECK_EQ(loaded.mtime(i), original.mtime(i));
+        CHECK(!loaded.is_marked(i));
+    }
+}
+
+static ino_t inode_of(const fs::path& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? st.st_ino : 0;
+}
+
+// A saved listing comes back with its columns, order flags and mtime.
+static void test_round_trip() {
+    ScratchDirectory scratch;
+    fs::path file = scratch / "directories.idx";
+    DirectoryListing home = make_listing("/home/user", {"notes.txt", "src", "a name with spaces", "ünïcödé", ""});
+    DirectoryListing empty = make_listing("/empty", {});
+
+    DirectoryIndex writer;
+    CHECK(!writer.open(file.string()));   // nothing there yet, but it becomes the file to save to
+    CHECK(writer.save({make_source(7, home), make_source(8, empty)}));
+
+    DirectoryIndex reader;
+    CHECK(reader.open(file.string()));
+    DirectoryIndex::Listing out;
+    CHECK(reader.load(42, 7, "/home/user", out));
+    check_same(out.listing, home);
+    CHECK_EQ(out.mtime, 1700000000000000007ll);
+    CHECK_EQ(out.mode, ListingSorter::SIZE);
+    CHECK(out.reversed);
+    CHECK(out.sorted);
+    CHECK(reader.load(42, 8, "/empty", out));
+    CHECK_EQ(out.listing.size(), 0u);
+
+    // The record must be for the same directory and the same path.
+    CHECK(!reader.load(42, 9, "/home/user", out));
+    CHECK(!reader.load(43, 7, "/home/user", out));
+    CHECK(!reader.load(42, 7, "/home/other", out));
+
+    // Saving what is stored already leaves the file alone.
+    ino_t before = inode_of(file);
+    CHECK(reader.save({make_source(7, home)}));
+    CHECK_EQ(inode_of(file), before);
+}
+
+// Records of directories a later run did not visit are carried over.
+static void test_keeps_earlier_records() {
+    ScratchDirectory scratch;
+    fs::path file = scratch / "directories.idx";
+    DirectoryListing first = make_listing("/first", {"one", "two"});
+    DirectoryListing second = make_listing("/second", {"three"});
+    DirectoryListing changed = make_listing("/first", {"one", "two", "four"});
+
+    DirectoryIndex run1;
+    run1.open(file.string());
+    CHECK(run1.save({make_source(1, first)}));
+    DirectoryIndex run2;
+    CHECK(run2.open(file.string()));
+    CHECK(run2.save({make_source(2, second)}));
+    DirectoryIndex run3;
+    CHECK(run3.open(file.string()));
+    CHECK(run3.save({make_source(1, changed)}));
+
+    DirectoryIndex reader;
+    CHECK(reader.open(file.string()));
+    DirectoryIndex::Listing out;
+    CHECK(reader.load(42, 1, "/first", out));
+    check_same(out.listing, changed);
+    CHECK(reader.load(42, 2, "/second", out));
+    check_same(out.listing, second);
+}
+
+static void patch(const fs::path& file, off_t offset, char byte) {
+    int fd = open(file.c_str(), O_WRONLY | O_CLOEXEC);
+    CHECK(fd >= 0 && pwrite(fd, &byte, 1, offset) == 1);
+    close(fd);
+}
+
+// A damaged file or record is ignored rather than trusted.
+static void test_rejects_damage() {
+    ScratchDirectory scratch;
+    fs::path file = scratch / "directories.idx";
+    // One name of 7 bytes plus its '\0' fills the arena to an 8-byte
+    // boundary, so the last byte of the file is that terminator.
+    DirectoryListing list = make_listing("/dir", {"abcdefg"});
+    DirectoryIndex writer;
+    writer.open(file.string());
+    CHECK(writer.save({make_source(5, list)}));
+    std::string good = read_file(file);
+
+    DirectoryIndex reader;
+    DirectoryIndex::Listing out;
+    patch(file, fs::file_size(file) - 1, 'x');
+    CHECK(reader.open(file.string()));
+    CHECK(!reader.load(42, 5, "/dir", out));
+
+    write_file(file, good);
+    patch(file, 0, 'X');
+    CHECK(!reader.open(file.string()));
+
+    write_file(file, good);
+    patch(file, 8, 99);   // format version
+    CHECK(!reader.open(file.string()));
+
+    write_file(file, good.substr(0, good.size() - 8));
+    CHECK(!reader.open(file.string()));
+
+    write_file(file, "");
+    CHECK(!reader.open(file.string()));
+
+    write_file(file, good);
+    CHECK(reader.open(file.string()));
+    CHECK(reader.load(42, 5, "/dir", out));
+    check_same(out.listing, list);
+}
+
+int main() {
+    test_round_trip();
+    test_keeps_earlier_records();
+    test_rejects_damage();
+    return check_status();
+}
@@ -0,0 +1,187 @@
+#include "file_operations.h"
+#include "check.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Contents that differ from block to block, so a misplaced extent shows.
+static std::string pattern(size_t size, unsigned seed) {
+    std::string data(size, '\0');
+    for (size_t i = 0; i < size; i++) data[i] = static_cast<char>((i * 131 + seed + i / 4096) & 0xff);
+    return data;
+}
+
+static void make_tree(const fs::path& root) {
+    fs::create_directories(root / "sub" / "deeper");
+    write_file(root / "small.txt", "small\n");
+    write_file(root / "empty", "");
+    write_file(root / "sub" / "big.bin", pattern(5 * 1024 * 1024 + 17, 1));
+    write_file(root / "sub" / "deeper" / "leaf.txt", "leaf\n");
+    fs::create_symlink("../small.txt", root / "sub" / "link");
+    fs::permissions(root / "small.txt", fs::perms(0600));
+}
+
+static void check_same_tree(const fs::path& source, const fs::path& target) {
+    std::vector<fs::path> expected, copied;
+    for (auto& entry : fs::recursive_directory_iterator(source)) expected.push_back(fs::relative(entry.path(), source));
+    for (auto& entry : fs::recursive_directory_iterator(target)) copied.push_back(fs::relative(entry.path(), target));
+    std::sort(expected.begin(), expected.end());
+    std::sort(copied.begin(), copied.end());
+    CHECK(expected == copied);
+    for (const auto& relative : expected) {
+        fs::path from = source / relative, to = target / relative;
+        auto status = fs::symlink_status(from);
+        CHECK(fs::symlink_status(to).type() == status.type());
+        if (fs::is_symlink(status)) {
+            CHECK(fs::read_symlink(to) == fs::read_symlink(from));
+        } else if (fs::is_regular_file(status)) {
+            CHECK(read_file(to) == read_file(from));
+            CHECK(fs::status(to).permissions() == status.permissions());
+        }
+    }
+}
+
+// A tree is copied with its directories, links, contents and permissions.
+static void test_copy_tree() {
+    ScratchDirectory scratch;
+    make_tree(scratch / "tree");
+    fs::create_directory(scratch / "dest");
+
+    WorkStealingPool pool(2);
+    OperationProgress progress;
+    CopyEngine engine(pool, progress);
+    engine.start({scratch / "tree"}, scratch / "dest");
+    engine.wait();
+    CHECK(progress.finished);
+    CHECK(progress.failures.empty());
+    CHECK_EQ(progress.files_total.load(), 4u);
+    CHECK_EQ(progress.files_done.load(), 4u);
+    CHECK_EQ(progress.bytes_done.load(), progress.bytes_total.load());
+    check_same_tree(scratch / "tree", scratch / "dest" / "tree");
+    CHECK_EQ(engine.source_directories().front(), scratch / "tree");
+}
+
+// An existing directory of the same name is not merged into, and a
+// directory is not copied into itself.
+static void test_copy_refuses() {
+    ScratchDirectory scratch;
+    make_tree(scratch / "tree");
+    fs::create_directories(scratch / "dest" / "tree");
+    write_file(scratch / "dest" / "tree" / "mine.txt", "mine\n");
+
+    WorkStealingPool pool(2);
+    OperationProgress progress;
+    CopyEngine engine(pool, progress);
+    engine.copy_tree({scratch / "tree"}, scratch / "dest");
+    CHECK_EQ(progress.failures.size(), 1u);
+    CHECK(!fs::exists(scratch / "dest" / "tree" / "small.txt"));
+    CHECK_EQ(read_file(scratch / "dest" / "tree" / "mine.txt"), "mine\n");
+
+    OperationProgress into_itself;
+    CopyEngine again(pool, into_itself);
+    again.copy_tree({scratch / "tree"}, scratch / "tree" / "sub" / "copy");
+    CHECK_EQ(into_itself.failures.size(), 1u);
+    CHECK(!fs::exists(scratch / "tree" / "sub" / "copy"));
+}
+
+// Holes stay holes: the copy reads the same and allocates about as much
+// as the source, not the full size.
+static void test_copy_sparse() {
+    ScratchDirectory scratch;
+    const off_t size = 256ll * 1024 * 1024;
+    const std::string head = pattern(64 * 1024, 2), middle = pattern(4096, 3);
+    fs::path source = scratch / "sparse.img";
+    int fd = open(source.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    CHECK(fd >= 0);
+    CHECK(pwrite(fd, head.data(), head.size(), 0) == static_cast<ssize_t>(head.size()));
+    CHECK(pwrite(fd, middle.data(), middle.size(), size / 2) == static_cast<ssize_t>(middle.size()));
+    CHECK(ftruncate(fd, size) == 0);   // trailing hole
+    close(fd);
+
+    WorkStealingPool pool(2);
+    OperationProgress progress;
+    CopyEngine engine(pool, progress);
+    engine.copy_tree({source}, scratch / "copy.img");
+    CHECK(progress.failures.empty());
+    CHECK_EQ(progress.bytes_done.load(), static_cast<uint64_t>(size));
+
+    struct stat in, out;
+    CHECK(stat(source.c_str(), &in) == 0 && stat((scratch / "copy.img").c_str(), &out) == 0);
+    CHECK_EQ(out.st_size, size);
+    // Only meaningful where the filesystem kept the source sparse.
+    if (in.st_blocks * 512 < size / 2) CHECK(out.st_blocks * 512 < size / 2);
+    std::string copy = read_file(scratch / "copy.img");
+    CHECK(copy.compare(0, head.size(), head) == 0);
+    CHECK(copy.compare(size / 2, middle.size(), middle) == 0);
+    CHECK(std::all_of(copy.begin() + head.size(), copy.begin() + size / 2, [](char c) { return c == 0; }));
+    CHECK(std::all_of(copy.begin() + size / 2 + middle.size(), copy.end(), [](char c) { return c == 0; }));
+}
+
+// A verified copy reports the digest of every file, which is the digest of
+// the source.
+static void test_copy_verified() {
+    ScratchDirectory scratch;
+    make_tree(scratch / "tree");
+
+    WorkStealingPool pool(2);
+    OperationProgress progress;
+    CopyEngine engine(pool, progress);
+    engine.set_verify(true);
+    engine.copy_tree({scratch / "tree"}, scratch / "copy");
+    CHECK(progress.failures.empty());
+    CHECK_EQ(progress.files_done.load(), 4u);
+    CHECK_EQ(progress.bytes_done.load(), progress.bytes_total.load());
+    check_same_tree(scratch / "tree", scratch / "copy");
+
+    CHECK_EQ(engine.file_digests().size(), 4u);
+    for (const auto& file : engine.file_digests()) {
+        std::string data = read_file(scratch / "tree" / fs::relative(file.target, scratch / "copy"));
+        Sha256 sha;
+        sha.update(data.data(), data.size());
+        CHECK(sha.finish() == file.digest);
+    }
+}
+
+// Delete removes a tree bottom-up and never follows a symlink out of it; a
+// dry run only counts what would go.
+static void test_delete_tree() {
+    ScratchDirectory scratch;
+    make_tree(scratch / "tree");
+    fs::create_directory(scratch / "outside");
+    write_file(scratch / "outside" / "keep.txt", "keep\n");
+    fs::create_directory_symlink("../../outside", scratch / "tree" / "sub" / "out");
+    write_file(scratch / "loose.txt", "loose\n");
+
+    WorkStealingPool pool(2);
+    OperationProgress counted;
+    DeleteEngine dry(pool, counted, true);
+    dry.start({scratch / "tree", scratch / "loose.txt"});
+    dry.wait();
+    CHECK(counted.failures.empty());
+    CHECK_EQ(counted.files_total.load(), 10u);
+    CHECK(fs::exists(scratch / "tree" / "sub" / "deeper" / "leaf.txt"));
+
+    OperationProgress progress;
+    DeleteEngine engine(pool, progress, false);
+    engine.start({scratch / "tree", scratch / "loose.txt"});
+    engine.wait();
+    CHECK(progress.finished);
+    CHECK(progress.failures.empty());
+    CHECK_EQ(progress.files_done.load(), 10u);
+    CHECK(!fs::exists(fs::symlink_status(scratch / "tree")));
+    CHECK(!fs::exists(scratch / "loose.txt"));
+    CHECK_EQ(read_file(scratch / "outside" / "keep.txt"), "keep\n");
+}
+
+int main() {
+    test_copy_tree();
+    test_copy_refuses();
+    test_copy_sparse();
+    test_copy_verified();
+    test_delete_tree();
+    return check_status();
+}
@@ -0,0 +1,200 @@
+#include "listing.h"
+#include "directory.h"
+#include "thread_pool.h"
+#include "check.h"
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static DirectoryListing make_listing(const std::vector<std::string>& names) {
+    DirectoryListing list;
+    for (const auto& name : names) list.push_back(name, DT_REG);
+    return list;
+}
+
+static std::vector<std::string> names_of(const DirectoryListing& list) {
+    std::vector<std::string> names;
+    for (size_t i = 0; i < list.size(); i++) names.emplace_back(list.name(i));
+    return names;
+}
+
+// Sorts `list` from scratch in `mode` and checks that `moved` maps every
+// entry to where it ended up.
+static void sort_listing(ListingSorter& sorter, DirectoryListing& list, int dir_fd = -1,
+                         WorkStealingPool* pool = nullptr) {
+    std::vector<std::string> before = names_of(list);
+    std::vector<uint32_t> moved;
+    sorter.merge(list, dir_fd, pool, moved);
+    CHECK_EQ(sorter.size(), list.size());
+    CHECK_EQ(moved.size(), before.size());
+    for (size_t i = 0; i < moved.size() && i < before.size(); i++) CHECK(list.name(moved[i]) == before[i]);
+}
+
+// Names compare case-insensitively, and digit runs by their value.
+static void test_sort_by_name() {
+    DirectoryListing list = make_listing({"file10.txt", "file9.txt", "File2.txt", "beta.md", "alpha.c", "_x"});
+    ListingSorter sorter;
+    sort_listing(sorter, list);
+    CHECK(names_of(list) == (std::vector<std::string>{"_x", "alpha.c", "beta.md", "File2.txt", "file9.txt", "file10.txt"}));
+
+    // Choosing the same mode again reverses the order.
+    sorter.set_mode(ListingSorter::NAME);
+    CHECK(sorter.is_reversed());
+    sort_listing(sorter, list);
+    CHECK(names_of(list) == (std::vector<std::string>{"file10.txt", "file9.txt", "File2.txt", "beta.md", "alpha.c", "_x"}));
+}
+
+static void test_sort_by_extension() {
+    DirectoryListing list = make_listing({"c.txt", "b.c", "d", "a.txt", ".profile"});
+    ListingSorter sorter;
+    sorter.set_mode(ListingSorter::EXTENSION);
+    sort_listing(sorter, list);
+    CHECK(names_of(list) == (std::vector<std::string>{".profile", "d", "b.c", "a.txt", "c.txt"}));
+}
+
+// Size and time sort the largest and newest first, reading the metadata
+// relative to the directory descriptor.
+static void test_sort_by_size_and_time() {
+    ScratchDirectory scratch;
+    const std::vector<std::pair<std::string, size_t>> files = {{"small", 10}, {"large", 3000}, {"medium", 200}};
+    for (size_t i = 0; i < files.size(); i++) {
+        fs::path path = scratch / files[i].first;
+        write_file(path, std::string(files[i].second, 'x'));
+        timespec times[2] = {{0, UTIME_OMIT}, {static_cast<time_t>(1000000 + i * 1000), 0}};
+        utimensat(AT_FDCWD, path.c_str(), times, 0);
+    }
+    int dir_fd = open(scratch.path().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    CHECK(dir_fd >= 0);
+
+    DirectoryListing list = make_listing({"small", "large", "medium"});
+    ListingSorter sorter;
+    sorter.set_mode(ListingSorter::SIZE);
+    sort_listing(sorter, list, dir_fd);
+    CHECK(names_of(list) == (std::vector<std::string>{"large", "medium", "small"}));
+    CHECK_EQ(list.file_size(0), 3000u);
+
+    sorter.set_mode(ListingSorter::MTIME);
+    sort_listing(sorter, list, dir_fd);
+    CHECK(names_of(list) == (std::vector<std::string>{"medium", "large", "small"}));
+    close(dir_fd);
+}
+
+// Entries that arrive after a sort are merged into the sorted prefix.
+static void test_incremental_merge() {
+    DirectoryListing list = make_listing({"m", "c", "x"});
+    ListingSorter sorter;
+    sort_listing(sorter, list);
+    list.push_back("a", DT_REG);
+    list.push_back("n", DT_REG);
+    CHECK_EQ(sorter.size(), 3u);
+    sort_listing(sorter, list);
+    CHECK(names_of(list) == (std::vector<std::string>{"a", "c", "m", "n", "x"}));
+
+    // Dropping entries keeps the rest in order without re-sorting.
+    std::vector<char> alive = {1, 0, 1, 1, 0};
+    sorter.retain(alive);
+    list.retain(alive);
+    CHECK_EQ(sorter.size(), 3u);
+    sort_listing(sorter, list);
+    CHECK(names_of(list) == (std::vector<std::string>{"a", "m", "n"}));
+}
+
+// Big listings are sorted in slices on the pool and merged back.
+static void test_parallel_sort() {
+    std::vector<std::string> names;
+    for (size_t i = 0; i < ListingSorter::PARALLEL_MIN + 4321; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "entry-%07zu", i);
+        names.push_back(name);
+    }
+    std::vector<std::string> expected = names;
+    std::shuffle(names.begin(), names.end(), std::mt19937(7));
+    DirectoryListing list = make_listing(names);
+    WorkStealingPool pool(4);
+    ListingSorter sorter;
+    sort_listing(sorter, list, -1, &pool);
+    CHECK(names_of(list) == expected);
+}
+
+static std::vector<std::string> filter(FuzzyFilter& filter, const DirectoryListing& list, const std::string& query) {
+    filter.set_query(query);
+    std::vector<std::string> found;
+    for (uint32_t index : filter.results()) found.emplace_back(list.name(index));
+    return found;
+}
+
+// Substring matches rank above scattered ones, and a match at the start of
+// the name above one inside it.
+static void test_filter_ranking() {
+    DirectoryListing list = make_listing({"readme.md", "m_a_i_n.txt", "domain.h", "Makefile", "main.cpp", "src"});
+    FuzzyFilter fuzzy;
+    fuzzy.add_names(list);
+    CHECK(!fuzzy.active());
+    CHECK(filter(fuzzy, list, "main") == (std::vector<std::string>{"main.cpp", "domain.h", "m_a_i_n.txt"}));
+    CHECK(fuzzy.active());
+    CHECK(filter(fuzzy, list, "MAIN") == (std::vector<std::string>{"main.cpp", "domain.h", "m_a_i_n.txt"}));
+    CHECK(filter(fuzzy, list, "mk") == (std::vector<std::string>{"Makefile"}));
+    CHECK(filter(fuzzy, list, "zz").empty());
+}
+
+// Extending or shortening the query gives the same results as typing it
+// from scratch, and names added later are filtered against the query.
+static void test_filter_incremental() {
+    DirectoryListing list = make_listing({"alpha", "alphabet", "beta", "gamma"});
+    FuzzyFilter fuzzy;
+    fuzzy.add_names(list);
+    CHECK(filter(fuzzy, list, "a").size() == 4);
+    CHECK(filter(fuzzy, list, "alp") == (std::vector<std::string>{"alpha", "alphabet"}));
+    CHECK(filter(fuzzy, list, "alpx").empty());
+    CHECK(filter(fuzzy, list, "alp") == (std::vector<std::string>{"alpha", "alphabet"}));
+
+    list.push_back("alpine", DT_DIR);
+    list.push_back("delta", DT_REG);
+    fuzzy.add_names(list);
+    CHECK(filter(fuzzy, list, "alp") == (std::vector<std::string>{"alpha", "alpine", "alphabet"}));
+    CHECK(filter(fuzzy, list, "").empty());
+    CHECK(!fuzzy.active());
+}
+
+// A scan hands over every entry, and one that cannot open its directory
+// keeps the errno until it is cancelled.
+static void test_scan() {
+    ScratchDirectory scratch;
+    for (const char* name : {"one", "two", "three"}) write_file(scratch / name, name);
+
+    DirectoryScanner scanner;
+    scanner.start(scratch.path());
+    while (scanner.is_running()) std::this_thread::yield();
+    DirectoryListing list;
+    scanner.take(list);
+    CHECK(scanner.is_complete());
+    CHECK_EQ(scanner.error(), 0);
+    std::vector<std::string> names = names_of(list);
+    std::sort(names.begin(), names.end());
+    CHECK(names == (std::vector<std::string>{"one", "three", "two"}));
+
+    scanner.start(scratch / "missing");
+    while (scanner.is_running()) std::this_thread::yield();
+    CHECK(!scanner.is_complete());
+    CHECK_EQ(scanner.error(), ENOENT);
+    scanner.cancel();
+    CHECK_EQ(scanner.error(), 0);
+}
+
+int main() {
+    test_sort_by_name();
+    test_sort_by_extension();
+    test_sort_by_size_and_time();
+    test_incremental_merge();
+    test_parallel_sort();
+    test_filter_ranking();
+    test_filter_incremental();
+    test_scan();
+    return check_status();
+}
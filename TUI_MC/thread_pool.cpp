@@ -0,0 +1,118 @@
+#include "thread_pool.h"
+
+void TaskGroup::add() {
+    std::lock_guard<std::mutex> lock(mtx);
+    pending++;
+}
+
+void TaskGroup::finish() {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (--pending == 0) done.notify_all();
+}
+
+void TaskGroup::wait() {
+    std::unique_lock<std::mutex> lock(mtx);
+    done.wait(lock, [this] { return pending == 0; });
+}
+
+int& WorkStealingPool::worker_index() {
+    static thread_local int index = -1;
+    return index;
+}
+
+bool WorkStealingPool::pop(size_t self, std::function<void()>& task) {
+    {
+        Queue& own = *queues[self];
+        std::lock_guard<std::mutex> lock(own.mtx);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            queued--;
+            return true;
+        }
+    }
+    for (size_t i = 1; i < queues.size(); i++) {
+        Queue& victim = *queues[(self + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mtx);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            queued--;
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkStealingPool::run(size_t self) {
+    worker_index() = static_cast<int>(self);
+    std::function<void()> task;
+    while (true) {
+        if (pop(self, task)) {
+            task();
+            task = nullptr;
+            if (--pending == 0) {
+                std::lock_guard<std::mutex> lock(sleep_mtx);
+                idle.notify_all();
+            }
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleep_mtx);
+        wake.wait(lock, [this] { return stopping || queued > 0; });
+        if (stopping) return;
+    }
+}
+
+WorkStealingPool::WorkStealingPool(size_t threads) {
+    for (size_t i = 0; i < threads; i++) queues.push_back(std::make_unique<Queue>());
+    for (size_t i = 0; i < threads; i++) workers.emplace_back(&WorkStealingPool::run, this, i);
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    wait_idle();
+    {
+        std::lock_guard<std::mutex> lock(sleep_mtx);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers) worker.join();
+}
+
+void WorkStealingPool::submit(std::function<void()> task) {
+    pending++;
+    int self = worker_index();
+    size_t target = self >= 0 ? self : next_queue++ % queues.size();
+    {
+        std::lock_guard<std::mutex> lock(queues[target]->mtx);
+        queues[target]->tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> lock(sleep_mtx);
+        queued++;
+    }
+    wake.notify_one();
+}
+
+void WorkStealingPool::submit(TaskGroup& group, std::function<void()> task) {
+    group.add();
+    submit([&group, task = std::move(task)] {
+        task();
+        group.finish();
+    });
+}
+
+void WorkStealingPool::wait_idle() {
+    std::unique_lock<std::mutex> lock(sleep_mtx);
+    idle.wait(lock, [this] { return pending == 0; });
+}
+
+void OperationProgress::finish() {
+    finished = true;
+    if (wakeup) wakeup->notify();
+}
+
+void OperationProgress::fail(const std::string& message) {
+    std::lock_guard<std::mutex> lock(error_mtx);
+    if (errors++ == 0) first_error = message;
+    if (failures.size() < MAX_FAILURES) failures.push_back(message);
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "directory.h"
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <condition_variable>
+#include <memory>
+#include <algorithm>
+
+// Counts the outstanding tasks of one operation, so it can wait for its own
+// work without also waiting for unrelated tasks that share the pool.
+class TaskGroup {
+private:
+    size_t pending = 0;
+    std::mutex mtx;
+    std::condition_variable done;
+
+public:
+    void add();
+    void finish();
+    void wait();
+};
+
+// Fixed set of worker threads, each with its own task deque. Workers pop their
+// own newest task first and steal the oldest task of another worker when idle,
+// so a task that discovers more work (a directory with subdirectories) can
+// push it locally and let idle workers take it over.
+class WorkStealingPool {
+private:
+    struct Queue {
+        std::mutex mtx;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::mutex sleep_mtx;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    std::atomic<size_t> pending{0};
+    std::atomic<long> queued{0};      // tasks in the deques; raised under sleep_mtx so no wakeup is lost
+    std::atomic<size_t> next_queue{0};
+    std::atomic<bool> stopping{false};
+
+    static int& worker_index();
+    bool pop(size_t self, std::function<void()>& task);
+    void run(size_t self);
+
+public:
+    explicit WorkStealingPool(size_t threads = std::max(4u, std::thread::hardware_concurrency()));
+    ~WorkStealingPool();
+
+    size_t size() const { return workers.size(); }
+
+    // Tasks submitted from a worker go to that worker's own deque.
+    void submit(std::function<void()> task);
+    void submit(TaskGroup& group, std::function<void()> task);
+
+    // Blocks until every submitted task, including tasks they spawned, has run.
+    void wait_idle();
+};
+
+// Progress of a long-running file operation. Workers update the counters,
+// the UI thread reads them to draw throughput and ETA.
+struct OperationProgress {
+    std::atomic<uint64_t> bytes_total{0};
+    std::atomic<uint64_t> bytes_done{0};
+    std::atomic<uint64_t> files_total{0};
+    std::atomic<uint64_t> files_done{0};
+    std::atomic<uint64_t> errors{0};
+    std::atomic<bool> planning{true};
+    std::atomic<bool> cancelled{false};
+    std::atomic<bool> finished{false};
+    Wakeup* wakeup = nullptr;            // notified when the operation finishes
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+
+    static constexpr size_t MAX_FAILURES = 10000;
+
+    OperationProgress() = default;
+    explicit OperationProgress(Wakeup* wakeup) : wakeup(wakeup) {}
+
+    std::mutex error_mtx;
+    std::string first_error;
+    std::vector<std::string> failures;   // one line per failed entry, for the report afterwards
+
+    void finish();
+    void fail(const std::string& message);
+};